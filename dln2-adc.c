@@ -156,7 +156,7 @@ static void dln2_adc_event(void)
 
     LOG1("%s:\n", __func__);
 
-    struct dln2_slot *slot = dln2_get_slot();
+    struct dln2_slot *slot = dln2_get_event_slot();
     if (!slot) {
         LOG1("Run out of slots!\n");
         return;
@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the logic analyzer capture of the DLN2 GPIO module.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+// Logic analyzer mode for the GPIO module.
+//
+// A PIO state machine samples all the pins at a fixed rate and DMA writes the samples to a ring
+// buffer. dln2_capture_task() masks them to the captured pins, waits for the trigger condition
+// and run length encodes them into records that are sent as DLN2_GPIO_CAPTURE_EV events.
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "dln2.h"
+
+#define LOG1    //printf
+
+#define DLN2_GPIO_CAPTURE_EV    DLN2_CMD(0x88, DLN2_MODULE_GPIO)
+
+// log2 of the ring buffer size in bytes, DMA can wrap at most 32kB
+#ifndef DLN2_CAPTURE_RING_BITS
+#define DLN2_CAPTURE_RING_BITS  14
+#endif
+
+#define DLN2_CAPTURE_RING_SIZE  ((1 << DLN2_CAPTURE_RING_BITS) / sizeof(uint32_t))
+
+// Send the records collected so far when there hasn't been an event for this long
+#define DLN2_CAPTURE_FLUSH_US   10000
+
+// Samples handled per call to keep the main loop going
+#define DLN2_CAPTURE_BATCH      1024
+
+#define DLN2_CAPTURE_DMA_COUNT  0xffffffff
+
+struct dln2_capture_record {
+    uint32_t value;
+    uint16_t run;   // number of samples with this value
+} TU_ATTR_PACKED;
+
+struct dln2_capture_event {
+    uint16_t count;
+    uint32_t lost;  // samples dropped since the previous event because the ring buffer overflowed
+    struct dln2_capture_record records[];
+} TU_ATTR_PACKED;
+
+#define DLN2_CAPTURE_RECORDS \
+    ((DLN2_BUF_SIZE - sizeof(struct dln2_header) - sizeof(struct dln2_capture_event)) / \
+     sizeof(struct dln2_capture_record))
+
+static uint32_t dln2_capture_ring[DLN2_CAPTURE_RING_SIZE] __attribute__((aligned(1 << DLN2_CAPTURE_RING_BITS)));
+
+// in pins, 32 with autopush: one 32-bit sample of GPIO0-31 per clock
+static const uint16_t dln2_capture_program_instructions[] = {
+    0x4000, //  0: in     pins, 32
+};
+
+static const pio_program_t dln2_capture_program = {
+    .instructions = dln2_capture_program_instructions,
+    .length = 1,
+    .origin = -1,
+};
+
+static struct {
+    bool running;
+    bool triggered;
+    PIO pio;
+    uint sm;
+    uint offset;
+    uint dma;
+    uint32_t mask;
+    uint32_t claimed;
+    uint32_t trigger_mask;
+    uint32_t trigger_value;
+    uint32_t dma_base;      // samples written by the previous DMA runs
+    uint32_t read;          // samples handled
+    uint32_t lost;
+    uint32_t lost_total;
+    struct dln2_capture_record run;
+    struct dln2_capture_record records[DLN2_CAPTURE_RECORDS];
+    uint num_records;
+    uint64_t last_flush;
+} dln2_capture;
+
+static void dln2_capture_free_pins(uint32_t pins)
+{
+    for (; pins; pins &= pins - 1)
+        dln2_pin_free(__builtin_ctz(pins), DLN2_MODULE_GPIO);
+}
+
+bool dln2_capture_start(struct dln2_slot *slot)
+{
+    struct {
+        uint32_t mask;
+        uint32_t rate;
+        uint32_t trigger_mask;
+        uint32_t trigger_value;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+
+    LOG1("%s: mask=0x%08x rate=%u trigger_mask=0x%08x trigger_value=0x%08x\n",
+         __func__, cmd->mask, cmd->rate, cmd->trigger_mask, cmd->trigger_value);
+
+    if (dln2_capture.running)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+
+    if (!cmd->mask || cmd->mask >> NUM_BANK0_GPIOS)
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+
+    if (cmd->trigger_mask & ~cmd->mask)
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+
+    // The clock divider has 8 fractional bits and runs from 1 to 65536
+    uint32_t sys_hz = clock_get_hz(clk_sys);
+    uint64_t div = cmd->rate ? ((uint64_t)sys_hz << 8) / cmd->rate : 0;
+    if (div < (1 << 8) || div >= (65536 << 8))
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+
+    // Pins already enabled by the GPIO module can be captured too, they're only read
+    uint32_t claimed = 0;
+    for (uint32_t pins = cmd->mask & ~dln2_pin_requested_mask(DLN2_MODULE_GPIO); pins; pins &= pins - 1) {
+        uint pin = __builtin_ctz(pins);
+        uint16_t res = dln2_pin_request(pin, DLN2_MODULE_GPIO);
+        if (res) {
+            dln2_capture_free_pins(claimed);
+            return dln2_response_error(slot, res);
+        }
+        claimed |= 1U << pin;
+    }
+
+    PIO pio = pio0;
+    int sm = pio_can_add_program(pio, &dln2_capture_program) ? pio_claim_unused_sm(pio, false) : -1;
+    int dma = sm >= 0 ? dma_claim_unused_channel(false) : -1;
+    if (dma < 0) {
+        LOG1("%s: Out of PIO/DMA resources\n", __func__);
+        if (sm >= 0)
+            pio_sm_unclaim(pio, sm);
+        dln2_capture_free_pins(claimed);
+        return dln2_response_error(slot, DLN2_RES_FAIL);
+    }
+
+    uint offset = pio_add_program(pio, &dln2_capture_program);
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset, offset);
+    sm_config_set_in_pins(&c, 0);
+    sm_config_set_in_shift(&c, false, true, 32);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    sm_config_set_clkdiv_int_frac(&c, div >> 8, div & 0xff);
+    pio_sm_init(pio, sm, offset, &c);
+
+    dma_channel_config dc = dma_channel_get_default_config(dma);
+    channel_config_set_transfer_data_size(&dc, DMA_SIZE_32);
+    channel_config_set_read_increment(&dc, false);
+    channel_config_set_write_increment(&dc, true);
+    channel_config_set_ring(&dc, true, DLN2_CAPTURE_RING_BITS);
+    channel_config_set_dreq(&dc, pio_get_dreq(pio, sm, false));
+    dma_channel_configure(dma, &dc, dln2_capture_ring, &pio->rxf[sm], DLN2_CAPTURE_DMA_COUNT, true);
+
+    memset(&dln2_capture, 0, sizeof(dln2_capture));
+    dln2_capture.pio = pio;
+    dln2_capture.sm = sm;
+    dln2_capture.offset = offset;
+    dln2_capture.dma = dma;
+    dln2_capture.mask = cmd->mask;
+    dln2_capture.claimed = claimed;
+    dln2_capture.trigger_mask = cmd->trigger_mask;
+    dln2_capture.trigger_value = cmd->trigger_value & cmd->trigger_mask;
+    dln2_capture.last_flush = time_us_64();
+    dln2_capture.running = true;
+
+    pio_sm_set_enabled(pio, sm, true);
+
+    return dln2_response_u32(slot, ((uint64_t)sys_hz << 8) / div);
+}
+
+static bool dln2_capture_flush(void)
+{
+    struct dln2_capture_event *ev;
+
+    if (!dln2_capture.num_records && !dln2_capture.lost)
+        return true;
+
+    struct dln2_slot *slot = dln2_get_event_slot();
+    if (!slot) {
+        LOG1("Run out of slots!\n");
+        return false;
+    }
+
+    size_t len = sizeof(*ev) + dln2_capture.num_records * sizeof(struct dln2_capture_record);
+
+    struct dln2_header *hdr = dln2_slot_header(slot);
+    hdr->size = sizeof(*hdr) + len;
+    hdr->id = DLN2_GPIO_CAPTURE_EV;
+    hdr->echo = 0;
+    hdr->handle = DLN2_HANDLE_EVENT;
+
+    ev = dln2_slot_header_data(slot);
+    ev->count = dln2_capture.num_records;
+    ev->lost = dln2_capture.lost;
+    memcpy(ev->records, dln2_capture.records, dln2_capture.num_records * sizeof(struct dln2_capture_record));
+
+    dln2_capture.num_records = 0;
+    dln2_capture.lost = 0;
+    dln2_capture.last_flush = time_us_64();
+
+    dln2_queue_slot_in(slot);
+
+    return true;
+}
+
+// Close the current run, returns false if there's no room for it
+static bool dln2_capture_close_run(void)
+{
+    if (!dln2_capture.run.run)
+        return true;
+
+    if (dln2_capture.num_records == DLN2_CAPTURE_RECORDS && !dln2_capture_flush())
+        return false;
+
+    dln2_capture.records[dln2_capture.num_records++] = dln2_capture.run;
+    dln2_capture.run.run = 0;
+
+    return true;
+}
+
+static void dln2_capture_process(uint32_t written)
+{
+    uint32_t avail = written - dln2_capture.read;
+
+    // Skip ahead if DMA has overwritten samples we haven't handled, leave some room so it doesn't happen again right away
+    if (avail > DLN2_CAPTURE_RING_SIZE) {
+        uint32_t skip = avail - DLN2_CAPTURE_RING_SIZE / 2;
+        LOG1("%s: overflow, skipping %u samples\n", __func__, skip);
+        if (!dln2_capture_close_run())
+            return;
+        dln2_capture.read += skip;
+        dln2_capture.lost += skip;
+        dln2_capture.lost_total += skip;
+        avail -= skip;
+    }
+
+    if (avail > DLN2_CAPTURE_BATCH)
+        avail = DLN2_CAPTURE_BATCH;
+
+    for (; avail; avail--) {
+        uint32_t value = dln2_capture_ring[dln2_capture.read % DLN2_CAPTURE_RING_SIZE] & dln2_capture.mask;
+
+        if (!dln2_capture.triggered) {
+            dln2_capture.read++;
+            if ((value & dln2_capture.trigger_mask) != dln2_capture.trigger_value)
+                continue;
+            LOG1("%s: triggered value=0x%08x\n", __func__, value);
+            dln2_capture.triggered = true;
+            dln2_capture.run.value = value;
+            dln2_capture.run.run = 1;
+            continue;
+        }
+
+        if (value != dln2_capture.run.value || dln2_capture.run.run == UINT16_MAX) {
+            if (!dln2_capture_close_run())
+                return;
+            dln2_capture.run.value = value;
+        }
+        dln2_capture.run.run++;
+        dln2_capture.read++;
+    }
+}
+
+static uint32_t dln2_capture_written(void)
+{
+    // Start over if the transfer count has run out
+    if (!dma_channel_is_busy(dln2_capture.dma)) {
+        dln2_capture.dma_base += DLN2_CAPTURE_DMA_COUNT;
+        dma_channel_set_trans_count(dln2_capture.dma, DLN2_CAPTURE_DMA_COUNT, true);
+    }
+
+    return dln2_capture.dma_base + (DLN2_CAPTURE_DMA_COUNT - dma_channel_hw_addr(dln2_capture.dma)->transfer_count);
+}
+
+void dln2_capture_task(void)
+{
+    if (!dln2_capture.running)
+        return;
+
+    dln2_capture_process(dln2_capture_written());
+
+    // A run can go on for a long time, send what we have so the host can keep up
+    if (time_us_64() - dln2_capture.last_flush >= DLN2_CAPTURE_FLUSH_US) {
+        if (dln2_capture_close_run())
+            dln2_capture_flush();
+    }
+}
+
+bool dln2_capture_stop(struct dln2_slot *slot)
+{
+    LOG1("%s\n", __func__);
+
+    if (dln2_slot_header_data_size(slot))
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+
+    if (!dln2_capture.running)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+
+    pio_sm_set_enabled(dln2_capture.pio, dln2_capture.sm, false);
+
+    // Send what's left if there's room for it
+    uint32_t written = dln2_capture_written();
+    while (written != dln2_capture.read) {
+        uint32_t read = dln2_capture.read;
+        dln2_capture_process(written);
+        if (read == dln2_capture.read)
+            break;
+    }
+    if (dln2_capture_close_run())
+        dln2_capture_flush();
+
+    dma_channel_abort(dln2_capture.dma);
+    dma_channel_unclaim(dln2_capture.dma);
+    pio_sm_unclaim(dln2_capture.pio, dln2_capture.sm);
+    pio_remove_program(dln2_capture.pio, &dln2_capture_program, dln2_capture.offset);
+    dln2_capture_free_pins(dln2_capture.claimed);
+    dln2_capture.running = false;
+
+    return dln2_response_u32(slot, dln2_capture.lost_total);
+}
@@ -22,6 +22,7 @@
 
 #define DLN2_GPIO_GET_PIN_COUNT         DLN2_GPIO_CMD(0x01)
 #define DLN2_GPIO_SET_DEBOUNCE          DLN2_GPIO_CMD(0x04)
+#define DLN2_GPIO_GET_DEBOUNCE          DLN2_GPIO_CMD(0x05)
 #define DLN2_GPIO_PIN_GET_VAL           DLN2_GPIO_CMD(0x0B)
 #define DLN2_GPIO_PIN_SET_OUT_VAL       DLN2_GPIO_CMD(0x0C)
 #define DLN2_GPIO_PIN_GET_OUT_VAL       DLN2_GPIO_CMD(0x0D)
@@ -32,13 +33,33 @@
 #define DLN2_GPIO_PIN_GET_DIRECTION     DLN2_GPIO_CMD(0x14)
 #define DLN2_GPIO_PIN_SET_EVENT_CFG     DLN2_GPIO_CMD(0x1E)
 
+// Commands from 0x80 and up are extensions specific to this board
+#define DLN2_GPIO_GET_EVENT_OVERFLOWS   DLN2_GPIO_CMD(0x80)
+#define DLN2_GPIO_PIN_SET_EVENT_POLICY  DLN2_GPIO_CMD(0x81)
+#define DLN2_GPIO_PORT_GET_VAL          DLN2_GPIO_CMD(0x82)
+#define DLN2_GPIO_PORT_GET_OUT_VAL      DLN2_GPIO_CMD(0x83)
+#define DLN2_GPIO_PORT_SET_OUT_VAL      DLN2_GPIO_CMD(0x84)
+#define DLN2_GPIO_PORT_SET_DIRECTION    DLN2_GPIO_CMD(0x85)
+#define DLN2_GPIO_CAPTURE_START         DLN2_GPIO_CMD(0x86)
+#define DLN2_GPIO_CAPTURE_STOP          DLN2_GPIO_CMD(0x87)
+#define DLN2_GPIO_PIN_SET_TRIGGER       DLN2_GPIO_CMD(0x89)
+
 #define DLN2_GPIO_EVENT_NONE            0
 #define DLN2_GPIO_EVENT_CHANGE          1
 #define DLN2_GPIO_EVENT_LVL_HIGH        2
 #define DLN2_GPIO_EVENT_LVL_LOW         3
+#define DLN2_GPIO_EVENT_ALWAYS          4
+
+// Event policies, set per pin with DLN2_GPIO_PIN_SET_EVENT_POLICY
+#define DLN2_GPIO_EVENT_POLICY_ALL          0   // one event per edge
+#define DLN2_GPIO_EVENT_POLICY_COALESCE     1   // latest value and the number of edges since the last event
+#define DLN2_GPIO_EVENT_POLICY_RATE_LIMIT   2   // one event per edge up to a rate, then coalesce
 
 #define DLN2_GPIO_NUM_PINS  29
 
+// How often bouncing pins are checked, a quarter of the debounce interval but not more often than this
+#define DLN2_GPIO_DEBOUNCE_TICK_MIN_US  100
+
 #ifdef PICO_DEFAULT_LED_PIN
   #define LED_PIN   PICO_DEFAULT_LED_PIN
 #else
@@ -58,14 +79,60 @@
 static uint32_t prev_values;
 
 struct dln2_gpio_event {
+    uint64_t timestamp;
     uint8_t gpio;
-    uint8_t events;
     uint8_t value;
 };
 
-#define DLN2_GPIO_MAX_EVENTS    32
-static struct dln2_gpio_event dln2_gpio_events[DLN2_GPIO_MAX_EVENTS];
-uint16_t dln2_gpio_event_count;
+#ifndef DLN2_GPIO_EVENT_QUEUE_SIZE
+#define DLN2_GPIO_EVENT_QUEUE_SIZE  32
+#endif
+
+static_assert(!(DLN2_GPIO_EVENT_QUEUE_SIZE & (DLN2_GPIO_EVENT_QUEUE_SIZE - 1)),
+              "DLN2_GPIO_EVENT_QUEUE_SIZE must be a power of 2");
+
+// Single producer (the irq callbacks) and single consumer (dln2_gpio_task()) ring buffer.
+// The indices are free running and each side only writes its own, so no locking is needed.
+// The gpio and debounce timer irqs have the same priority so they don't preempt each other.
+static struct {
+    struct dln2_gpio_event events[DLN2_GPIO_EVENT_QUEUE_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t overflows;
+} dln2_gpio_event_queue;
+
+// Edges that are not queued as separate events are merged here per pin.
+// The irq callbacks only write edges and the task only writes delivered.
+static struct dln2_gpio_pin {
+    uint8_t type;
+    uint8_t policy;
+    uint16_t rate;              // events per millisecond
+    uint32_t window;            // millisecond the rate is counted in
+    uint16_t window_events;
+    volatile uint16_t edges;
+    volatile uint16_t delivered;
+    uint64_t timestamp;         // latest merged edge
+    uint64_t last_edge;         // debounce: the level has been stable since
+    uint16_t period;            // periodic events: milliseconds between them
+    uint32_t next_tick;
+} dln2_gpio_pins[DLN2_GPIO_NUM_PINS];
+
+// Debounce: an edge restarts the interval and the level is reported when it has been stable that long
+static uint32_t dln2_gpio_debounce_us;
+static uint32_t dln2_gpio_bouncing;
+static repeating_timer_t dln2_gpio_debounce_timer;
+static bool dln2_gpio_debounce_timer_running;
+
+// Periodic events for all pins are driven by one 1ms timer that only runs while there are any
+static uint32_t dln2_gpio_periodic;
+static uint32_t dln2_gpio_ticks;
+static repeating_timer_t dln2_gpio_period_timer;
+static bool dln2_gpio_period_timer_running;
+
+static bool dln2_gpio_period_timer_callback(repeating_timer_t *rt);
+
+// Pins with a policy that merges edges
+static uint32_t dln2_gpio_coalesce_mask;
 
 static const char *dln2_gpio_id_to_name(uint16_t id)
 {
@@ -74,6 +141,8 @@ static const char *dln2_gpio_id_to_name(uint16_t id)
         return "GPIO_GET_PIN_COUNT";
     case DLN2_GPIO_SET_DEBOUNCE:
         return "GPIO_SET_DEBOUNCE";
+    case DLN2_GPIO_GET_DEBOUNCE:
+        return "GPIO_GET_DEBOUNCE";
     case DLN2_GPIO_PIN_GET_VAL:
         return "GPIO_PIN_GET_VAL";
     case DLN2_GPIO_PIN_SET_OUT_VAL:
@@ -92,6 +161,24 @@ static const char *dln2_gpio_id_to_name(uint16_t id)
         return "GPIO_PIN_GET_DIRECTION";
     case DLN2_GPIO_PIN_SET_EVENT_CFG:
         return "GPIO_PIN_SET_EVENT_CFG";
+    case DLN2_GPIO_GET_EVENT_OVERFLOWS:
+        return "GPIO_GET_EVENT_OVERFLOWS";
+    case DLN2_GPIO_PIN_SET_EVENT_POLICY:
+        return "GPIO_PIN_SET_EVENT_POLICY";
+    case DLN2_GPIO_PORT_GET_VAL:
+        return "GPIO_PORT_GET_VAL";
+    case DLN2_GPIO_PORT_GET_OUT_VAL:
+        return "GPIO_PORT_GET_OUT_VAL";
+    case DLN2_GPIO_PORT_SET_OUT_VAL:
+        return "GPIO_PORT_SET_OUT_VAL";
+    case DLN2_GPIO_PORT_SET_DIRECTION:
+        return "GPIO_PORT_SET_DIRECTION";
+    case DLN2_GPIO_CAPTURE_START:
+        return "GPIO_CAPTURE_START";
+    case DLN2_GPIO_CAPTURE_STOP:
+        return "GPIO_CAPTURE_STOP";
+    case DLN2_GPIO_PIN_SET_TRIGGER:
+        return "GPIO_PIN_SET_TRIGGER";
     }
     return NULL;
 }
@@ -138,6 +225,21 @@ static bool dln2_gpio_response_pin_val(struct dln2_slot *slot, uint16_t pin, uin
     return dln2_response(slot, val ? 3 : 2);
 }
 
+static void dln2_gpio_pin_policy_set(uint pin, uint8_t policy, uint16_t rate)
+{
+    struct dln2_gpio_pin *p = &dln2_gpio_pins[pin];
+
+    uint32_t ints = save_and_disable_interrupts();
+
+    p->policy = policy;
+    p->rate = rate;
+    p->window_events = 0;
+    p->delivered = p->edges;
+    assign_bit(pin, dln2_gpio_coalesce_mask, policy != DLN2_GPIO_EVENT_POLICY_ALL);
+
+    restore_interrupts(ints);
+}
+
 static bool dln2_gpio_pin_enable(struct dln2_slot *slot, bool enable)
 {
     int pin = dln2_gpio_slot_pin_val(slot, NULL);
@@ -163,6 +265,13 @@ static bool dln2_gpio_pin_enable(struct dln2_slot *slot, bool enable)
             return dln2_response_error(slot, res);
         if (pin != LED_PIN)
             gpio_deinit(pin);
+        dln2_gpio_pin_policy_set(pin, DLN2_GPIO_EVENT_POLICY_ALL, 0);
+        dln2_trigger_clear(pin);
+
+        uint32_t ints = save_and_disable_interrupts();
+        assign_bit(pin, dln2_gpio_bouncing, 0);
+        assign_bit(pin, dln2_gpio_periodic, 0);
+        restore_interrupts(ints);
     }
     return dln2_response(slot, 0);
 }
@@ -182,38 +291,180 @@ static bool dln2_gpio_pin_set_event_cfg(struct dln2_slot *slot)
     if (!dln2_pin_is_requested(cmd->pin, DLN2_MODULE_GPIO))
         return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
 
-    if (cmd->period)
-        return dln2_response_error(slot, DLN2_RES_INVALID_EVENT_PERIOD);
-
     if (cmd->pin == LED_PIN)
         return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
 
-    assign_bit(cmd->pin, prev_values, gpio_get(cmd->pin));
-
     switch (cmd->type) {
     case DLN2_GPIO_EVENT_NONE:
-        gpio_set_irq_enabled(cmd->pin, GPIO_IRQ_LEVEL_LOW | GPIO_IRQ_LEVEL_HIGH | GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, false);
-        break;
     // The Linux driver always uses this so we don't know which edge(s) it actually cares about.
     case DLN2_GPIO_EVENT_CHANGE:
-        gpio_set_irq_enabled(cmd->pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true);
+        if (cmd->period)
+            return dln2_response_error(slot, DLN2_RES_INVALID_EVENT_PERIOD);
         break;
     // The Linux driver doesn't use these, maybe because they were mistaken to be only level
     // interrupts, but with period=0 they are actually edge interrupts according to the docs:
     // http://dlnware.com/dll/DLN_GPIO_EVENT_LEVEL_HIGH-Events
+    // With a period the event is repeated as long as the level stays the same.
     case DLN2_GPIO_EVENT_LVL_HIGH:
-        gpio_set_irq_enabled(cmd->pin, GPIO_IRQ_EDGE_RISE, true);
-        break;
     case DLN2_GPIO_EVENT_LVL_LOW:
-        gpio_set_irq_enabled(cmd->pin, GPIO_IRQ_EDGE_FALL, true);
+        break;
+    // The level is sent every period whatever it is
+    case DLN2_GPIO_EVENT_ALWAYS:
+        if (!cmd->period)
+            return dln2_response_error(slot, DLN2_RES_INVALID_EVENT_PERIOD);
         break;
     default:
         return dln2_response_error(slot, DLN2_RES_INVALID_EVENT_TYPE);
     }
 
+    struct dln2_gpio_pin *p = &dln2_gpio_pins[cmd->pin];
+    bool edges = cmd->type != DLN2_GPIO_EVENT_NONE && cmd->type != DLN2_GPIO_EVENT_ALWAYS;
+
+    uint32_t ints = save_and_disable_interrupts();
+
+    // Both edges are always used so prev_values follows the level, the type filters the events
+    p->type = cmd->type;
+    p->period = cmd->period;
+    p->next_tick = dln2_gpio_ticks + cmd->period;
+    assign_bit(cmd->pin, prev_values, gpio_get(cmd->pin));
+    assign_bit(cmd->pin, dln2_gpio_bouncing, 0);
+    assign_bit(cmd->pin, dln2_gpio_periodic, cmd->period);
+    gpio_set_irq_enabled(cmd->pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, edges);
+
+    if (dln2_gpio_periodic && !dln2_gpio_period_timer_running) {
+        dln2_gpio_period_timer_running = add_repeating_timer_us(-1000, dln2_gpio_period_timer_callback,
+                                                                NULL, &dln2_gpio_period_timer);
+        if (!dln2_gpio_period_timer_running)
+            LOG1("GPIO: Failed to add period timer\n");
+    }
+
+    restore_interrupts(ints);
+
+    if (dln2_gpio_periodic && !dln2_gpio_period_timer_running)
+        return dln2_response_error(slot, DLN2_RES_FAIL);
+
+    return dln2_response(slot, 0);
+}
+
+static bool dln2_gpio_pin_set_event_policy(struct dln2_slot *slot)
+{
+    struct {
+        uint16_t pin;
+        uint8_t policy;
+        uint16_t rate;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+
+    LOG1("\nDLN2_GPIO_PIN_SET_EVENT_POLICY: pin=%u policy=%u rate=%u\n", cmd->pin, cmd->policy, cmd->rate);
+
+    if (!dln2_pin_is_requested(cmd->pin, DLN2_MODULE_GPIO))
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+
+    switch (cmd->policy) {
+    case DLN2_GPIO_EVENT_POLICY_ALL:
+    case DLN2_GPIO_EVENT_POLICY_COALESCE:
+        break;
+    case DLN2_GPIO_EVENT_POLICY_RATE_LIMIT:
+        if (!cmd->rate)
+            return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+        break;
+    default:
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+    }
+
+    dln2_gpio_pin_policy_set(cmd->pin, cmd->policy, cmd->rate);
+
+    return dln2_response(slot, 0);
+}
+
+// The port commands work on all the pins at once. Bits for pins that are not enabled
+// read as zero and can't be in the mask when writing.
+static bool dln2_gpio_port_get(struct dln2_slot *slot, bool out)
+{
+    uint32_t mask = dln2_pin_requested_mask(DLN2_MODULE_GPIO);
+    uint32_t values = 0;
+
+    if (dln2_slot_header_data_size(slot))
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+
+    if (out) {
+        for (uint32_t m = mask; m; m &= m - 1) {
+            uint pin = __builtin_ctz(m);
+            if (gpio_get_out_level(pin))
+                values |= 1U << pin;
+        }
+    } else {
+        values = gpio_get_all() & mask;
+    }
+
+    LOG1("%s: out=%u mask=0x%08x values=0x%08x\n", __func__, out, mask, values);
+
+    return dln2_response_u32(slot, values);
+}
+
+static bool dln2_gpio_port_set(struct dln2_slot *slot, bool dir)
+{
+    struct {
+        uint32_t mask;
+        uint32_t values;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+
+    LOG1("%s: dir=%u mask=0x%08x values=0x%08x\n", __func__, dir, cmd->mask, cmd->values);
+
+    if (cmd->mask & ~dln2_pin_requested_mask(DLN2_MODULE_GPIO))
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+
+    // The SIO toggles all the pins with one register write
+    if (dir) {
+        if (LED_PIN < DLN2_GPIO_NUM_PINS && get_bit(LED_PIN, cmd->mask) && !get_bit(LED_PIN, cmd->values))
+            return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+        gpio_set_dir_masked(cmd->mask, cmd->values);
+    } else {
+        gpio_put_masked(cmd->mask, cmd->values);
+    }
+
     return dln2_response(slot, 0);
 }
 
+static bool dln2_gpio_debounce_timer_callback(repeating_timer_t *rt);
+
+static void dln2_gpio_debounce_timer_start(void)
+{
+    int64_t tick = tu_max32(dln2_gpio_debounce_us / 4, DLN2_GPIO_DEBOUNCE_TICK_MIN_US);
+
+    dln2_gpio_debounce_timer_running = add_repeating_timer_us(-tick, dln2_gpio_debounce_timer_callback,
+                                                              NULL, &dln2_gpio_debounce_timer);
+    if (!dln2_gpio_debounce_timer_running)
+        LOG1("GPIO: Failed to add debounce timer\n");
+}
+
+static bool dln2_gpio_set_debounce(struct dln2_slot *slot)
+{
+    struct {
+        uint32_t duration_us;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+
+    LOG1("DLN2_GPIO_SET_DEBOUNCE: duration_us=%u\n", cmd->duration_us);
+
+    uint32_t ints = save_and_disable_interrupts();
+
+    dln2_gpio_debounce_us = cmd->duration_us;
+    // Pins that are bouncing keep their deadline, the timer tick follows the new interval
+    if (dln2_gpio_debounce_timer_running) {
+        cancel_repeating_timer(&dln2_gpio_debounce_timer);
+        dln2_gpio_debounce_timer_start();
+    }
+
+    restore_interrupts(ints);
+
+    return dln2_response_u32(slot, dln2_gpio_debounce_us);
+}
+
 bool dln2_handle_gpio(struct dln2_slot *slot)
 {
     struct dln2_header *hdr = dln2_slot_header(slot);
@@ -226,11 +477,16 @@ bool dln2_handle_gpio(struct dln2_slot *slot)
         if (dln2_slot_header_data_size(slot))
             return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
         return dln2_response_u16(slot, DLN2_GPIO_NUM_PINS);
+    // The Linux driver can set the default debounce value, but it does not enable it for the pin,
+    // so it applies to all pins with events enabled. The DLN-2 adapter does not support debounce,
+    // but 4M and 4S do.
     case DLN2_GPIO_SET_DEBOUNCE:
-        // The Linux driver can set the default debounce value, but it does not enable it for the pin?!
-        // The DLN-2 adapter does not support debounce, but 4M and 4S do.
-        LOG1("DLN2_GPIO_SET_DEBOUNCE\n");
-        return dln2_response_error(slot, DLN2_RES_COMMAND_NOT_SUPPORTED);
+        return dln2_gpio_set_debounce(slot);
+    case DLN2_GPIO_GET_DEBOUNCE:
+        LOG1("DLN2_GPIO_GET_DEBOUNCE\n");
+        if (dln2_slot_header_data_size(slot))
+            return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+        return dln2_response_u32(slot, dln2_gpio_debounce_us);
     case DLN2_GPIO_PIN_GET_VAL:
         DLN2_GPIO_GET_PIN_VERIFY(slot, pin, NULL);
         val = gpio_get(pin);
@@ -259,42 +515,73 @@ bool dln2_handle_gpio(struct dln2_slot *slot)
         return dln2_gpio_response_pin_val(slot, pin, &val);
     case DLN2_GPIO_PIN_SET_EVENT_CFG:
         return dln2_gpio_pin_set_event_cfg(slot);
+    case DLN2_GPIO_GET_EVENT_OVERFLOWS:
+        LOG1("DLN2_GPIO_GET_EVENT_OVERFLOWS\n");
+        if (dln2_slot_header_data_size(slot))
+            return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+        return dln2_response_u32(slot, dln2_gpio_event_queue.overflows);
+    case DLN2_GPIO_PIN_SET_EVENT_POLICY:
+        return dln2_gpio_pin_set_event_policy(slot);
+    case DLN2_GPIO_PORT_GET_VAL:
+        return dln2_gpio_port_get(slot, false);
+    case DLN2_GPIO_PORT_GET_OUT_VAL:
+        return dln2_gpio_port_get(slot, true);
+    case DLN2_GPIO_PORT_SET_OUT_VAL:
+        return dln2_gpio_port_set(slot, false);
+    case DLN2_GPIO_PORT_SET_DIRECTION:
+        return dln2_gpio_port_set(slot, true);
+    case DLN2_GPIO_CAPTURE_START:
+        return dln2_capture_start(slot);
+    case DLN2_GPIO_CAPTURE_STOP:
+        return dln2_capture_stop(slot);
+    case DLN2_GPIO_PIN_SET_TRIGGER:
+        return dln2_trigger_set(slot);
     default:
         LOG1("GPIO command not supported: 0x%04x\n", hdr->id);
         return dln2_response_error(slot, DLN2_RES_COMMAND_NOT_SUPPORTED);
     }
 }
 
-static bool dln2_gpio_queue_event(struct dln2_gpio_event *event)
+static bool dln2_gpio_queue_event(struct dln2_gpio_event *event, uint16_t count)
 {
     struct {
         uint16_t count;
         uint8_t type;
         uint16_t pin;
         uint8_t value;
+        uint64_t timestamp; // DLN2_FEATURE_GPIO_TIMESTAMP
     } TU_ATTR_PACKED *ev;
+    size_t len = sizeof(*ev);
 
-    LOG1("%s(gpio=%u, value=%u)\n", __func__, event->gpio, event->value);
+    LOG1("%s(gpio=%u, value=%u, count=%u)\n", __func__, event->gpio, event->value, count);
 
-    struct dln2_slot *slot = dln2_get_slot();
+    // The transaction is run instead and its result is the event
+    if (dln2_trigger_is_set(event->gpio))
+        return dln2_trigger_run(event->gpio, event->value, count, event->timestamp);
+
+    struct dln2_slot *slot = dln2_get_event_slot();
     if (!slot) {
         LOG1("Run out of slots!\n");
         LOG2("-\n");
         return false;
     }
 
+    if (!dln2_feature_enabled(DLN2_FEATURE_GPIO_TIMESTAMP))
+        len -= sizeof(ev->timestamp);
+
     struct dln2_header *hdr = dln2_slot_header(slot);
-    hdr->size = sizeof(*hdr) + sizeof(*ev);
+    hdr->size = sizeof(*hdr) + len;
     hdr->id = DLN2_GPIO_CONDITION_MET_EV;
     hdr->echo = 0;
     hdr->handle = DLN2_HANDLE_EVENT;
 
     ev = dln2_slot_header_data(slot);
     // The Linux driver ignores count and type
-    ev->count = dln2_gpio_event_count;
+    ev->count = count;
     ev->type = 0;
     ev->pin = event->gpio;
     ev->value = event->value;
+    ev->timestamp = event->timestamp;
 
     dln2_print_slot(slot);
     dln2_queue_slot_in(slot);
@@ -304,27 +591,169 @@ static bool dln2_gpio_queue_event(struct dln2_gpio_event *event)
 
 void dln2_gpio_task(void)
 {
-    bool queued;
+    uint32_t tail = dln2_gpio_event_queue.tail;
 
-    do {
-        queued = false;
-        uint32_t ints = save_and_disable_interrupts();
+    while (tail != dln2_gpio_event_queue.head) {
+        // Don't read the event before the producer is done writing it
+        __dmb();
+
+        struct dln2_gpio_event *event = &dln2_gpio_event_queue.events[tail % DLN2_GPIO_EVENT_QUEUE_SIZE];
+        if (!dln2_gpio_queue_event(event, 1))
+            return;
+
+        // Don't hand the entry back before we're done with it
+        __dmb();
+        dln2_gpio_event_queue.tail = ++tail;
+    }
+
+    // Merged edges go after the separate events for the same pin
+    for (uint32_t mask = dln2_gpio_coalesce_mask; mask; mask &= mask - 1) {
+        uint pin = __builtin_ctz(mask);
+        struct dln2_gpio_pin *p = &dln2_gpio_pins[pin];
+        struct dln2_gpio_event event = {
+            .gpio = pin,
+        };
+        uint16_t edges;
+
+        if (p->edges == p->delivered)
+            continue;
+
+        // prev_values and the timestamp are written before edges is incremented,
+        // read them again if an edge came in meanwhile.
+        do {
+            edges = p->edges;
+            __dmb();
+            event.value = get_bit(pin, prev_values);
+            event.timestamp = p->timestamp;
+            __dmb();
+        } while (edges != p->edges);
+
+        if (!dln2_gpio_queue_event(&event, edges - p->delivered))
+            return;
+        p->delivered = edges;
+    }
+}
+
+// Called from interrupt context
+static void dln2_gpio_event_push(uint gpio, bool value, uint64_t timestamp)
+{
+    uint32_t head = dln2_gpio_event_queue.head;
+
+    if (head - dln2_gpio_event_queue.tail == DLN2_GPIO_EVENT_QUEUE_SIZE) {
+        LOG1("dln2_gpio_event_queue is FULL\n");
+        dln2_gpio_event_queue.overflows++;
+        return;
+    }
+
+    struct dln2_gpio_event *event = &dln2_gpio_event_queue.events[head % DLN2_GPIO_EVENT_QUEUE_SIZE];
+    event->timestamp = timestamp;
+    event->gpio = gpio;
+    event->value = value;
+
+    // Publish the event after it has been written
+    __dmb();
+    dln2_gpio_event_queue.head = head + 1;
+}
+
+// Called from interrupt context
+static void dln2_gpio_edge_merge(struct dln2_gpio_pin *p, uint64_t timestamp)
+{
+    p->timestamp = timestamp;
+    __dmb();
+    p->edges++;
+}
+
+// Called from interrupt context when the level of @gpio has changed
+static void dln2_gpio_edge(uint gpio, bool value, uint64_t timestamp)
+{
+    struct dln2_gpio_pin *p = &dln2_gpio_pins[gpio];
 
-        if (dln2_gpio_events[0].events) {
-            if (dln2_gpio_queue_event(&dln2_gpio_events[0])) {
-                for (int i = 0; i < (DLN2_GPIO_MAX_EVENTS - 1); i++) {
-                    dln2_gpio_events[i] = dln2_gpio_events[i + 1];
-                }
-                dln2_gpio_events[DLN2_GPIO_MAX_EVENTS - 1].events = 0;
-                queued = true;
-            }
+    assign_bit(gpio, prev_values, value);
+    // The period starts over on the edge into the level
+    p->next_tick = dln2_gpio_ticks + p->period;
+
+    if ((p->type == DLN2_GPIO_EVENT_LVL_HIGH && !value) ||
+        (p->type == DLN2_GPIO_EVENT_LVL_LOW && value))
+        return;
+
+    if (p->policy == DLN2_GPIO_EVENT_POLICY_RATE_LIMIT) {
+        uint32_t now = (uint32_t)(timestamp / 1000);
+        if (now != p->window) {
+            p->window = now;
+            p->window_events = 0;
         }
-        restore_interrupts(ints);
-    } while (queued);
+        // Keep merging while there are undelivered edges so the events stay in order
+        if (p->window_events < p->rate && p->edges == p->delivered) {
+            p->window_events++;
+            dln2_gpio_event_push(gpio, value, timestamp);
+        } else {
+            dln2_gpio_edge_merge(p, timestamp);
+        }
+    } else if (p->policy == DLN2_GPIO_EVENT_POLICY_COALESCE) {
+        dln2_gpio_edge_merge(p, timestamp);
+    } else {
+        dln2_gpio_event_push(gpio, value, timestamp);
+    }
+}
+
+static bool dln2_gpio_debounce_timer_callback(repeating_timer_t *rt)
+{
+    uint64_t now = time_us_64();
+
+    for (uint32_t mask = dln2_gpio_bouncing; mask; mask &= mask - 1) {
+        uint gpio = __builtin_ctz(mask);
+        struct dln2_gpio_pin *p = &dln2_gpio_pins[gpio];
+
+        if (now - p->last_edge < dln2_gpio_debounce_us)
+            continue;
+
+        assign_bit(gpio, dln2_gpio_bouncing, 0);
+
+        bool value = gpio_get(gpio);
+        LOG1("%s: gpio=%u value=%u prev_value=%u\n", __func__, gpio, value, get_bit(gpio, prev_values));
+        if (value != get_bit(gpio, prev_values))
+            dln2_gpio_edge(gpio, value, p->last_edge);
+    }
+
+    dln2_gpio_debounce_timer_running = dln2_gpio_bouncing;
+
+    return dln2_gpio_debounce_timer_running;
+}
+
+static bool dln2_gpio_period_timer_callback(repeating_timer_t *rt)
+{
+    uint64_t timestamp = time_us_64();
+    uint32_t ticks = ++dln2_gpio_ticks;
+
+    for (uint32_t mask = dln2_gpio_periodic; mask; mask &= mask - 1) {
+        uint gpio = __builtin_ctz(mask);
+        struct dln2_gpio_pin *p = &dln2_gpio_pins[gpio];
+
+        if ((int32_t)(ticks - p->next_tick) < 0)
+            continue;
+
+        p->next_tick = ticks + p->period;
+
+        // Periodic events report the level and don't go through the edge policy
+        bool value = get_bit(gpio, prev_values);
+        if (p->type == DLN2_GPIO_EVENT_ALWAYS)
+            value = gpio_get(gpio);
+        else if ((p->type == DLN2_GPIO_EVENT_LVL_HIGH) != value)
+            continue;
+
+        dln2_gpio_event_push(gpio, value, timestamp);
+    }
+
+    dln2_gpio_period_timer_running = dln2_gpio_periodic;
+
+    return dln2_gpio_period_timer_running;
 }
 
 static void dln2_gpio_irq_callback(uint gpio, uint32_t events)
 {
+    // Take the timestamp first, the rest of the latency is in the logs
+    uint64_t timestamp = time_us_64();
+
     if (gpio >= DLN2_GPIO_NUM_PINS)
         return;
 
@@ -351,6 +780,16 @@ static void dln2_gpio_irq_callback(uint gpio, uint32_t events)
         return;
     }
 
+    // Bounces are filtered before they reach the event queue
+    if (dln2_gpio_debounce_us) {
+        LOG1("%s: gpio=%u events=0x%x value=%u BOUNCE\n", __func__, gpio, events, value);
+        dln2_gpio_pins[gpio].last_edge = timestamp;
+        assign_bit(gpio, dln2_gpio_bouncing, 1);
+        if (!dln2_gpio_debounce_timer_running)
+            dln2_gpio_debounce_timer_start();
+        return;
+    }
+
     LOG1("%s: gpio=%u events=0x%x value=%u prev_value=%u %s\n",
          __func__, gpio, events, value, prev_value, prev_value == value ? "SKIP" : "");
 
@@ -359,23 +798,7 @@ static void dln2_gpio_irq_callback(uint gpio, uint32_t events)
         return;
     }
 
-    assign_bit(gpio, prev_values, value);
-    dln2_gpio_event_count++;
-
-    uint i;
-    for (i = 0; i < DLN2_GPIO_MAX_EVENTS; i++) {
-        if (!dln2_gpio_events[i].events)
-            break;
-    }
-
-    if (i == DLN2_GPIO_MAX_EVENTS) {
-        LOG1("dln2_gpio_events is FULL\n");
-        return;
-    }
-
-    dln2_gpio_events[i].gpio = gpio;
-    dln2_gpio_events[i].events = events;
-    dln2_gpio_events[i].value = value;
+    dln2_gpio_edge(gpio, value, timestamp);
     LOG2("%u\n", value);
 }
 
@@ -11,6 +11,9 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
 #include "hardware/i2c.h"
 #include "dln2.h"
@@ -27,10 +30,88 @@ static struct dln2_i2c_device **dln2_i2c_devices;
 #define DLN2_I2C_DISABLE                DLN2_I2C_CMD(0x02)
 #define DLN2_I2C_WRITE                  DLN2_I2C_CMD(0x06)
 #define DLN2_I2C_READ                   DLN2_I2C_CMD(0x07)
+#define DLN2_I2C_TRANSFER               DLN2_I2C_CMD(0x80)
+
+#define DLN2_I2C_FREQUENCY      (100 * 1000)
 
 // Linux driver timeout is 200ms
 #define DLN2_I2C_TIMEOUT_US     (150 * 1000)
 
+// A byte with its ack takes 90us at 100kHz, twice that leaves room for clock stretching. A blocking
+// message holds up the main loop for at most 53ms (263 bytes), well under the timeout above.
+#define DLN2_I2C_BYTE_US        200
+#define DLN2_I2C_BLOCKING_US(len)   (1000 + (len) * DLN2_I2C_BYTE_US)
+
+// The whole bus recovery including clock stretching, it takes about 150us without stretching
+#define DLN2_I2C_RECOVER_US     (2 * 1000)
+
+// Read data is returned after a 16-bit length
+#define DLN2_I2C_MAX_READ       (DLN2_BUF_SIZE - sizeof(struct dln2_response) - sizeof(uint16_t))
+
+#define DLN2_I2C_MAX_MSGS       16
+
+#define DLN2_I2C_M_RD           (1 << 0)
+
+struct dln2_i2c_msg {
+    uint8_t addr;
+    uint8_t flags;
+    uint16_t len;
+} TU_ATTR_PACKED;
+
+// Requests are turned into a message list that runs from dln2_i2c_task(). Messages to the same
+// address make up a group that DMA feeds to the controller as one transfer ending with a stop.
+// The list is moved out of the slot since the read data overwrites it.
+static struct {
+    struct dln2_slot *slot;     // request in progress
+    int dma_tx;
+    int dma_rx;
+    uint count;
+    uint index;                 // first message in the group on the bus
+    uint end;
+    bool blocking;              // the group goes out one message per dln2_i2c_task() pass
+    size_t tx_offset;
+    size_t rx_len;
+    uint16_t write_len;         // DLN2_I2C_WRITE data without the register address
+    uint64_t timeout;
+    struct dln2_i2c_msg msgs[DLN2_I2C_MAX_MSGS];
+    uint8_t tx[DLN2_BUF_SIZE];
+    uint32_t cmds[DLN2_BUF_SIZE + DLN2_I2C_MAX_READ];  // IC_DATA_CMD values, one per byte either way
+} dln2_i2c = {
+    .dma_tx = -1,
+    .dma_rx = -1,
+};
+
+// Without DMA channels the transfers are done blocking
+static void dln2_i2c_dma_claim(void)
+{
+    if (dln2_i2c.dma_rx >= 0)
+        return;
+
+    int tx = dma_claim_unused_channel(false);
+    int rx = dma_claim_unused_channel(false);
+    if (tx < 0 || rx < 0) {
+        if (tx >= 0)
+            dma_channel_unclaim(tx);
+        if (rx >= 0)
+            dma_channel_unclaim(rx);
+        return;
+    }
+
+    dln2_i2c.dma_tx = tx;
+    dln2_i2c.dma_rx = rx;
+}
+
+static void dln2_i2c_dma_unclaim(void)
+{
+    if (dln2_i2c.dma_rx < 0)
+        return;
+
+    dma_channel_unclaim(dln2_i2c.dma_tx);
+    dma_channel_unclaim(dln2_i2c.dma_rx);
+    dln2_i2c.dma_tx = -1;
+    dln2_i2c.dma_rx = -1;
+}
+
 static bool dln2_i2c_enable(struct dln2_slot *slot, bool enable)
 {
     uint8_t *port = dln2_slot_header_data(slot);
@@ -56,9 +137,10 @@ static bool dln2_i2c_enable(struct dln2_slot *slot, bool enable)
             return dln2_response_error(slot, res);
         }
 
-        i2c_init(i2c_default, 100 * 1000);
+        i2c_init(i2c_default, DLN2_I2C_FREQUENCY);
         gpio_set_function(scl, GPIO_FUNC_I2C);
         gpio_set_function(sda, GPIO_FUNC_I2C);
+        dln2_i2c_dma_claim();
     } else {
         res = dln2_pin_free(sda, DLN2_MODULE_I2C);
         if (res)
@@ -71,11 +153,305 @@ static bool dln2_i2c_enable(struct dln2_slot *slot, bool enable)
         gpio_set_function(sda, GPIO_FUNC_NULL);
         gpio_set_function(scl, GPIO_FUNC_NULL);
         i2c_deinit(i2c_default);
+        dln2_i2c_dma_unclaim();
     }
 
     return dln2_response(slot, 0);
 }
 
+static bool dln2_i2c_emulated(uint8_t addr)
+{
+    if (dln2_i2c_devices) {
+        for (struct dln2_i2c_device **ptr = dln2_i2c_devices; *ptr; ptr++) {
+            if (!(*ptr)->address || (*ptr)->address == addr)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Emulated devices get the message first, a device that fails it falls through to the bus
+static uint16_t dln2_i2c_xfer(uint8_t addr, bool read, uint8_t *buf, size_t len, bool nostop)
+{
+    if (dln2_i2c_devices) {
+        for (struct dln2_i2c_device **ptr = dln2_i2c_devices; *ptr; ptr++) {
+            struct dln2_i2c_device *dev = *ptr;
+            if (dev->address && dev->address != addr)
+                continue;
+
+            if (!(read ? dev->read(dev, addr, buf, len) : dev->write(dev, addr, buf, len)))
+                break;
+            return 0;
+        }
+    }
+
+    int ret;
+    if (read)
+        ret = i2c_read_timeout_us(i2c_default, addr, buf, len, nostop, DLN2_I2C_BLOCKING_US(len));
+    else
+        ret = i2c_write_timeout_us(i2c_default, addr, buf, len, nostop, DLN2_I2C_BLOCKING_US(len));
+    LOG2("        %s: read=%u ret=%d\n", __func__, read, ret);
+    if (ret < 0)
+        return DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED;
+    // The linux driver returns -EPROTO if length differs, so use a descriptive error (there was no read error code)
+    if (ret != len)
+        return DLN2_RES_I2C_MASTER_SENDING_DATA_FAILED;
+
+    return 0;
+}
+
+static void dln2_i2c_finish(uint16_t result)
+{
+    struct dln2_slot *slot = dln2_i2c.slot;
+    uint8_t *rx = dln2_slot_response_data(slot);
+
+    dln2_i2c.slot = NULL;
+
+    if (result) {
+        dln2_response_error(slot, result);
+        return;
+    }
+
+    if (dln2_slot_header(slot)->id == DLN2_I2C_WRITE) {
+        dln2_response(slot, dln2_i2c.write_len);
+        return;
+    }
+
+    put_unaligned_le16(dln2_i2c.rx_len, rx);
+    dln2_response(slot, dln2_i2c.rx_len + 2);
+}
+
+// The lines are open drain: driven low as outputs and released to the pull-ups as inputs
+static void dln2_i2c_line_low(uint pin)
+{
+    gpio_set_dir(pin, GPIO_OUT);
+    busy_wait_us_32(5);
+}
+
+// Returns false if the line is still low when the recovery runs out of time
+static bool dln2_i2c_line_release(uint pin, uint64_t deadline)
+{
+    gpio_set_dir(pin, GPIO_IN);
+    while (!gpio_get(pin)) {
+        if (time_us_64() > deadline)
+            return false;
+        busy_wait_us_32(1);
+    }
+    busy_wait_us_32(5);
+    return true;
+}
+
+// Clock out a device that holds SDA low in the middle of a byte and end with a stop
+static void dln2_i2c_recover(void)
+{
+    uint scl = PICO_DEFAULT_I2C_SCL_PIN;
+    uint sda = PICO_DEFAULT_I2C_SDA_PIN;
+    uint64_t deadline = time_us_64() + DLN2_I2C_RECOVER_US;
+
+    LOG1("    %s: sda=%u\n", __func__, gpio_get(sda));
+
+    // Both start out released with the output value at 0
+    gpio_init(scl);
+    gpio_init(sda);
+
+    bool ok = dln2_i2c_line_release(scl, deadline);
+    for (uint i = 0; ok && i < 9 && !gpio_get(sda); i++) {
+        dln2_i2c_line_low(scl);
+        ok = dln2_i2c_line_release(scl, deadline);
+    }
+
+    if (ok) {
+        dln2_i2c_line_low(scl);
+        dln2_i2c_line_low(sda);
+        if (dln2_i2c_line_release(scl, deadline))
+            dln2_i2c_line_release(sda, deadline);
+    }
+    gpio_set_dir(scl, GPIO_IN);
+    gpio_set_dir(sda, GPIO_IN);
+
+    // Reset the controller, it might be stuck too
+    i2c_init(i2c_default, DLN2_I2C_FREQUENCY);
+    gpio_set_function(scl, GPIO_FUNC_I2C);
+    gpio_set_function(sda, GPIO_FUNC_I2C);
+}
+
+// The group goes out as IC_DATA_CMD values: a restart between messages and a stop at the end
+static void dln2_i2c_dma_start(void)
+{
+    i2c_hw_t *hw = i2c_get_hw(i2c_default);
+    uint8_t addr = dln2_i2c.msgs[dln2_i2c.index].addr;
+    uint8_t *rx = dln2_slot_response_data(dln2_i2c.slot) + 2 + dln2_i2c.rx_len;
+    uint n = 0, rx_count = 0;
+
+    for (uint i = dln2_i2c.index; i < dln2_i2c.end; i++) {
+        struct dln2_i2c_msg *msg = &dln2_i2c.msgs[i];
+
+        for (uint j = 0; j < msg->len; j++) {
+            uint32_t cmd;
+            if (msg->flags & DLN2_I2C_M_RD) {
+                cmd = I2C_IC_DATA_CMD_CMD_BITS;
+                rx_count++;
+            } else {
+                cmd = dln2_i2c.tx[dln2_i2c.tx_offset++];
+            }
+            if (!j && i != dln2_i2c.index)
+                cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+            if (j == msg->len - 1 && i == dln2_i2c.end - 1)
+                cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+            dln2_i2c.cmds[n++] = cmd;
+        }
+    }
+    dln2_i2c.rx_len += rx_count;
+
+    LOG2("        %s: addr=0x%02x cmds=%u rx=%u\n", __func__, addr, n, rx_count);
+
+    hw->enable = 0;
+    hw->tar = addr;
+    (void)hw->clr_tx_abrt;
+    (void)hw->clr_stop_det;
+    hw->enable = 1;
+
+    if (rx_count) {
+        dma_channel_config c = dma_channel_get_default_config(dln2_i2c.dma_rx);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, i2c_get_dreq(i2c_default, false));
+        dma_channel_configure(dln2_i2c.dma_rx, &c, rx, &hw->data_cmd, rx_count, true);
+    }
+
+    dma_channel_config c = dma_channel_get_default_config(dln2_i2c.dma_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, i2c_get_dreq(i2c_default, true));
+    dma_channel_configure(dln2_i2c.dma_tx, &c, &hw->data_cmd, dln2_i2c.cmds, n, true);
+
+    dln2_i2c.timeout = time_us_64() + DLN2_I2C_TIMEOUT_US;
+}
+
+// Emulated devices and zero length messages which the controller can't do go out blocking, as does
+// everything without DMA. That's one message per dln2_i2c_task() pass, each bounded by
+// DLN2_I2C_BLOCKING_US(), so the other modules and USB get their turn in between.
+static void dln2_i2c_run(void)
+{
+    if (dln2_i2c.index < dln2_i2c.end) {
+        struct dln2_i2c_msg *msg = &dln2_i2c.msgs[dln2_i2c.index];
+        bool read = msg->flags & DLN2_I2C_M_RD;
+        uint8_t *buf = read ? dln2_slot_response_data(dln2_i2c.slot) + 2 + dln2_i2c.rx_len :
+                              dln2_i2c.tx + dln2_i2c.tx_offset;
+
+        uint16_t res = dln2_i2c_xfer(msg->addr, read, buf, msg->len, dln2_i2c.index < dln2_i2c.end - 1);
+        if (res) {
+            dln2_i2c_finish(res);
+            return;
+        }
+        if (read)
+            dln2_i2c.rx_len += msg->len;
+        else
+            dln2_i2c.tx_offset += msg->len;
+
+        if (++dln2_i2c.index < dln2_i2c.end)
+            return;
+    }
+
+    if (dln2_i2c.index == dln2_i2c.count) {
+        dln2_i2c_finish(0);
+        return;
+    }
+
+    uint8_t addr = dln2_i2c.msgs[dln2_i2c.index].addr;
+    dln2_i2c.blocking = dln2_i2c.dma_rx < 0 || dln2_i2c_emulated(addr);
+
+    while (dln2_i2c.end < dln2_i2c.count && dln2_i2c.msgs[dln2_i2c.end].addr == addr) {
+        if (!dln2_i2c.msgs[dln2_i2c.end].len)
+            dln2_i2c.blocking = true;
+        dln2_i2c.end++;
+    }
+
+    if (!dln2_i2c.blocking)
+        dln2_i2c_dma_start();
+}
+
+// The messages and write data are in dln2_i2c
+static bool dln2_i2c_start(struct dln2_slot *slot, uint count)
+{
+    dln2_i2c.slot = slot;
+    dln2_i2c.count = count;
+    dln2_i2c.index = 0;
+    dln2_i2c.end = 0;
+    dln2_i2c.tx_offset = 0;
+    dln2_i2c.rx_len = 0;
+
+    dln2_i2c_run();
+
+    return true;
+}
+
+void dln2_i2c_task(void)
+{
+    if (!dln2_i2c.slot)
+        return;
+
+    if (dln2_i2c.blocking) {
+        dln2_i2c_run();
+        return;
+    }
+
+    i2c_hw_t *hw = i2c_get_hw(i2c_default);
+    bool busy = dma_channel_is_busy(dln2_i2c.dma_tx) || dma_channel_is_busy(dln2_i2c.dma_rx);
+    uint32_t stat = hw->raw_intr_stat;
+
+    // The controller flushes the commands and sends a stop
+    if (stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        uint32_t source = hw->tx_abrt_source;
+
+        LOG1("I2C: abort source=0x%08x\n", source);
+        dma_channel_abort(dln2_i2c.dma_tx);
+        dma_channel_abort(dln2_i2c.dma_rx);
+        (void)hw->clr_tx_abrt;
+        dln2_i2c_finish(source & I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS ?
+                        DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED : DLN2_RES_I2C_MASTER_SENDING_DATA_FAILED);
+        return;
+    }
+
+    if (!busy && (stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS)) {
+        (void)hw->clr_stop_det;
+        dln2_i2c.index = dln2_i2c.end;
+        dln2_i2c_run();
+        return;
+    }
+
+    if (time_us_64() > dln2_i2c.timeout) {
+        LOG1("I2C: timeout\n");
+        dma_channel_abort(dln2_i2c.dma_tx);
+        dma_channel_abort(dln2_i2c.dma_rx);
+        dln2_i2c_recover();
+        dln2_i2c_finish(DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+    }
+}
+
+// Called before the slots are reset, a transfer cut short leaves the bus like a timeout does
+void dln2_i2c_reset(void)
+{
+    if (!dln2_i2c.slot)
+        return;
+
+    // A blocking group cut short between messages is left without its stop
+    if (!dln2_i2c.blocking) {
+        dma_channel_abort(dln2_i2c.dma_tx);
+        dma_channel_abort(dln2_i2c.dma_rx);
+    }
+    dln2_i2c_recover();
+    dln2_i2c.slot = NULL;
+}
+
+// One transfer at a time
+bool dln2_i2c_busy(struct dln2_slot *slot)
+{
+    return dln2_i2c.slot;
+}
+
 struct dln2_i2c_read_msg_tx {
     uint8_t port;
     uint8_t addr;
@@ -87,8 +463,7 @@ struct dln2_i2c_read_msg_tx {
 static bool dln2_i2c_read(struct dln2_slot *slot)
 {
     struct dln2_i2c_read_msg_tx *msg = dln2_slot_header_data(slot);
-    uint8_t *rx = dln2_slot_response_data(slot);
-    size_t len = msg->buf_len;
+    uint count = 0;
 
     LOG1("    %s: port=%u addr=0x%02x buf_len=%u\n", __func__, msg->port, msg->addr, msg->buf_len);
 
@@ -96,29 +471,20 @@ static bool dln2_i2c_read(struct dln2_slot *slot)
         return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
     if (msg->port)
         return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
-
-    if (dln2_i2c_devices) {
-        for (struct dln2_i2c_device **ptr = dln2_i2c_devices; *ptr; ptr++) {
-            struct dln2_i2c_device *dev = *ptr;
-            if (dev->address && dev->address != msg->addr)
-                continue;
-
-            if (!dev->read(dev, msg->addr, rx + 2, len))
-                break;
-            put_unaligned_le16(len, rx);
-            return dln2_response(slot, len + 2);
-        }
+    if (msg->mem_addr_len > sizeof(msg->mem_addr))
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+    if (msg->buf_len > DLN2_I2C_MAX_READ)
+        return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+
+    // The register address is written MSB first followed by a repeated start
+    if (msg->mem_addr_len) {
+        for (uint i = 0; i < msg->mem_addr_len; i++)
+            dln2_i2c.tx[i] = msg->mem_addr >> (8 * (msg->mem_addr_len - 1 - i));
+        dln2_i2c.msgs[count++] = (struct dln2_i2c_msg){ msg->addr, 0, msg->mem_addr_len };
     }
+    dln2_i2c.msgs[count++] = (struct dln2_i2c_msg){ msg->addr, DLN2_I2C_M_RD, msg->buf_len };
 
-    int ret = i2c_read_timeout_us(i2c_default, msg->addr, rx + 2, len, false, DLN2_I2C_TIMEOUT_US);
-    if (ret < 0)
-        return dln2_response_error(slot, DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
-    // The linux driver returns -EPROTO if length differs, so use a descriptive error (there was no read error code)
-    if (ret != len)
-        return dln2_response_error(slot, DLN2_RES_I2C_MASTER_SENDING_DATA_FAILED);
-
-    put_unaligned_le16(len, rx);
-    return dln2_response(slot, len + 2);
+    return dln2_i2c_start(slot, count);
 }
 
 struct dln2_i2c_write_msg {
@@ -136,31 +502,108 @@ static bool dln2_i2c_write(struct dln2_slot *slot)
 
     LOG1("    %s: port=%u addr=0x%02x buf_len=%u\n", __func__, msg->port, msg->addr, msg->buf_len);
 
-    if (dln2_slot_header_data_size(slot) < sizeof(*msg))
+    if (dln2_slot_header_data_size(slot) < sizeof(*msg) ||
+        dln2_slot_header_data_size(slot) != sizeof(*msg) + msg->buf_len)
         return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
     if (msg->port)
         return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
+    if (msg->mem_addr_len > sizeof(msg->mem_addr))
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
 
-    if (dln2_i2c_devices) {
-        for (struct dln2_i2c_device **ptr = dln2_i2c_devices; *ptr; ptr++) {
-            struct dln2_i2c_device *dev = *ptr;
-            if (dev->address && dev->address != msg->addr)
-                continue;
+    // The register address is written MSB first in front of the data
+    for (uint i = 0; i < msg->mem_addr_len; i++)
+        dln2_i2c.tx[i] = msg->mem_addr >> (8 * (msg->mem_addr_len - 1 - i));
+    memcpy(dln2_i2c.tx + msg->mem_addr_len, msg->buf, msg->buf_len);
+    dln2_i2c.msgs[0] = (struct dln2_i2c_msg){ msg->addr, 0, msg->mem_addr_len + msg->buf_len };
+    dln2_i2c.write_len = msg->buf_len;
 
-            if (!dev->write(dev, msg->addr, msg->buf, msg->buf_len))
-                break;
-            return dln2_response(slot, msg->buf_len);
-        }
+    return dln2_i2c_start(slot, 1);
+}
+
+// Like a Linux i2c_msg array: the messages are followed by the write data and joined with
+// repeated starts. A message to another address is preceded by a stop since the controller
+// can't change target in the middle of a transfer. The read data is returned in order.
+static bool dln2_i2c_transfer(struct dln2_slot *slot)
+{
+    struct {
+        uint8_t port;
+        uint8_t count;
+        struct dln2_i2c_msg msgs[];
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    size_t len = dln2_slot_header_data_size(slot);
+    size_t tx_len = 0, rx_len = 0;
+
+    if (len < 2 || len < 2 + cmd->count * sizeof(struct dln2_i2c_msg))
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+
+    LOG1("    %s: port=%u count=%u\n", __func__, cmd->port, cmd->count);
+
+    if (cmd->port)
+        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
+    if (!cmd->count || cmd->count > DLN2_I2C_MAX_MSGS)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+
+    for (uint i = 0; i < cmd->count; i++) {
+        struct dln2_i2c_msg *msg = &cmd->msgs[i];
+
+        if (msg->flags & ~DLN2_I2C_M_RD)
+            return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+        // The controller can't do zero length messages
+        if (!msg->len)
+            return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+        if (msg->flags & DLN2_I2C_M_RD)
+            rx_len += msg->len;
+        else
+            tx_len += msg->len;
     }
 
-    int ret = i2c_write_timeout_us(i2c_default, msg->addr, msg->buf, msg->buf_len, false, DLN2_I2C_TIMEOUT_US);
-    LOG2("        i2c_write_timeout_us: ret =%d\n", ret);
-    if (ret < 0)
-        return dln2_response_error(slot, DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
-    if (ret != msg->buf_len)
-        return dln2_response_error(slot, DLN2_RES_I2C_MASTER_SENDING_DATA_FAILED);
+    if (rx_len > DLN2_I2C_MAX_READ)
+        return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+    if (len != 2 + cmd->count * sizeof(struct dln2_i2c_msg) + tx_len)
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
 
-    return dln2_response(slot, msg->buf_len);
+    uint count = cmd->count;
+    memcpy(dln2_i2c.msgs, cmd->msgs, count * sizeof(struct dln2_i2c_msg));
+    memcpy(dln2_i2c.tx, &cmd->msgs[count], tx_len);
+
+    return dln2_i2c_start(slot, count);
+}
+
+// The response data size of a transfer request or -1 for the other commands. A request that's too
+// short gets an error response without data.
+int dln2_i2c_response_size(const struct dln2_header *msg)
+{
+    const void *data = msg + 1;
+    size_t len = msg->size - sizeof(*msg);
+
+    switch (msg->id) {
+    case DLN2_I2C_READ: {
+        const struct dln2_i2c_read_msg_tx *cmd = data;
+        return len < sizeof(*cmd) ? 0 : sizeof(uint16_t) + cmd->buf_len;
+    }
+    case DLN2_I2C_WRITE: {
+        const struct dln2_i2c_write_msg *cmd = data;
+        return len < sizeof(*cmd) ? 0 : cmd->buf_len;
+    }
+    case DLN2_I2C_TRANSFER: {
+        const struct {
+            uint8_t port;
+            uint8_t count;
+            struct dln2_i2c_msg msgs[];
+        } TU_ATTR_PACKED *cmd = data;
+        size_t rx_len = 0;
+
+        if (len < 2 || len < 2 + cmd->count * sizeof(struct dln2_i2c_msg))
+            return 0;
+        for (uint i = 0; i < cmd->count; i++) {
+            if (cmd->msgs[i].flags & DLN2_I2C_M_RD)
+                rx_len += cmd->msgs[i].len;
+        }
+        return sizeof(uint16_t) + rx_len;
+    }
+    default:
+        return -1;
+    }
 }
 
 bool dln2_handle_i2c(struct dln2_slot *slot)
@@ -176,6 +619,8 @@ bool dln2_handle_i2c(struct dln2_slot *slot)
         return dln2_i2c_write(slot);
     case DLN2_I2C_READ:
         return dln2_i2c_read(slot);
+    case DLN2_I2C_TRANSFER:
+        return dln2_i2c_transfer(slot);
     default:
         LOG1("I2C: unknown command 0x%02x\n", hdr->id);
         return dln2_response_error(slot, DLN2_RES_COMMAND_NOT_SUPPORTED);
@@ -33,6 +33,18 @@ bool dln2_pin_is_requested(uint16_t pin, uint8_t module)
     return state->module == module;
 }
 
+// Bitmask of the pins requested by @module
+uint32_t dln2_pin_requested_mask(uint8_t module)
+{
+    uint32_t mask = 0;
+
+    for (uint i = 0; i < DLN2_PIN_MAX; i++) {
+        if (dln2_pin_states[i].module == module)
+            mask |= 1U << i;
+    }
+    return mask;
+}
+
 uint16_t dln2_pin_request(uint16_t pin, uint8_t module)
 {
     if (pin >= DLN2_PIN_MAX)
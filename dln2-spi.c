@@ -13,7 +13,9 @@
 #include <stdio.h>
 #include "dln2.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/gpio.h"
+#include "hardware/pio.h"
 #include "hardware/spi.h"
 
 #define LOG1    //printf
@@ -31,6 +33,12 @@
 #define DLN2_SPI_READ_WRITE                     DLN2_SPI_CMD(0x1A)
 #define DLN2_SPI_READ                           DLN2_SPI_CMD(0x1B)
 #define DLN2_SPI_WRITE                          DLN2_SPI_CMD(0x1C)
+#define DLN2_SPI_SET_DELAY_BETWEEN_SS           DLN2_SPI_CMD(0x20)
+#define DLN2_SPI_GET_DELAY_BETWEEN_SS           DLN2_SPI_CMD(0x21)
+#define DLN2_SPI_SET_DELAY_AFTER_SS             DLN2_SPI_CMD(0x22)
+#define DLN2_SPI_GET_DELAY_AFTER_SS             DLN2_SPI_CMD(0x23)
+#define DLN2_SPI_SET_DELAY_BETWEEN_FRAMES       DLN2_SPI_CMD(0x24)
+#define DLN2_SPI_GET_DELAY_BETWEEN_FRAMES       DLN2_SPI_CMD(0x25)
 #define DLN2_SPI_SET_SS                         DLN2_SPI_CMD(0x26)
 #define DLN2_SPI_SS_MULTI_ENABLE                DLN2_SPI_CMD(0x38)
 #define DLN2_SPI_SS_MULTI_DISABLE               DLN2_SPI_CMD(0x39)
@@ -39,90 +47,553 @@
 #define DLN2_SPI_GET_MIN_FREQUENCY              DLN2_SPI_CMD(0x45)
 #define DLN2_SPI_GET_MAX_FREQUENCY              DLN2_SPI_CMD(0x46)
 
+/* Board specific commands */
+#define DLN2_SPI_STREAM_READ                    DLN2_SPI_CMD(0x80)
+#define DLN2_SPI_STREAM_WRITE                   DLN2_SPI_CMD(0x81)
+#define DLN2_SPI_STREAM_DATA                    DLN2_SPI_CMD(0x82)
+#define DLN2_SPI_STREAM_READ_EV                 DLN2_SPI_CMD(0x83)
+#define DLN2_SPI_SET_SS_PINS                    DLN2_SPI_CMD(0x84)
+#define DLN2_SPI_GET_SS_PINS                    DLN2_SPI_CMD(0x85)
+#define DLN2_SPI_TRANSFER_LIST                  DLN2_SPI_CMD(0x86)
+#define DLN2_SPI_SET_ENGINE                     DLN2_SPI_CMD(0x87)
+#define DLN2_SPI_GET_ENGINE                     DLN2_SPI_CMD(0x88)
+#define DLN2_SPI_FLASH_READ_ID                  DLN2_SPI_CMD(0x89)
+#define DLN2_SPI_FLASH_ERASE                    DLN2_SPI_CMD(0x8A)
+#define DLN2_SPI_FLASH_PROGRAM                  DLN2_SPI_CMD(0x8B)
+#define DLN2_SPI_FLASH_READ                     DLN2_SPI_CMD(0x8C)
+#define DLN2_SPI_FLASH_CRC32                    DLN2_SPI_CMD(0x8D)
+
 #define DLN2_SPI_CPHA                           (1 << 0)
 #define DLN2_SPI_CPOL                           (1 << 1)
 
 #define DLN2_SPI_MAX_XFER_SIZE          256
+#define DLN2_SPI_MAX_SS                 8
 #define DLN2_SPI_ATTR_LEAVE_SS_LOW      (1 << 0)
+#define DLN2_SPI_MAX_SEGMENTS           16
+
+#define DLN2_SPI_SEGMENT_TX             (1 << 0)
+#define DLN2_SPI_SEGMENT_RX             (1 << 1)
+#define DLN2_SPI_SEGMENT_CS_CHANGE      (1 << 2)
+#define DLN2_SPI_SEGMENT_DUAL           (1 << 3)
+#define DLN2_SPI_SEGMENT_QUAD           (1 << 4)
+
+#define DLN2_SPI_ENGINE_HW              0
+#define DLN2_SPI_ENGINE_PIO             1
+
+// PIO engine options. Dual and quad reads need MISO on the pin after MOSI, quad also uses the
+// next two pins as IO2 (WP#) and IO3 (HOLD#), they're held high outside the reads.
+#define DLN2_SPI_PIO_LSB_FIRST          (1 << 0)
+#define DLN2_SPI_PIO_3WIRE              (1 << 1)
+#define DLN2_SPI_PIO_DUAL               (1 << 2)
+#define DLN2_SPI_PIO_QUAD               (1 << 3)
+
+#define DLN2_SPI_PIO    pio1
+
+// SPI NOR flash with 3-byte addresses on the selected chip select
+#define DLN2_SPI_FLASH_OP_PAGE_PROGRAM  0x02
+#define DLN2_SPI_FLASH_OP_READ          0x03
+#define DLN2_SPI_FLASH_OP_READ_STATUS   0x05
+#define DLN2_SPI_FLASH_OP_WRITE_ENABLE  0x06
+#define DLN2_SPI_FLASH_OP_SECTOR_ERASE  0x20
+#define DLN2_SPI_FLASH_OP_READ_ID       0x9f
+#define DLN2_SPI_FLASH_OP_BLOCK_ERASE   0xd8
+
+#define DLN2_SPI_FLASH_STATUS_WIP       (1 << 0)
+#define DLN2_SPI_FLASH_SIZE             (16 * 1024 * 1024)
+#define DLN2_SPI_FLASH_PAGE_SIZE        256
+#define DLN2_SPI_FLASH_SECTOR_SIZE      4096
+#define DLN2_SPI_FLASH_BLOCK_SIZE       65536
+// A block erase can take a couple of seconds
+#define DLN2_SPI_FLASH_TIMEOUT_US       (10 * 1000 * 1000)
 
 #define div_round_up(n,d)   (((n) + (d) - 1) / (d))
 
-struct {
-    uint32_t freq;
-    uint8_t mode;
-    uint8_t bpw;
-} dln2_spi_config;
+// Transfers larger than a message keep CS asserted across several messages.
+// A read stream sends the data as events and is answered when it's done.
+// A write stream is fed by DLN2_SPI_STREAM_DATA requests.
+struct dln2_spi_stream_event {
+    uint32_t offset;
+    uint16_t size;
+    uint8_t buf[];
+} TU_ATTR_PACKED;
+
+#define DLN2_SPI_STREAM_CHUNK_SIZE \
+    (DLN2_BUF_SIZE - sizeof(struct dln2_header) - sizeof(struct dln2_spi_stream_event))
+
+// The SPI programs from pico-examples with SCK on side-set and 4 cycles per bit.
+// The frame size is the autopull/autopush threshold and CPOL inverts the SCK pin.
+
+// CPHA=0: data out on the trailing edge, sampled on the leading edge
+static const uint16_t dln2_spi_pio_cpha0_instructions[] = {
+    0x6101, //  0: out    pins, 1         side 0 [1]
+    0x5101, //  1: in     pins, 1         side 1 [1]
+};
+
+// CPHA=1: data out on the leading edge, sampled on the trailing edge
+static const uint16_t dln2_spi_pio_cpha1_instructions[] = {
+    0x6021, //  0: out    x, 1            side 0
+    0xb101, //  1: mov    pins, x         side 1 [1]
+    0x4001, //  2: in     pins, 1         side 0
+};
+
+// Dual and quad reads, dummy frames in the TX fifo clock in 2 or 4 bits at a time
+static const uint16_t dln2_spi_pio_dual_instructions[] = {
+    0x6162, //  0: out    null, 2         side 0 [1]
+    0x5102, //  1: in     pins, 2         side 1 [1]
+};
+
+static const uint16_t dln2_spi_pio_quad_instructions[] = {
+    0x6164, //  0: out    null, 4         side 0 [1]
+    0x5104, //  1: in     pins, 4         side 1 [1]
+};
+
+static const pio_program_t dln2_spi_pio_cpha0_program = {
+    .instructions = dln2_spi_pio_cpha0_instructions,
+    .length = 2,
+    .origin = -1,
+};
+
+static const pio_program_t dln2_spi_pio_cpha1_program = {
+    .instructions = dln2_spi_pio_cpha1_instructions,
+    .length = 3,
+    .origin = -1,
+};
+
+static const pio_program_t dln2_spi_pio_dual_program = {
+    .instructions = dln2_spi_pio_dual_instructions,
+    .length = 2,
+    .origin = -1,
+};
+
+static const pio_program_t dln2_spi_pio_quad_program = {
+    .instructions = dln2_spi_pio_quad_instructions,
+    .length = 2,
+    .origin = -1,
+};
+
+// One spi_transfer of a Linux spi_message. The TX data of all the segments follows the segment
+// table in the command and the RX data is concatenated in the response.
+// CS_CHANGE deasserts CS after the segment like the Linux cs_change flag, the delay comes before that.
+// DUAL and QUAD read segments need the PIO engine with the matching option.
+struct dln2_spi_segment {
+    uint8_t flags;
+    uint8_t bpw; // 0 is the port frame size
+    uint16_t len;
+    uint16_t delay_us;
+} TU_ATTR_PACKED;
+
+struct dln2_spi_port {
+    spi_inst_t *spi;
+    uint8_t sck;
+    uint8_t mosi;
+    uint8_t miso;
+
+    struct {
+        uint32_t freq;
+        uint8_t mode;
+        uint8_t bpw;
+        // Delays in system clock cycles
+        uint32_t delay_after_ss;
+        uint32_t delay_between_ss;
+        uint32_t delay_between_frames;
+    } config;
+
+    // Chip selects, the table can be changed with DLN2_SPI_SET_SS_PINS while none are enabled
+    struct {
+        uint8_t pins[DLN2_SPI_MAX_SS];
+        uint8_t count;
+        uint8_t enabled;
+        uint8_t selected;
+    } ss;
+    bool cs_asserted;
+    uint64_t cs_deasserted_at;
+
+    // DLN2_SPI_ENGINE_PIO runs the port on a state machine instead of the SPI controller
+    uint8_t engine;
+    uint8_t flags;
+    struct {
+        int sm;
+        uint offset[3]; // CPHA=0, CPHA=1 and the dual/quad read program
+    } pio;
+
+    // Transfers are run by a TX/RX DMA channel pair claimed when the port is enabled.
+    // The response is sent from dln2_spi_task() when the RX channel is done.
+    int dma_tx;
+    int dma_rx;
+    // Paces the TX channel when there's a delay between frames
+    int dma_timer;
+
+    struct {
+        struct dln2_slot *slot;
+        uint8_t attr;
+        uint16_t size;
+        size_t len;
+    } xfer;
+
+    // The list is copied out of the request since the RX data overwrites it
+    struct {
+        struct dln2_spi_segment segs[DLN2_SPI_MAX_SEGMENTS];
+        uint8_t tx[DLN2_SPI_MAX_XFER_SIZE] __attribute__((aligned(4)));
+        uint8_t count;
+        uint8_t index;
+        uint16_t tx_offset;
+        uint16_t rx_offset;
+        uint64_t delay_end;     // the delay after the segment is running
+    } list;
+
+    struct {
+        struct dln2_slot *slot; // the read request
+        struct dln2_slot *ev;   // the event being read into
+        bool write;
+        uint8_t attr;
+        uint32_t size;
+        uint32_t offset;
+    } stream;
+
+    // The flash commands are run as a sequence of flash operations, each with its own CS
+    // assertion. The WIP bit is polled from dln2_spi_task() so only the data crosses USB.
+    struct {
+        struct dln2_slot *slot;
+        uint8_t op;
+        uint32_t addr;
+        uint32_t end;
+        uint32_t step;
+        uint32_t crc;
+        uint64_t timeout;
+        // Opcode, address and data
+        uint8_t buf[4 + DLN2_SPI_FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+    } flash;
+};
+
+#define DLN2_SPI_PORT(_spi, _sck, _mosi, _miso, _cs) { \
+        .spi = (_spi), \
+        .sck = (_sck), \
+        .mosi = (_mosi), \
+        .miso = (_miso), \
+        .config = { .freq = DLN2_SPI_DEFAULT_FREQUENCY, .bpw = 8, }, \
+        .ss = { .pins = { (_cs) }, .count = 1, .selected = 0x01, }, \
+        .dma_tx = -1, \
+        .dma_rx = -1, \
+        .dma_timer = -1, \
+        .pio = { .sm = -1, }, \
+    }
+
+// Port 1 is the second controller on the GP10-GP13 pins
+static struct dln2_spi_port dln2_spi_ports[] = {
+    DLN2_SPI_PORT(spi0, PICO_DEFAULT_SPI_SCK_PIN, PICO_DEFAULT_SPI_TX_PIN, PICO_DEFAULT_SPI_RX_PIN,
+                  PICO_DEFAULT_SPI_CSN_PIN),
+    DLN2_SPI_PORT(spi1, 10, 11, 12, 13),
+};
+
+#define DLN2_SPI_PORTS  TU_ARRAY_SIZE(dln2_spi_ports)
+
+// The other end of a read or write transfer
+static uint16_t dln2_spi_dummy_tx;
+static uint16_t dln2_spi_dummy_rx;
+
+// Frames wider than 8 bits are 16-bit little endian words in the buffers
+static bool dln2_spi_wide(uint8_t bpw)
+{
+    return bpw > 8;
+}
+
+static bool dln2_spi_bpw_valid(struct dln2_spi_port *port, uint8_t bpw)
+{
+    // Narrow writes to the PIO fifo are replicated across the word, the frame has to fill the byte lanes
+    if (port->engine == DLN2_SPI_ENGINE_PIO)
+        return bpw == 8 || bpw == 16;
+    return bpw >= 4 && bpw <= 16;
+}
+
+// The pins the port uses apart from the chip selects
+static uint32_t dln2_spi_pins(struct dln2_spi_port *port)
+{
+    uint32_t pins = (1u << port->sck) | (1u << port->mosi);
+
+    if (!(port->flags & DLN2_SPI_PIO_3WIRE))
+        pins |= 1u << port->miso;
+    if (port->flags & DLN2_SPI_PIO_QUAD)
+        pins |= 3u << (port->mosi + 2);
+    return pins;
+}
+
+static const pio_program_t *dln2_spi_pio_program(struct dln2_spi_port *port, uint i)
+{
+    if (i == 0)
+        return &dln2_spi_pio_cpha0_program;
+    if (i == 1)
+        return &dln2_spi_pio_cpha1_program;
+    if (port->flags & DLN2_SPI_PIO_QUAD)
+        return &dln2_spi_pio_quad_program;
+    if (port->flags & DLN2_SPI_PIO_DUAL)
+        return &dln2_spi_pio_dual_program;
+    return NULL;
+}
+
+// A bit takes 4 cycles, the divider has 8 fractional bits
+static uint32_t dln2_spi_pio_clkdiv(uint32_t freq)
+{
+    uint64_t div = div_round_up((uint64_t)clock_get_hz(clk_sys) << 8, 4ull * freq);
+
+    return div < (1 << 8) ? 1 << 8 : tu_min32(div, 0xffffff);
+}
+
+static uint32_t dln2_spi_pio_frequency(uint32_t div)
+{
+    return ((uint64_t)clock_get_hz(clk_sys) << 8) / (4ull * div);
+}
+
+// @lanes is 2 or 4 for the dual and quad reads
+static void dln2_spi_pio_set_format(struct dln2_spi_port *port, uint8_t bpw, uint lanes)
+{
+    PIO pio = DLN2_SPI_PIO;
+    uint sm = port->pio.sm;
+    bool lsb_first = port->flags & DLN2_SPI_PIO_LSB_FIRST;
+    uint i = lanes > 1 ? 2 : !!(port->config.mode & DLN2_SPI_CPHA);
+    uint offset = port->pio.offset[i];
+    uint in_base = lanes > 1 || (port->flags & DLN2_SPI_PIO_3WIRE) ? port->mosi : port->miso;
+    uint32_t div = dln2_spi_pio_clkdiv(port->config.freq);
+
+    pio_sm_set_enabled(pio, sm, false);
+
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset, offset + dln2_spi_pio_program(port, i)->length - 1);
+    sm_config_set_sideset(&c, 1, false, false);
+    sm_config_set_sideset_pins(&c, port->sck);
+    sm_config_set_out_pins(&c, port->mosi, 1);
+    sm_config_set_in_pins(&c, in_base);
+    sm_config_set_out_shift(&c, lsb_first, true, bpw);
+    sm_config_set_in_shift(&c, lsb_first, true, bpw);
+    sm_config_set_clkdiv_int_frac(&c, div >> 8, div & 0xff);
+    pio_sm_init(pio, sm, offset, &c);
+
+    // The data pins are inputs while reading on more than one lane
+    uint32_t out = 1u << port->sck;
+    if (lanes == 1) {
+        uint32_t hold = port->flags & DLN2_SPI_PIO_QUAD ? 3u << (port->mosi + 2) : 0;
+        pio_sm_set_pins_with_mask(pio, sm, hold, hold);
+        out |= (1u << port->mosi) | hold;
+    }
+    pio_sm_set_pindirs_with_mask(pio, sm, out, dln2_spi_pins(port));
+    gpio_set_outover(port->sck, port->config.mode & DLN2_SPI_CPOL ? GPIO_OVERRIDE_INVERT : GPIO_OVERRIDE_NORMAL);
+
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+static bool dln2_spi_pio_init(struct dln2_spi_port *port)
+{
+    PIO pio = DLN2_SPI_PIO;
+    int sm = pio_claim_unused_sm(pio, false);
+
+    if (sm < 0)
+        return false;
+
+    for (uint i = 0; i < TU_ARRAY_SIZE(port->pio.offset); i++) {
+        const pio_program_t *program = dln2_spi_pio_program(port, i);
+        if (!program)
+            continue;
+
+        if (!pio_can_add_program(pio, program)) {
+            LOG1("SPI: Out of PIO program space\n");
+            while (i--) {
+                if (dln2_spi_pio_program(port, i))
+                    pio_remove_program(pio, dln2_spi_pio_program(port, i), port->pio.offset[i]);
+            }
+            pio_sm_unclaim(pio, sm);
+            return false;
+        }
+        port->pio.offset[i] = pio_add_program(pio, program);
+    }
+
+    port->pio.sm = sm;
+    for (uint32_t pins = dln2_spi_pins(port); pins; pins &= pins - 1)
+        pio_gpio_init(pio, __builtin_ctz(pins));
+
+    return true;
+}
+
+static void dln2_spi_pio_deinit(struct dln2_spi_port *port)
+{
+    PIO pio = DLN2_SPI_PIO;
+
+    if (port->pio.sm < 0)
+        return;
+
+    pio_sm_set_enabled(pio, port->pio.sm, false);
+    for (uint i = 0; i < TU_ARRAY_SIZE(port->pio.offset); i++) {
+        if (dln2_spi_pio_program(port, i))
+            pio_remove_program(pio, dln2_spi_pio_program(port, i), port->pio.offset[i]);
+    }
+    pio_sm_unclaim(pio, port->pio.sm);
+    port->pio.sm = -1;
+    gpio_set_outover(port->sck, GPIO_OVERRIDE_NORMAL);
+}
+
+// @lanes is more than one for the dual/quad read segments which only the PIO engine can do
+static void dln2_spi_set_format(struct dln2_spi_port *port, uint8_t bpw, uint lanes)
+{
+    if (port->engine == DLN2_SPI_ENGINE_PIO) {
+        dln2_spi_pio_set_format(port, bpw, lanes);
+        return;
+    }
+
+    spi_set_format(port->spi, bpw, port->config.mode & DLN2_SPI_CPOL,
+                   port->config.mode & DLN2_SPI_CPHA, SPI_MSB_FIRST);
+}
+
+static bool dln2_spi_dma_claim(struct dln2_spi_port *port)
+{
+    if (port->dma_rx >= 0)
+        return true;
+
+    int tx = dma_claim_unused_channel(false);
+    int rx = dma_claim_unused_channel(false);
+    if (tx < 0 || rx < 0) {
+        if (tx >= 0)
+            dma_channel_unclaim(tx);
+        if (rx >= 0)
+            dma_channel_unclaim(rx);
+        return false;
+    }
+
+    port->dma_tx = tx;
+    port->dma_rx = rx;
+    return true;
+}
+
+static void dln2_spi_dma_unclaim(struct dln2_spi_port *port)
+{
+    if (port->dma_rx < 0)
+        return;
+
+    dma_channel_unclaim(port->dma_tx);
+    dma_channel_unclaim(port->dma_rx);
+    port->dma_tx = -1;
+    port->dma_rx = -1;
+}
+
+static void dln2_spi_dma_timer_unclaim(struct dln2_spi_port *port)
+{
+    if (port->dma_timer < 0)
+        return;
+
+    dma_timer_unclaim(port->dma_timer);
+    port->dma_timer = -1;
+}
+
+static void dln2_spi_free_pins(uint32_t pins)
+{
+    for (; pins; pins &= pins - 1)
+        dln2_pin_free(__builtin_ctz(pins), DLN2_MODULE_SPI);
+}
+
+static uint32_t dln2_spi_cs_pins(struct dln2_spi_port *port)
+{
+    uint32_t pins = 0;
+
+    for (uint i = 0; i < port->ss.count; i++) {
+        if (port->ss.enabled & (1 << i))
+            pins |= 1u << port->ss.pins[i];
+    }
+    return pins;
+}
+
+// dln2_pin_request() doesn't tell the ports apart since they're both DLN2_MODULE_SPI
+static uint32_t dln2_spi_other_ports_pins(struct dln2_spi_port *port)
+{
+    uint32_t pins = 0;
 
-static uint8_t dln2_spi_tmp_buf[DLN2_SPI_MAX_XFER_SIZE];
+    for (uint i = 0; i < DLN2_SPI_PORTS; i++) {
+        struct dln2_spi_port *other = &dln2_spi_ports[i];
 
-static bool dln2_spi_enable(struct dln2_slot *slot, bool enable)
+        if (other == port)
+            continue;
+        if (other->dma_rx >= 0)
+            pins |= dln2_spi_pins(other);
+        pins |= dln2_spi_cs_pins(other);
+    }
+    return pins;
+}
+
+static bool dln2_spi_engine_init(struct dln2_spi_port *port)
 {
-    uint8_t *port = dln2_slot_header_data(slot);
+    if (port->engine == DLN2_SPI_ENGINE_PIO) {
+        if (!dln2_spi_pio_init(port))
+            return false;
+    } else {
+        uint freq = spi_init(port->spi, port->config.freq);
+        LOG1("SPI: actual frequency: %uHz\n", freq);
+
+        gpio_set_function(port->sck, GPIO_FUNC_SPI);
+        gpio_set_function(port->mosi, GPIO_FUNC_SPI);
+        gpio_set_function(port->miso, GPIO_FUNC_SPI);
+    }
+
+    dln2_spi_set_format(port, port->config.bpw, 1);
+    return true;
+}
+
+static void dln2_spi_cs_active(struct dln2_spi_port *port, bool active);
+
+static bool dln2_spi_enable(struct dln2_spi_port *port, struct dln2_slot *slot, bool enable)
+{
+    uint8_t *port_num = dln2_slot_header_data(slot);
     // wait_for_completion is always DLN2_TRANSFERS_WAIT_COMPLETE in the Linux driver
     //uint8_t *wait_for_completion = dln2_slot_header_data(slot) + 1;
-    uint sck = PICO_DEFAULT_SPI_SCK_PIN;
-    uint mosi = PICO_DEFAULT_SPI_TX_PIN;
-    uint miso = PICO_DEFAULT_SPI_RX_PIN;
+    uint32_t pins = dln2_spi_pins(port);
     int res;
 
-    LOG1("%s: port=%u\n", enable ? "DLN2_SPI_ENABLE" : "DLN2_SPI_DISABLE", *port);
+    LOG1("%s: port=%u\n", enable ? "DLN2_SPI_ENABLE" : "DLN2_SPI_DISABLE", *port_num);
 
     if (enable)
         DLN2_VERIFY_COMMAND_SIZE(slot, 1);
     else
         DLN2_VERIFY_COMMAND_SIZE(slot, 2);
 
-    if (*port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
-
     if (enable) {
-        res = dln2_pin_request(sck, DLN2_MODULE_SPI);
-        if (res)
-            return dln2_response_error(slot, res);
-
-        res = dln2_pin_request(mosi, DLN2_MODULE_SPI);
-        if (res) {
-            dln2_pin_free(sck, DLN2_MODULE_SPI);
-            return dln2_response_error(slot, res);
+        if (pins & (dln2_spi_cs_pins(port) | dln2_spi_other_ports_pins(port)))
+            return dln2_response_error(slot, DLN2_RES_PIN_IN_USE);
+
+        uint32_t claimed = 0;
+        for (uint32_t p = pins; p; p &= p - 1) {
+            uint pin = __builtin_ctz(p);
+            res = dln2_pin_request(pin, DLN2_MODULE_SPI);
+            if (res) {
+                dln2_spi_free_pins(claimed);
+                return dln2_response_error(slot, res);
+            }
+            claimed |= 1u << pin;
         }
 
-        res = dln2_pin_request(miso, DLN2_MODULE_SPI);
-        if (res) {
-            dln2_pin_free(sck, DLN2_MODULE_SPI);
-            dln2_pin_free(mosi, DLN2_MODULE_SPI);
-            return dln2_response_error(slot, res);
+        if (!dln2_spi_dma_claim(port) || !dln2_spi_engine_init(port)) {
+            dln2_spi_dma_unclaim(port);
+            dln2_spi_free_pins(pins);
+            return dln2_response_error(slot, DLN2_RES_FAIL);
         }
-
-        uint freq = spi_init(spi_default, dln2_spi_config.freq);
-        LOG1("SPI: actual frequency: %uHz\n", freq);
-
-        spi_set_format(spi_default, dln2_spi_config.bpw, dln2_spi_config.mode & DLN2_SPI_CPOL,
-                       dln2_spi_config.mode & DLN2_SPI_CPHA, SPI_MSB_FIRST);
-
-        gpio_set_function(sck, GPIO_FUNC_SPI);
-        gpio_set_function(mosi, GPIO_FUNC_SPI);
-        gpio_set_function(miso, GPIO_FUNC_SPI);
     } else {
-        res = dln2_pin_free(sck, DLN2_MODULE_SPI);
-        if (res)
-            return dln2_response_error(slot, res);
-        gpio_set_function(sck, GPIO_FUNC_NULL);
+        for (; pins; pins &= pins - 1) {
+            uint pin = __builtin_ctz(pins);
+            res = dln2_pin_free(pin, DLN2_MODULE_SPI);
+            if (res)
+                return dln2_response_error(slot, res);
+            gpio_set_function(pin, GPIO_FUNC_NULL);
+        }
 
-        res = dln2_pin_free(mosi, DLN2_MODULE_SPI);
-        if (res)
-            return dln2_response_error(slot, res);
-        gpio_set_function(mosi, GPIO_FUNC_NULL);
+        // An open write stream or DLN2_SPI_ATTR_LEAVE_SS_LOW doesn't leave CS asserted
+        dln2_spi_cs_active(port, false);
+        port->stream.write = false;
 
-        res = dln2_pin_free(miso, DLN2_MODULE_SPI);
-        if (res)
-            return dln2_response_error(slot, res);
-        gpio_set_function(miso, GPIO_FUNC_NULL);
+        dln2_spi_pio_deinit(port);
+        dln2_spi_dma_unclaim(port);
+        // The pacing timer is claimed again when the delay is set
+        dln2_spi_dma_timer_unclaim(port);
+        port->config.delay_between_frames = 0;
     }
 
     return dln2_response(slot, 0);
 }
 
-static bool dln2_spi_set_mode(struct dln2_slot *slot)
+static bool dln2_spi_set_mode(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
     struct {
         uint8_t port;
@@ -134,18 +605,17 @@ static bool dln2_spi_set_mode(struct dln2_slot *slot)
 
     LOG1("DLN2_SPI_SET_MODE: port=%u mode=0x%02x\n", cmd->port, cmd->mode);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
-
     if (cmd->mode & ~mask)
         return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
 
-    dln2_spi_config.mode = cmd->mode;
+    port->config.mode = cmd->mode;
+    if (port->dma_rx >= 0)
+        dln2_spi_set_format(port, port->config.bpw, 1);
 
     return dln2_response(slot, 0);
 }
 
-static bool dln2_spi_set_bpw(struct dln2_slot *slot)
+static bool dln2_spi_set_bpw(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
     struct {
         uint8_t port;
@@ -156,33 +626,39 @@ static bool dln2_spi_set_bpw(struct dln2_slot *slot)
 
     LOG1("DLN2_SPI_SET_BPW: port=%u bpw=%u\n", cmd->port, cmd->bpw);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
+    if (!dln2_spi_bpw_valid(port, cmd->bpw))
+        return dln2_response_error(slot, DLN2_RES_SPI_INVALID_FRAME_SIZE);
 
-    // TODO: verify
-    // DLN2_RES_SPI_INVALID_FRAME_SIZE
-    dln2_spi_config.bpw = cmd->bpw;
+    port->config.bpw = cmd->bpw;
+    if (port->dma_rx >= 0)
+        dln2_spi_set_format(port, port->config.bpw, 1);
 
     return dln2_response(slot, 0);
 }
 
-static uint dln2_spi_min_frequency(void)
+static uint dln2_spi_min_frequency(struct dln2_spi_port *port)
 {
     uint freq_in = clock_get_hz(clk_peri);
     uint prescale = 254, postdiv = 256;
 
+    if (port->engine == DLN2_SPI_ENGINE_PIO)
+        return dln2_spi_pio_frequency(0xffffff) + 1;
+
     return freq_in / (prescale * postdiv);
 }
 
-static uint dln2_spi_max_frequency(void)
+static uint dln2_spi_max_frequency(struct dln2_spi_port *port)
 {
     uint freq_in = clock_get_hz(clk_peri);
     uint prescale = 2, postdiv = 1;
 
+    if (port->engine == DLN2_SPI_ENGINE_PIO)
+        return dln2_spi_pio_frequency(1 << 8);
+
     return freq_in / (prescale * postdiv);
 }
 
-static bool dln2_spi_set_frequency(struct dln2_slot *slot)
+static bool dln2_spi_set_frequency(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
     struct {
         uint8_t port;
@@ -194,39 +670,550 @@ static bool dln2_spi_set_frequency(struct dln2_slot *slot)
 
     LOG1("DLN2_SPI_SET_FREQUENCY: port=%u speed=%u\n", cmd->port, cmd->speed);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
-
-    if (cmd->speed < dln2_spi_min_frequency())
-        cmd->speed = dln2_spi_min_frequency();
-    else if (cmd->speed > dln2_spi_max_frequency())
-        cmd->speed = dln2_spi_max_frequency();
+    if (cmd->speed < dln2_spi_min_frequency(port))
+        cmd->speed = dln2_spi_min_frequency(port);
+    else if (cmd->speed > dln2_spi_max_frequency(port))
+        cmd->speed = dln2_spi_max_frequency(port);
 
-    speed = spi_set_baudrate(spi_default, cmd->speed);
+    if (port->engine == DLN2_SPI_ENGINE_PIO) {
+        uint32_t div = dln2_spi_pio_clkdiv(cmd->speed);
+        speed = dln2_spi_pio_frequency(div);
+        if (port->pio.sm >= 0)
+            pio_sm_set_clkdiv_int_frac(DLN2_SPI_PIO, port->pio.sm, div >> 8, div & 0xff);
+    } else {
+        speed = spi_set_baudrate(port->spi, cmd->speed);
+    }
     LOG1("SPI: actual frequency: %uHz\n", speed);
-    dln2_spi_config.freq = speed;
+    port->config.freq = speed;
 
     // The Linux driver ignores the returned value
     return dln2_response_u32(slot, speed);
 }
 
-static void dln2_spi_cs_active(bool active)
+static uint32_t dln2_spi_ns_to_cycles(uint32_t ns)
+{
+    return div_round_up((uint64_t)ns * (clock_get_hz(clk_sys) / 1000000), 1000);
+}
+
+static uint32_t dln2_spi_cycles_to_ns(uint32_t cycles)
+{
+    return (uint64_t)cycles * 1000 / (clock_get_hz(clk_sys) / 1000000);
+}
+
+static uint32_t dln2_spi_frame_cycles(struct dln2_spi_port *port, uint8_t bpw)
+{
+    return div_round_up((uint64_t)bpw * clock_get_hz(clk_sys), port->config.freq);
+}
+
+// The pacing timer period is a 16-bit number of cycles: one frame and the delay between frames.
+// The frame gets longer with a lower frequency or a larger frame size.
+static bool dln2_spi_period_valid(struct dln2_spi_port *port, uint8_t bpw, uint32_t delay)
+{
+    return !delay || dln2_spi_frame_cycles(port, bpw) + delay <= 0xffff;
+}
+
+static uint32_t *dln2_spi_delay(struct dln2_spi_port *port, uint16_t id)
+{
+    switch (id) {
+    case DLN2_SPI_SET_DELAY_BETWEEN_SS:
+    case DLN2_SPI_GET_DELAY_BETWEEN_SS:
+        return &port->config.delay_between_ss;
+    case DLN2_SPI_SET_DELAY_AFTER_SS:
+    case DLN2_SPI_GET_DELAY_AFTER_SS:
+        return &port->config.delay_after_ss;
+    default:
+        return &port->config.delay_between_frames;
+    }
+}
+
+static bool dln2_spi_set_delay(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    struct dln2_header *hdr = dln2_slot_header(slot);
+    struct {
+        uint8_t port;
+        uint32_t delay;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    uint32_t *delay = dln2_spi_delay(port, hdr->id);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+
+    LOG1("DLN2_SPI_SET_DELAY(0x%02x): port=%u delay=%uns\n", hdr->id, cmd->port, cmd->delay);
+
+    uint32_t cycles = dln2_spi_ns_to_cycles(cmd->delay);
+
+    if (hdr->id == DLN2_SPI_SET_DELAY_BETWEEN_FRAMES) {
+        if (!dln2_spi_period_valid(port, port->config.bpw, cycles))
+            return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+
+        if (!cycles) {
+            dln2_spi_dma_timer_unclaim(port);
+        } else if (port->dma_timer < 0) {
+            port->dma_timer = dma_claim_unused_timer(false);
+            if (port->dma_timer < 0)
+                return dln2_response_error(slot, DLN2_RES_FAIL);
+        }
+    }
+
+    *delay = cycles;
+
+    return dln2_response_u32(slot, dln2_spi_cycles_to_ns(cycles));
+}
+
+static bool dln2_spi_get_delay(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    struct dln2_header *hdr = dln2_slot_header(slot);
+    uint8_t *port_num = dln2_slot_header_data(slot);
+
+    LOG1("DLN2_SPI_GET_DELAY(0x%02x): port=%u\n", hdr->id, *port_num);
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port_num));
+
+    return dln2_response_u32(slot, dln2_spi_cycles_to_ns(*dln2_spi_delay(port, hdr->id)));
+}
+
+static void dln2_spi_cs_active(struct dln2_spi_port *port, bool active)
 {
     // http://dlnware.com/dll/DlnSpiMasterSetDelayAfterSS
     // With a 0ns delay time, the actual delay will be equal to 1/2 of the SPI clock frequency
-    uint64_t us = div_round_up(dln2_spi_config.freq, 2 * 1000000);
-    LOG1("    CS=%s wait=%llu\n", active ? "activate" : "deactivate", us);
+    uint32_t half_clock = div_round_up(clock_get_hz(clk_sys), 2 * port->config.freq);
+    uint32_t after_ss = port->config.delay_after_ss ? port->config.delay_after_ss : half_clock;
+    LOG1("    CS=%s\n", active ? "activate" : "deactivate");
+
+    // Transfers chained with DLN2_SPI_ATTR_LEAVE_SS_LOW and streams follow each other without a delay
+    if (active == port->cs_asserted)
+        return;
+    port->cs_asserted = active;
+
+    if (active && port->config.delay_between_ss) {
+        // The time since the last deassert counts, the host is usually slower than the delay
+        uint64_t end = port->cs_deasserted_at +
+                       div_round_up(port->config.delay_between_ss, clock_get_hz(clk_sys) / 1000000);
+        uint64_t now = time_us_64();
+        if (now < end)
+            busy_wait_us_32(end - now);
+    }
 
     if (!active)
-        sleep_us(us);
+        busy_wait_at_least_cycles(half_clock);
 
-    gpio_put(PICO_DEFAULT_SPI_CSN_PIN, !active);
+    uint32_t mask = 0;
+    for (uint i = 0; i < port->ss.count; i++) {
+        if (port->ss.selected & port->ss.enabled & (1 << i))
+            mask |= 1u << port->ss.pins[i];
+    }
+    gpio_put_masked(mask, active ? 0 : mask);
 
     if (active)
-        sleep_us(us);
+        busy_wait_at_least_cycles(after_ss);
+    else
+        port->cs_deasserted_at = time_us_64();
+}
+
+// @size is in bytes
+static void dln2_spi_dma_start(struct dln2_spi_port *port, const void *tx, void *rx, uint16_t size, uint8_t bpw)
+{
+    volatile void *tx_fifo = &spi_get_hw(port->spi)->dr;
+    volatile void *rx_fifo = tx_fifo;
+    uint tx_dreq = spi_get_dreq(port->spi, true);
+    uint rx_dreq = spi_get_dreq(port->spi, false);
+    enum dma_channel_transfer_size data_size = DMA_SIZE_8;
+    dma_channel_config c;
+
+    if (dln2_spi_wide(bpw)) {
+        data_size = DMA_SIZE_16;
+        size /= 2;
+    }
+
+    if (port->engine == DLN2_SPI_ENGINE_PIO) {
+        PIO pio = DLN2_SPI_PIO;
+        uint sm = port->pio.sm;
+
+        tx_fifo = &pio->txf[sm];
+        rx_fifo = &pio->rxf[sm];
+        // Shifting right leaves the frame at the top of the word
+        if (port->flags & DLN2_SPI_PIO_LSB_FIRST)
+            rx_fifo = (volatile uint8_t *)rx_fifo + 4 - (1 << data_size);
+        tx_dreq = pio_get_dreq(pio, sm, true);
+        rx_dreq = pio_get_dreq(pio, sm, false);
+
+        // MOSI is only driven when writing on a 3-wire bus
+        if (port->flags & DLN2_SPI_PIO_3WIRE)
+            pio_sm_set_consecutive_pindirs(pio, sm, port->mosi, 1, tx != &dln2_spi_dummy_tx);
+    }
+
+    c = dma_channel_get_default_config(port->dma_tx);
+    channel_config_set_transfer_data_size(&c, data_size);
+    channel_config_set_read_increment(&c, tx != &dln2_spi_dummy_tx);
+    channel_config_set_write_increment(&c, false);
+    if (port->dma_timer >= 0) {
+        // One frame per timer period leaves the delay between the frames
+        uint32_t period = dln2_spi_frame_cycles(port, bpw) + port->config.delay_between_frames;
+        dma_timer_set_fraction(port->dma_timer, 1, period);
+        channel_config_set_dreq(&c, dma_get_timer_dreq(port->dma_timer));
+    } else {
+        channel_config_set_dreq(&c, tx_dreq);
+    }
+    dma_channel_configure(port->dma_tx, &c, tx_fifo, tx, size, false);
+
+    c = dma_channel_get_default_config(port->dma_rx);
+    channel_config_set_transfer_data_size(&c, data_size);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, rx != &dln2_spi_dummy_rx);
+    channel_config_set_dreq(&c, rx_dreq);
+    dma_channel_configure(port->dma_rx, &c, rx, rx_fifo, size, false);
+
+    // Without a timer the TX dreq keeps the fifo full so there are no gaps between frames
+    dma_start_channel_mask((1u << port->dma_tx) | (1u << port->dma_rx));
+}
+
+// Returns with CS active and the DMA channels running, the response is sent when they're done
+static bool _dln2_spi_xfer_start(struct dln2_spi_port *port, struct dln2_slot *slot, const void *tx, void *rx, uint16_t size,
+                                 uint8_t attr, size_t len)
+{
+    port->xfer.slot = slot;
+    port->xfer.attr = attr;
+    port->xfer.size = size;
+    port->xfer.len = len;
+
+    dln2_spi_cs_active(port, true);
+
+    if (size)
+        dln2_spi_dma_start(port, tx, rx, size, port->config.bpw);
+
+    return true;
+}
+
+static bool dln2_spi_xfer_start(struct dln2_spi_port *port, struct dln2_slot *slot, const void *tx, void *rx, uint16_t size,
+                                uint8_t attr, size_t len)
+{
+    // An open write stream owns the bus
+    if (port->dma_rx < 0 || port->stream.write)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+    if (!dln2_spi_period_valid(port, port->config.bpw, port->config.delay_between_frames))
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+    if (dln2_spi_wide(port->config.bpw) && (size & 1))
+        return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+    // A 3-wire bus is half duplex
+    if ((port->flags & DLN2_SPI_PIO_3WIRE) && tx != &dln2_spi_dummy_tx && rx != &dln2_spi_dummy_rx)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+
+    return _dln2_spi_xfer_start(port, slot, tx, rx, size, attr, len);
+}
+
+static struct dln2_spi_port *dln2_spi_get_port(struct dln2_slot *slot)
+{
+    // All commands start with the port number
+    uint8_t *port_num = dln2_slot_header_data(slot);
+
+    if (*port_num >= DLN2_SPI_PORTS)
+        return NULL;
+    return &dln2_spi_ports[*port_num];
+}
+
+// The ports run their transfers independently of each other
+bool dln2_spi_busy(struct dln2_slot *slot)
+{
+    struct dln2_spi_port *port = dln2_spi_get_port(slot);
+
+    return port && (port->xfer.slot || port->stream.slot || port->flash.slot);
+}
+
+static void dln2_spi_stream_read_task(struct dln2_spi_port *port)
+{
+    struct dln2_slot *ev = port->stream.ev;
+
+    if (ev) {
+        if (dma_channel_is_busy(port->dma_rx))
+            return;
+        port->stream.ev = NULL;
+        port->stream.offset += ((struct dln2_spi_stream_event *)dln2_slot_header_data(ev))->size;
+        dln2_queue_slot_in(ev);
+    }
+
+    if (port->stream.offset == port->stream.size) {
+        struct dln2_slot *slot = port->stream.slot;
+
+        port->stream.slot = NULL;
+        if (!(port->stream.attr & DLN2_SPI_ATTR_LEAVE_SS_LOW))
+            dln2_spi_cs_active(port, false);
+        dln2_response_u32(slot, port->stream.size);
+        return;
+    }
+
+    // Waiting for the host to take the previous chunks keeps the stream from using up the slots
+    ev = dln2_get_event_slot();
+    if (!ev)
+        return;
+
+    uint32_t chunk = DLN2_SPI_STREAM_CHUNK_SIZE;
+    if (dln2_spi_wide(port->config.bpw))
+        chunk &= ~1;
+
+    uint32_t size = tu_min32(port->stream.size - port->stream.offset, chunk);
+    struct dln2_header *hdr = dln2_slot_header(ev);
+    hdr->size = sizeof(*hdr) + sizeof(struct dln2_spi_stream_event) + size;
+    hdr->id = DLN2_SPI_STREAM_READ_EV;
+    hdr->echo = 0;
+    hdr->handle = DLN2_HANDLE_EVENT;
+
+    struct dln2_spi_stream_event *data = dln2_slot_header_data(ev);
+    data->offset = port->stream.offset;
+    data->size = size;
+
+    port->stream.ev = ev;
+    dln2_spi_dma_start(port, &dln2_spi_dummy_tx, data->buf, size, port->config.bpw);
+}
+
+static uint dln2_spi_segment_lanes(struct dln2_spi_segment *seg)
+{
+    if (seg->flags & DLN2_SPI_SEGMENT_QUAD)
+        return 4;
+    if (seg->flags & DLN2_SPI_SEGMENT_DUAL)
+        return 2;
+    return 1;
+}
+
+static void dln2_spi_list_segment_start(struct dln2_spi_port *port)
+{
+    struct dln2_spi_segment *seg = &port->list.segs[port->list.index];
+    uint8_t *buf = dln2_slot_response_data(port->xfer.slot) + sizeof(uint16_t);
+    uint8_t bpw = seg->bpw ? seg->bpw : port->config.bpw;
+    const void *tx = &dln2_spi_dummy_tx;
+    void *rx = &dln2_spi_dummy_rx;
+
+    if (seg->flags & DLN2_SPI_SEGMENT_TX) {
+        tx = port->list.tx + port->list.tx_offset;
+        port->list.tx_offset += seg->len;
+    }
+    if (seg->flags & DLN2_SPI_SEGMENT_RX) {
+        rx = buf + port->list.rx_offset;
+        port->list.rx_offset += seg->len;
+    }
+
+    port->xfer.size = seg->len;
+    dln2_spi_set_format(port, bpw, dln2_spi_segment_lanes(seg));
+    dln2_spi_cs_active(port, true);
+    if (seg->len)
+        dln2_spi_dma_start(port, tx, rx, seg->len, bpw);
+}
+
+// Returns false when the last segment is done
+static bool dln2_spi_list_task(struct dln2_spi_port *port)
+{
+    struct dln2_spi_segment *seg = &port->list.segs[port->list.index];
+
+    // The main loop goes on while the delay runs out
+    if (seg->delay_us) {
+        if (!port->list.delay_end)
+            port->list.delay_end = time_us_64() + seg->delay_us;
+        if (time_us_64() < port->list.delay_end)
+            return true;
+        port->list.delay_end = 0;
+    }
+    port->list.index++;
+
+    if (port->list.index == port->list.count) {
+        port->list.count = 0;
+        dln2_spi_set_format(port, port->config.bpw, 1);
+        return false;
+    }
+
+    if (seg->flags & DLN2_SPI_SEGMENT_CS_CHANGE)
+        dln2_spi_cs_active(port, false);
+
+    dln2_spi_list_segment_start(port);
+    return true;
+}
+
+// One flash operation, the data goes in and out of flash.buf after the opcode and address
+static void dln2_spi_flash_op(struct dln2_spi_port *port, uint8_t op, bool addr, uint16_t len)
+{
+    uint8_t *buf = port->flash.buf;
+    uint16_t size = 1;
+
+    buf[0] = op;
+    if (addr) {
+        buf[1] = port->flash.addr >> 16;
+        buf[2] = port->flash.addr >> 8;
+        buf[3] = port->flash.addr;
+        size = 4;
+    }
+    port->flash.op = op;
+
+    dln2_spi_cs_active(port, false);
+    dln2_spi_cs_active(port, true);
+    dln2_spi_dma_start(port, buf, buf, size + len, 8);
+}
+
+static uint32_t dln2_spi_flash_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (uint i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static struct dln2_slot *dln2_spi_flash_done(struct dln2_spi_port *port)
+{
+    struct dln2_slot *slot = port->flash.slot;
+
+    port->flash.slot = NULL;
+    dln2_spi_cs_active(port, false);
+    return slot;
+}
+
+// Erase the largest block that fits
+static void dln2_spi_flash_erase_start(struct dln2_spi_port *port)
+{
+    uint8_t op = DLN2_SPI_FLASH_OP_SECTOR_ERASE;
+
+    port->flash.step = DLN2_SPI_FLASH_SECTOR_SIZE;
+    if (!(port->flash.addr % DLN2_SPI_FLASH_BLOCK_SIZE) &&
+        port->flash.end - port->flash.addr >= DLN2_SPI_FLASH_BLOCK_SIZE) {
+        op = DLN2_SPI_FLASH_OP_BLOCK_ERASE;
+        port->flash.step = DLN2_SPI_FLASH_BLOCK_SIZE;
+    }
+    dln2_spi_flash_op(port, op, true, 0);
 }
 
-static bool dln2_spi_read_write(struct dln2_slot *slot)
+static void dln2_spi_flash_read_start(struct dln2_spi_port *port)
+{
+    port->flash.step = tu_min32(port->flash.end - port->flash.addr, DLN2_SPI_FLASH_PAGE_SIZE);
+    dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_READ, true, port->flash.step);
+}
+
+// Called when the previous operation is done
+static void dln2_spi_flash_task(struct dln2_spi_port *port)
+{
+    uint16_t id = dln2_slot_header(port->flash.slot)->id;
+    uint8_t *buf = port->flash.buf;
+    struct dln2_slot *slot;
+
+    if (dma_channel_is_busy(port->dma_rx))
+        return;
+
+    switch (port->flash.op) {
+    case DLN2_SPI_FLASH_OP_READ_ID:
+        slot = dln2_spi_flash_done(port);
+        memcpy(dln2_slot_response_data(slot), &buf[1], 3);
+        dln2_response(slot, 3);
+        break;
+
+    case DLN2_SPI_FLASH_OP_WRITE_ENABLE:
+        if (id == DLN2_SPI_FLASH_ERASE)
+            dln2_spi_flash_erase_start(port);
+        else
+            dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_PAGE_PROGRAM, true, port->flash.step);
+        break;
+
+    case DLN2_SPI_FLASH_OP_SECTOR_ERASE:
+    case DLN2_SPI_FLASH_OP_BLOCK_ERASE:
+    case DLN2_SPI_FLASH_OP_PAGE_PROGRAM:
+        port->flash.addr += port->flash.step;
+        port->flash.timeout = time_us_64() + DLN2_SPI_FLASH_TIMEOUT_US;
+        dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_READ_STATUS, false, 1);
+        break;
+
+    case DLN2_SPI_FLASH_OP_READ_STATUS:
+        if (buf[1] & DLN2_SPI_FLASH_STATUS_WIP) {
+            if (time_us_64() > port->flash.timeout) {
+                LOG1("SPI: Flash timeout: status=0x%02x\n", buf[1]);
+                dln2_response_error(dln2_spi_flash_done(port), DLN2_RES_FAIL);
+                break;
+            }
+            dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_READ_STATUS, false, 1);
+        } else if (port->flash.addr < port->flash.end) {
+            dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_WRITE_ENABLE, false, 0);
+        } else {
+            dln2_response(dln2_spi_flash_done(port), 0);
+        }
+        break;
+
+    case DLN2_SPI_FLASH_OP_READ:
+        if (id == DLN2_SPI_FLASH_READ) {
+            // The data is sent by the read stream with CS still asserted
+            port->stream.slot = port->flash.slot;
+            port->stream.attr = 0;
+            port->stream.size = port->flash.end - port->flash.addr;
+            port->stream.offset = 0;
+            port->flash.slot = NULL;
+            break;
+        }
+
+        port->flash.crc = dln2_spi_flash_crc32(port->flash.crc, &buf[4], port->flash.step);
+        port->flash.addr += port->flash.step;
+        if (port->flash.addr < port->flash.end) {
+            dln2_spi_flash_read_start(port);
+            break;
+        }
+        dln2_response_u32(dln2_spi_flash_done(port), port->flash.crc);
+        break;
+    }
+}
+
+static void dln2_spi_port_task(struct dln2_spi_port *port)
+{
+    if (port->flash.slot) {
+        dln2_spi_flash_task(port);
+        return;
+    }
+
+    if (port->stream.slot) {
+        dln2_spi_stream_read_task(port);
+        return;
+    }
+
+    struct dln2_slot *slot = port->xfer.slot;
+
+    // RX is done last, when the final frame has been clocked in
+    if (!slot || (port->xfer.size && dma_channel_is_busy(port->dma_rx)))
+        return;
+
+    if (port->list.count && dln2_spi_list_task(port))
+        return;
+
+    port->xfer.slot = NULL;
+
+    if (!(port->xfer.attr & DLN2_SPI_ATTR_LEAVE_SS_LOW))
+        dln2_spi_cs_active(port, false);
+
+    dln2_response(slot, port->xfer.len);
+}
+
+void dln2_spi_task(void)
+{
+    for (uint i = 0; i < DLN2_SPI_PORTS; i++)
+        dln2_spi_port_task(&dln2_spi_ports[i]);
+}
+
+// Called before the slots are reset, the ports are left enabled but idle
+void dln2_spi_reset(void)
+{
+    for (uint i = 0; i < DLN2_SPI_PORTS; i++) {
+        struct dln2_spi_port *port = &dln2_spi_ports[i];
+
+        if (port->dma_rx < 0)
+            continue;
+
+        dma_channel_abort(port->dma_tx);
+        dma_channel_abort(port->dma_rx);
+        dln2_spi_cs_active(port, false);
+        // Restarts the state machine and undoes the format of a list segment
+        dln2_spi_set_format(port, port->config.bpw, 1);
+
+        port->xfer.slot = NULL;
+        port->list.count = 0;
+        port->list.delay_end = 0;
+        port->stream.slot = NULL;
+        port->stream.ev = NULL;
+        port->stream.write = false;
+        port->flash.slot = NULL;
+    }
+}
+
+static bool dln2_spi_read_write(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
     struct {
         uint8_t port;
@@ -234,7 +1221,6 @@ static bool dln2_spi_read_write(struct dln2_slot *slot)
         uint8_t attr;
         uint8_t buf[DLN2_SPI_MAX_XFER_SIZE];
     } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
-    uint8_t attr = cmd->attr;
     uint16_t *size = dln2_slot_response_data(slot);
     uint8_t *buf = dln2_slot_response_data(slot) + sizeof(*size);
 
@@ -244,28 +1230,26 @@ static bool dln2_spi_read_write(struct dln2_slot *slot)
 
     LOG1("DLN2_SPI_READ_WRITE: port=%u size=%u attr=0x%02x\n", cmd->port, cmd->size, cmd->attr);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
     if (cmd->size > DLN2_SPI_MAX_XFER_SIZE)
         return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
     if (cmd->size != (len - 4))
         return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
 
-    dln2_spi_cs_active(true);
-
-    // The buffer addresses are 32-bit aligned and can be used directly.
-    // It looks like txbuf can move ahead 8 bytes on rxbuf so we can't use buf directly
-    spi_write_read_blocking(spi_default, cmd->buf, dln2_spi_tmp_buf, cmd->size);
+    uint16_t xfer_size = cmd->size;
+    uint8_t attr = cmd->attr;
 
-    if (!(attr & DLN2_SPI_ATTR_LEAVE_SS_LOW))
-        dln2_spi_cs_active(false);
+    put_unaligned_le16(xfer_size, size);
 
-    memcpy(buf, dln2_spi_tmp_buf, cmd->size);
+    static_assert(sizeof(struct dln2_header) + offsetof(typeof(*cmd), buf) ==
+                  sizeof(struct dln2_response) + sizeof(*size), "command and response data don't line up");
 
-    return dln2_response(slot, sizeof(uint16_t) + cmd->size);
+    // The response data is at the same offset as the command data so the transfer is done in place.
+    // That's safe since a frame can't be received before it has been sent, RX always trails TX.
+    return dln2_spi_xfer_start(port, slot, cmd->buf, buf, xfer_size, attr,
+                               sizeof(uint16_t) + xfer_size);
 }
 
-static bool dln2_spi_read(struct dln2_slot *slot)
+static bool dln2_spi_read(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
     struct {
         uint8_t port;
@@ -280,25 +1264,16 @@ static bool dln2_spi_read(struct dln2_slot *slot)
     DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
     LOG1("DLN2_SPI_READ: port=%u size=%zu attr=0x%02x\n", cmd->port, len, cmd->attr);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
     if (len > DLN2_SPI_MAX_XFER_SIZE)
         return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
 
     put_unaligned_le16(len, size);
 
-    dln2_spi_cs_active(true);
-
     // The buffer address is 32-bit aligned and can be used directly
-    spi_read_blocking(spi_default, 0, buf, len);
-
-    if (!(attr & DLN2_SPI_ATTR_LEAVE_SS_LOW))
-        dln2_spi_cs_active(false);
-
-    return dln2_response(slot, sizeof(uint16_t) + len);
+    return dln2_spi_xfer_start(port, slot, &dln2_spi_dummy_tx, buf, len, attr, sizeof(uint16_t) + len);
 }
 
-static bool dln2_spi_write(struct dln2_slot *slot)
+static bool dln2_spi_write(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
     struct {
         uint8_t port;
@@ -313,25 +1288,284 @@ static bool dln2_spi_write(struct dln2_slot *slot)
 
     LOG1("DLN2_SPI_WRITE: port=%u size=%u attr=0x%02x\n", cmd->port, cmd->size, cmd->attr);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
     if (cmd->size > DLN2_SPI_MAX_XFER_SIZE)
         return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
     if (cmd->size != (len - 4))
         return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
 
-    dln2_spi_cs_active(true);
-
     // The buffer address is 32-bit aligned and can be used directly
-    spi_write_blocking(spi_default, cmd->buf, cmd->size);
+    return dln2_spi_xfer_start(port, slot, cmd->buf, &dln2_spi_dummy_rx, cmd->size, cmd->attr, 0);
+}
+
+static bool dln2_spi_transfer_list(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    struct {
+        uint8_t port;
+        uint8_t count;
+        uint8_t attr;
+        struct dln2_spi_segment segs[];
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    size_t len = dln2_slot_header_data_size(slot);
+    size_t tx_len = 0, rx_len = 0;
+
+    if (len < 3 || len < 3 + cmd->count * sizeof(struct dln2_spi_segment))
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
 
-    if (!(cmd->attr & DLN2_SPI_ATTR_LEAVE_SS_LOW))
-        dln2_spi_cs_active(false);
+    LOG1("DLN2_SPI_TRANSFER_LIST: port=%u count=%u attr=0x%02x\n", cmd->port, cmd->count, cmd->attr);
 
-    return dln2_response(slot, 0);
+    if (!cmd->count || cmd->count > DLN2_SPI_MAX_SEGMENTS)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+
+    for (uint i = 0; i < cmd->count; i++) {
+        struct dln2_spi_segment *seg = &cmd->segs[i];
+        uint8_t bpw = seg->bpw ? seg->bpw : port->config.bpw;
+        uint lanes = dln2_spi_segment_lanes(seg);
+        bool duplex = (seg->flags & DLN2_SPI_SEGMENT_TX) && (seg->flags & DLN2_SPI_SEGMENT_RX);
+
+        if (seg->flags & ~(DLN2_SPI_SEGMENT_TX | DLN2_SPI_SEGMENT_RX | DLN2_SPI_SEGMENT_CS_CHANGE |
+                           DLN2_SPI_SEGMENT_DUAL | DLN2_SPI_SEGMENT_QUAD))
+            return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+        if (lanes > 1 && (seg->flags & DLN2_SPI_SEGMENT_TX))
+            return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+        // The quad pins can do dual reads too
+        if ((lanes == 4 && !(port->flags & DLN2_SPI_PIO_QUAD)) ||
+            (lanes == 2 && !(port->flags & (DLN2_SPI_PIO_DUAL | DLN2_SPI_PIO_QUAD))) ||
+            (lanes > 1 && (port->config.mode & DLN2_SPI_CPHA)) ||
+            (duplex && (port->flags & DLN2_SPI_PIO_3WIRE)))
+            return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+        if (!dln2_spi_bpw_valid(port, bpw))
+            return dln2_response_error(slot, DLN2_RES_SPI_INVALID_FRAME_SIZE);
+        if (!dln2_spi_period_valid(port, bpw, port->config.delay_between_frames))
+            return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+        // The 16-bit words have to be aligned in the buffers
+        if (dln2_spi_wide(bpw) && ((seg->len | tx_len | rx_len) & 1))
+            return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+        if (seg->flags & DLN2_SPI_SEGMENT_TX)
+            tx_len += seg->len;
+        if (seg->flags & DLN2_SPI_SEGMENT_RX)
+            rx_len += seg->len;
+    }
+
+    if (rx_len > DLN2_SPI_MAX_XFER_SIZE)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    if (len != 3 + cmd->count * sizeof(struct dln2_spi_segment) + tx_len)
+        return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+    if (port->dma_rx < 0 || port->stream.write)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+
+    uint8_t attr = cmd->attr;
+    port->list.count = cmd->count;
+    port->list.index = 0;
+    port->list.tx_offset = 0;
+    port->list.rx_offset = 0;
+    memcpy(port->list.segs, cmd->segs, cmd->count * sizeof(struct dln2_spi_segment));
+    memcpy(port->list.tx, &cmd->segs[cmd->count], tx_len);
+
+    put_unaligned_le16(rx_len, dln2_slot_response_data(slot));
+
+    port->xfer.slot = slot;
+    port->xfer.attr = attr;
+    port->xfer.len = sizeof(uint16_t) + rx_len;
+    dln2_spi_list_segment_start(port);
+
+    return true;
+}
+
+static bool dln2_spi_stream_start(struct dln2_spi_port *port, struct dln2_slot *slot, bool write)
+{
+    struct {
+        uint8_t port;
+        uint32_t size;
+        uint8_t attr;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+    LOG1("DLN2_SPI_STREAM_%s: port=%u size=%u attr=0x%02x\n", write ? "WRITE" : "READ", cmd->port, cmd->size, cmd->attr);
+
+    if (!cmd->size)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    if (port->dma_rx < 0 || port->stream.write)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+    if (!dln2_spi_period_valid(port, port->config.bpw, port->config.delay_between_frames))
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+    if (dln2_spi_wide(port->config.bpw) && (cmd->size & 1))
+        return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+
+    port->stream.write = write;
+    port->stream.attr = cmd->attr;
+    port->stream.size = cmd->size;
+    port->stream.offset = 0;
+
+    dln2_spi_cs_active(port, true);
+
+    if (write)
+        return dln2_response(slot, 0);
+
+    // Answered from dln2_spi_task() when all the data has been sent
+    port->stream.slot = slot;
+    return true;
+}
+
+static bool dln2_spi_stream_data(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    struct {
+        uint8_t port;
+        uint8_t buf[];
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    size_t len = dln2_slot_header_data_size(slot);
+    uint8_t attr = DLN2_SPI_ATTR_LEAVE_SS_LOW;
+
+    if (len < 2)
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+    len--;
+
+    LOG1("DLN2_SPI_STREAM_DATA: port=%u len=%zu\n", cmd->port, len);
+
+    if (!port->stream.write)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+    if (!dln2_spi_period_valid(port, port->config.bpw, port->config.delay_between_frames))
+        return dln2_response_error(slot, DLN2_RES_INVALID_VALUE);
+    if (len > port->stream.size - port->stream.offset)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    if (dln2_spi_wide(port->config.bpw) && (len & 1))
+        return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+
+    port->stream.offset += len;
+    if (port->stream.offset == port->stream.size) {
+        port->stream.write = false;
+        attr = port->stream.attr;
+    }
+
+    // The data follows the port number, move it so the words are aligned
+    void *tx = cmd->buf;
+    if (dln2_spi_wide(port->config.bpw)) {
+        memmove(cmd, cmd->buf, len);
+        tx = cmd;
+    }
+
+    return _dln2_spi_xfer_start(port, slot, tx, &dln2_spi_dummy_rx, len, attr, 0);
+}
+
+// Returns the error if the command can't be run
+static uint16_t dln2_spi_flash_start(struct dln2_spi_port *port, struct dln2_slot *slot, uint32_t addr, uint32_t size)
+{
+    if (port->dma_rx < 0 || port->stream.write || (port->flags & DLN2_SPI_PIO_3WIRE))
+        return DLN2_RES_INVALID_MODE;
+    if (port->config.bpw != 8)
+        return DLN2_RES_SPI_INVALID_FRAME_SIZE;
+    if (!dln2_spi_period_valid(port, 8, port->config.delay_between_frames))
+        return DLN2_RES_INVALID_VALUE;
+    // The opcodes and addresses are sent as they are
+    if (port->flags & DLN2_SPI_PIO_LSB_FIRST)
+        return DLN2_RES_BAD_PARAMETER;
+    if (addr >= DLN2_SPI_FLASH_SIZE || size > DLN2_SPI_FLASH_SIZE - addr)
+        return DLN2_RES_BAD_PARAMETER;
+
+    port->flash.slot = slot;
+    port->flash.addr = addr;
+    port->flash.end = addr + size;
+    return DLN2_RES_SUCCESS;
+}
+
+static bool dln2_spi_flash_read_id(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    uint8_t *port_num = dln2_slot_header_data(slot);
+
+    LOG1("DLN2_SPI_FLASH_READ_ID: port=%u\n", *port_num);
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port_num));
+
+    uint16_t res = dln2_spi_flash_start(port, slot, 0, 0);
+    if (res)
+        return dln2_response_error(slot, res);
+
+    dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_READ_ID, false, 3);
+    return true;
 }
 
-static bool dln2_spi_set_ss(struct dln2_slot *slot)
+// Sectors are erased until the address is 64k aligned and then blocks as far as they fit
+static bool dln2_spi_flash_erase(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    struct {
+        uint8_t port;
+        uint32_t addr;
+        uint32_t size;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+    LOG1("DLN2_SPI_FLASH_ERASE: port=%u addr=0x%x size=%u\n", cmd->port, cmd->addr, cmd->size);
+
+    if (!cmd->size || (cmd->addr | cmd->size) % DLN2_SPI_FLASH_SECTOR_SIZE)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    uint16_t res = dln2_spi_flash_start(port, slot, cmd->addr, cmd->size);
+    if (res)
+        return dln2_response_error(slot, res);
+
+    dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_WRITE_ENABLE, false, 0);
+    return true;
+}
+
+// One page at a time, the host doesn't have to wait for the response before sending the next page
+static bool dln2_spi_flash_program(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    struct {
+        uint8_t port;
+        uint32_t addr;
+        uint8_t buf[DLN2_SPI_FLASH_PAGE_SIZE];
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    size_t len = dln2_slot_header_data_size(slot);
+
+    if (len < 5 + 1 || len > sizeof(*cmd))
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+    len -= 5;
+
+    LOG1("DLN2_SPI_FLASH_PROGRAM: port=%u addr=0x%x len=%zu\n", cmd->port, cmd->addr, len);
+
+    // The address wraps around within the page
+    if ((cmd->addr % DLN2_SPI_FLASH_PAGE_SIZE) + len > DLN2_SPI_FLASH_PAGE_SIZE)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    uint16_t res = dln2_spi_flash_start(port, slot, cmd->addr, len);
+    if (res)
+        return dln2_response_error(slot, res);
+
+    port->flash.step = len;
+    memcpy(&port->flash.buf[4], cmd->buf, len);
+    dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_WRITE_ENABLE, false, 0);
+    return true;
+}
+
+// The data is sent as DLN2_SPI_STREAM_READ_EV events, the response is sent when they're done
+static bool dln2_spi_flash_read(struct dln2_spi_port *port, struct dln2_slot *slot, bool crc)
+{
+    struct {
+        uint8_t port;
+        uint32_t addr;
+        uint32_t size;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+    LOG1("DLN2_SPI_FLASH_%s: port=%u addr=0x%x size=%u\n", crc ? "CRC32" : "READ", cmd->port, cmd->addr, cmd->size);
+
+    if (!cmd->size)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    uint16_t res = dln2_spi_flash_start(port, slot, cmd->addr, cmd->size);
+    if (res)
+        return dln2_response_error(slot, res);
+
+    if (crc) {
+        port->flash.crc = 0;
+        dln2_spi_flash_read_start(port);
+    } else {
+        dln2_spi_flash_op(port, DLN2_SPI_FLASH_OP_READ, true, 0);
+    }
+    return true;
+}
+
+static uint8_t dln2_spi_ss_valid_mask(struct dln2_spi_port *port)
+{
+    return (1 << port->ss.count) - 1;
+}
+
+static bool dln2_spi_set_ss(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
     struct {
         uint8_t port;
@@ -342,142 +1576,389 @@ static bool dln2_spi_set_ss(struct dln2_slot *slot)
 
     LOG1("DLN2_SPI_SET_SS: port=%u cs_mask=0x%02x\n", cmd->port, cmd->cs_mask);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
-
-    if (cmd->cs_mask & 0xFE != 0xFE)
+    // A cleared bit selects the chip select, several can be active at the same time
+    uint8_t selected = ~cmd->cs_mask;
+    if (!selected || (selected & ~dln2_spi_ss_valid_mask(port)))
         return dln2_response_error(slot, DLN2_RES_SPI_MASTER_INVALID_SS_VALUE);
 
-    // Nothing to do since there's only one chip select
+    if (selected != port->ss.selected) {
+        dln2_spi_cs_active(port, false);
+        port->ss.selected = selected;
+    }
 
     return dln2_response(slot, 0);
 }
 
-static bool dln2_spi_ss_multi_enable(struct dln2_slot *slot, bool enable)
+static bool dln2_spi_ss_multi_enable(struct dln2_spi_port *port, struct dln2_slot *slot, bool enable)
 {
     struct {
         uint8_t port;
         uint8_t cs_mask;
     } *cmd = dln2_slot_header_data(slot);
-    uint cs = PICO_DEFAULT_SPI_CSN_PIN;
+    uint8_t mask;
+    int res;
 
     DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
 
     LOG1("%s: port=%u cs_mask=0x%02x\n", enable ? "DLN2_SPI_SS_MULTI_ENABLE" : "DLN2_SPI_SS_MULTI_DISABLE", cmd->port, cmd->cs_mask);
 
-    if (cmd->port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
-
-    if (cmd->cs_mask != 0x01)
+    if (!cmd->cs_mask || (cmd->cs_mask & ~dln2_spi_ss_valid_mask(port)))
         return dln2_response_error(slot, DLN2_RES_SPI_MASTER_INVALID_SS_VALUE);
 
     if (enable) {
-        int res = dln2_pin_request(cs, DLN2_MODULE_SPI);
-        if (res)
-            return dln2_response_error(slot, res);
+        mask = cmd->cs_mask & ~port->ss.enabled;
+
+        // The table could have been set before the other port took the pin or the engine changed
+        uint32_t in_use = dln2_spi_pins(port) | dln2_spi_other_ports_pins(port);
+        for (uint i = 0; i < port->ss.count; i++) {
+            if ((mask & (1 << i)) && (in_use & (1u << port->ss.pins[i])))
+                return dln2_response_error(slot, DLN2_RES_PIN_IN_USE);
+        }
+
+        dln2_spi_cs_active(port, false);
 
-        gpio_init(cs);
-        gpio_set_dir(cs, GPIO_OUT);
-        gpio_put(cs, 1);
+        for (uint i = 0; i < port->ss.count; i++) {
+            if (!(mask & (1 << i)))
+                continue;
+
+            res = dln2_pin_request(port->ss.pins[i], DLN2_MODULE_SPI);
+            if (res) {
+                while (i--) {
+                    if (mask & (1 << i))
+                        dln2_pin_free(port->ss.pins[i], DLN2_MODULE_SPI);
+                }
+                return dln2_response_error(slot, res);
+            }
+        }
+
+        for (uint i = 0; i < port->ss.count; i++) {
+            if (!(mask & (1 << i)))
+                continue;
+
+            uint cs = port->ss.pins[i];
+            gpio_init(cs);
+            gpio_set_dir(cs, GPIO_OUT);
+            gpio_put(cs, 1);
+        }
+
+        port->ss.enabled |= mask;
     } else {
-        int res = dln2_pin_free(cs, DLN2_MODULE_SPI);
-        if (res)
-            return dln2_response_error(slot, res);
+        mask = cmd->cs_mask & port->ss.enabled;
 
-        gpio_set_function(cs, GPIO_FUNC_NULL);
+        for (uint i = 0; i < port->ss.count; i++) {
+            if (!(mask & (1 << i)))
+                continue;
+
+            uint cs = port->ss.pins[i];
+            res = dln2_pin_free(cs, DLN2_MODULE_SPI);
+            if (res)
+                return dln2_response_error(slot, res);
+
+            gpio_set_function(cs, GPIO_FUNC_NULL);
+            port->ss.enabled &= ~(1 << i);
+        }
     }
 
     return dln2_response(slot, 0);
 }
 
-static bool dln2_spi_get_supported_frame_sizes(struct dln2_slot *slot)
+static bool dln2_spi_set_ss_pins(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
-    uint8_t *port = dln2_slot_header_data(slot);
+    struct {
+        uint8_t port;
+        uint8_t count;
+        uint8_t pins[DLN2_SPI_MAX_SS];
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    size_t len = dln2_slot_header_data_size(slot);
+
+    if (len < 2 || len != 2 + cmd->count)
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+
+    LOG1("DLN2_SPI_SET_SS_PINS: port=%u count=%u\n", cmd->port, cmd->count);
+
+    if (!cmd->count || cmd->count > DLN2_SPI_MAX_SS)
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    if (port->ss.enabled)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+
+    uint32_t in_use = dln2_spi_pins(port) | dln2_spi_other_ports_pins(port);
+    for (uint i = 0; i < cmd->count; i++) {
+        if (cmd->pins[i] >= NUM_BANK0_GPIOS)
+            return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+        for (uint j = 0; j < i; j++) {
+            if (cmd->pins[j] == cmd->pins[i])
+                return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+        }
+        if (in_use & (1u << cmd->pins[i]))
+            return dln2_response_error(slot, DLN2_RES_PIN_IN_USE);
+    }
+
+    memcpy(port->ss.pins, cmd->pins, cmd->count);
+    port->ss.count = cmd->count;
+    port->ss.selected = 0x01;
+
+    return dln2_response(slot, 0);
+}
+
+static bool dln2_spi_get_ss_pins(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    uint8_t *port_num = dln2_slot_header_data(slot);
     uint8_t *data = dln2_slot_response_data(slot);
-    int i, j;
 
-    LOG1("DLN2_SPI_GET_SUPPORTED_FRAME_SIZES: port=%u\n", *port);
-    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port));
+    LOG1("DLN2_SPI_GET_SS_PINS: port=%u\n", *port_num);
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port_num));
 
-    if (*port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
+    data[0] = port->ss.count;
+    memcpy(data + 1, port->ss.pins, port->ss.count);
+
+    return dln2_response(slot, 1 + port->ss.count);
+}
+
+// The controller is on GPIO0-7 and GPIO16-23 (spi0) or GPIO8-15 and GPIO24-29 (spi1),
+// the functions repeat every 4 pins: RX, CSn, SCK, TX
+static bool dln2_spi_hw_pin_valid(struct dln2_spi_port *port, uint pin, uint function)
+{
+    return ((pin >> 3) & 1) == spi_get_index(port->spi) && (pin & 3) == function;
+}
+
+static bool dln2_spi_set_engine(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    struct {
+        uint8_t port;
+        uint8_t engine;
+        uint8_t flags;
+        uint8_t sck;
+        uint8_t mosi;
+        uint8_t miso;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    uint8_t lanes = DLN2_SPI_PIO_DUAL | DLN2_SPI_PIO_QUAD;
+    bool three_wire = cmd->flags & DLN2_SPI_PIO_3WIRE;
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*cmd));
+
+    LOG1("DLN2_SPI_SET_ENGINE: port=%u engine=%u flags=0x%02x sck=%u mosi=%u miso=%u\n",
+         cmd->port, cmd->engine, cmd->flags, cmd->sck, cmd->mosi, cmd->miso);
+
+    // The pins can't change under an enabled port
+    if (port->dma_rx >= 0)
+        return dln2_response_error(slot, DLN2_RES_INVALID_MODE);
+
+    if (cmd->engine > DLN2_SPI_ENGINE_PIO || (cmd->flags & ~(DLN2_SPI_PIO_LSB_FIRST | DLN2_SPI_PIO_3WIRE | lanes)))
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+    if ((cmd->engine == DLN2_SPI_ENGINE_HW && cmd->flags) || ((cmd->flags & lanes) && three_wire))
+        return dln2_response_error(slot, DLN2_RES_BAD_PARAMETER);
+
+    if (cmd->sck >= NUM_BANK0_GPIOS || cmd->mosi >= NUM_BANK0_GPIOS || cmd->miso >= NUM_BANK0_GPIOS ||
+        cmd->sck == cmd->mosi || (!three_wire && (cmd->sck == cmd->miso || cmd->mosi == cmd->miso)))
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+
+    if ((cmd->flags & lanes) && cmd->miso != cmd->mosi + 1)
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+    if ((cmd->flags & DLN2_SPI_PIO_QUAD) &&
+        (cmd->mosi + 3 >= NUM_BANK0_GPIOS || (cmd->sck >= cmd->mosi && cmd->sck <= cmd->mosi + 3)))
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+
+    if (cmd->engine == DLN2_SPI_ENGINE_HW &&
+        (!dln2_spi_hw_pin_valid(port, cmd->sck, 2) || !dln2_spi_hw_pin_valid(port, cmd->mosi, 3) ||
+         !dln2_spi_hw_pin_valid(port, cmd->miso, 0)))
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+
+    port->engine = cmd->engine;
+    port->flags = cmd->flags;
+    port->sck = cmd->sck;
+    port->mosi = cmd->mosi;
+    port->miso = cmd->miso;
+
+    // The frequency is kept within the engine's range
+    if (!dln2_spi_bpw_valid(port, port->config.bpw))
+        port->config.bpw = 8;
+    port->config.freq = tu_max32(dln2_spi_min_frequency(port),
+                                 tu_min32(port->config.freq, dln2_spi_max_frequency(port)));
+
+    return dln2_response(slot, 0);
+}
+
+static bool dln2_spi_get_engine(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    uint8_t *port_num = dln2_slot_header_data(slot);
+    uint8_t *data = dln2_slot_response_data(slot);
+
+    LOG1("DLN2_SPI_GET_ENGINE: port=%u\n", *port_num);
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port_num));
+
+    data[0] = port->engine;
+    data[1] = port->flags;
+    data[2] = port->sck;
+    data[3] = port->mosi;
+    data[4] = port->miso;
+
+    return dln2_response(slot, 5);
+}
+
+static bool dln2_spi_get_supported_frame_sizes(struct dln2_spi_port *port, struct dln2_slot *slot)
+{
+    uint8_t *port_num = dln2_slot_header_data(slot);
+    uint8_t *data = dln2_slot_response_data(slot);
+    int i, j;
+
+    LOG1("DLN2_SPI_GET_SUPPORTED_FRAME_SIZES: port=%u\n", *port_num);
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port_num));
 
     memset(data, 0, 1 + 36);
     j = 1;
-    for (i = 4; i <= 16; i++)
-        data[j++] = i;
+    for (i = 4; i <= 16; i++) {
+        if (dln2_spi_bpw_valid(port, i))
+            data[j++] = i;
+    }
     data[0] = j - 1;
 
     return dln2_response(slot, 1 + 36);
 }
 
-static bool dln2_spi_get_ss_count(struct dln2_slot *slot)
+static bool dln2_spi_get_ss_count(struct dln2_spi_port *port, struct dln2_slot *slot)
 {
-    uint8_t *port = dln2_slot_header_data(slot);
+    uint8_t *port_num = dln2_slot_header_data(slot);
 
-    LOG1("DLN2_SPI_GET_SS_COUNT: port=%u\n", *port);
-    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port));
-
-    if (*port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
+    LOG1("DLN2_SPI_GET_SS_COUNT: port=%u\n", *port_num);
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*port_num));
 
     // set defaults
-    dln2_spi_config.freq = DLN2_SPI_DEFAULT_FREQUENCY;
-    dln2_spi_config.bpw = 8;
-
-    return dln2_response_u16(slot, 1);
+    port->config.freq = DLN2_SPI_DEFAULT_FREQUENCY;
+    port->config.bpw = 8;
+    port->config.delay_after_ss = 0;
+    port->config.delay_between_ss = 0;
+    port->config.delay_between_frames = 0;
+    dln2_spi_dma_timer_unclaim(port);
+
+    return dln2_response_u16(slot, port->ss.count);
 }
 
-static uint dln2_spi_get_frequency(struct dln2_slot *slot, uint32_t freq)
+static uint dln2_spi_get_frequency(struct dln2_spi_port *port, struct dln2_slot *slot, uint32_t freq)
 {
     struct dln2_header *hdr = dln2_slot_header(slot);
-    uint8_t *port = dln2_slot_header_data(slot);
+    uint8_t *port_num = dln2_slot_header_data(slot);
 
     LOG1("%s: port=%u freq=%u\n",
-         hdr->id == DLN2_SPI_GET_MIN_FREQUENCY ? "DLN2_SPI_GET_MIN_FREQUENCY" : "DLN2_SPI_GET_MAX_FREQUENCY" , *port, freq);
+         hdr->id == DLN2_SPI_GET_MIN_FREQUENCY ? "DLN2_SPI_GET_MIN_FREQUENCY" : "DLN2_SPI_GET_MAX_FREQUENCY" , *port_num, freq);
     DLN2_VERIFY_COMMAND_SIZE(slot, 1);
 
-    if (*port)
-        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
-
     return dln2_response_u32(slot, freq);
 }
 
+// The response data size of a transfer request or -1 for the other commands. A request that's too
+// short gets an error response without data.
+int dln2_spi_response_size(const struct dln2_header *msg)
+{
+    const void *data = msg + 1;
+    size_t len = msg->size - sizeof(*msg);
+
+    switch (msg->id) {
+    case DLN2_SPI_READ_WRITE:
+    case DLN2_SPI_READ: {
+        const struct {
+            uint8_t port;
+            uint16_t size;
+            uint8_t attr;
+        } TU_ATTR_PACKED *cmd = data;
+        return len < sizeof(*cmd) ? 0 : sizeof(uint16_t) + cmd->size;
+    }
+    case DLN2_SPI_WRITE:
+        return 0;
+    case DLN2_SPI_TRANSFER_LIST: {
+        const struct {
+            uint8_t port;
+            uint8_t count;
+            uint8_t attr;
+            struct dln2_spi_segment segs[];
+        } TU_ATTR_PACKED *cmd = data;
+        size_t rx_len = 0;
+
+        if (len < 3 || len < 3 + cmd->count * sizeof(struct dln2_spi_segment))
+            return 0;
+        for (uint i = 0; i < cmd->count; i++) {
+            if (cmd->segs[i].flags & DLN2_SPI_SEGMENT_RX)
+                rx_len += cmd->segs[i].len;
+        }
+        return sizeof(uint16_t) + rx_len;
+    }
+    default:
+        return -1;
+    }
+}
+
 bool dln2_handle_spi(struct dln2_slot *slot)
 {
     struct dln2_header *hdr = dln2_slot_header(slot);
+    struct dln2_spi_port *port = dln2_spi_get_port(slot);
+
+    if (!port)
+        return dln2_response_error(slot, DLN2_RES_INVALID_PORT_NUMBER);
 
     switch (hdr->id) {
     case DLN2_SPI_ENABLE:
-        return dln2_spi_enable(slot, true);
+        return dln2_spi_enable(port, slot, true);
     case DLN2_SPI_DISABLE:
-        return dln2_spi_enable(slot, false);
+        return dln2_spi_enable(port, slot, false);
     case DLN2_SPI_SET_MODE:
-        return dln2_spi_set_mode(slot);
+        return dln2_spi_set_mode(port, slot);
     case DLN2_SPI_SET_FRAME_SIZE:
-        return dln2_spi_set_bpw(slot);
+        return dln2_spi_set_bpw(port, slot);
     case DLN2_SPI_SET_FREQUENCY:
-        return dln2_spi_set_frequency(slot);
+        return dln2_spi_set_frequency(port, slot);
     case DLN2_SPI_READ_WRITE:
-        return dln2_spi_read_write(slot);
+        return dln2_spi_read_write(port, slot);
     case DLN2_SPI_READ:
-        return dln2_spi_read(slot);
+        return dln2_spi_read(port, slot);
     case DLN2_SPI_WRITE:
-        return dln2_spi_write(slot);
+        return dln2_spi_write(port, slot);
+    case DLN2_SPI_SET_DELAY_BETWEEN_SS:
+    case DLN2_SPI_SET_DELAY_AFTER_SS:
+    case DLN2_SPI_SET_DELAY_BETWEEN_FRAMES:
+        return dln2_spi_set_delay(port, slot);
+    case DLN2_SPI_GET_DELAY_BETWEEN_SS:
+    case DLN2_SPI_GET_DELAY_AFTER_SS:
+    case DLN2_SPI_GET_DELAY_BETWEEN_FRAMES:
+        return dln2_spi_get_delay(port, slot);
     case DLN2_SPI_SET_SS:
-        return dln2_spi_set_ss(slot);
+        return dln2_spi_set_ss(port, slot);
     case DLN2_SPI_SS_MULTI_ENABLE:
-        return dln2_spi_ss_multi_enable(slot, true);
+        return dln2_spi_ss_multi_enable(port, slot, true);
     case DLN2_SPI_SS_MULTI_DISABLE:
-        return dln2_spi_ss_multi_enable(slot, false);
+        return dln2_spi_ss_multi_enable(port, slot, false);
     case DLN2_SPI_GET_SUPPORTED_FRAME_SIZES:
-        return dln2_spi_get_supported_frame_sizes(slot);
+        return dln2_spi_get_supported_frame_sizes(port, slot);
     case DLN2_SPI_GET_SS_COUNT:
-        return dln2_spi_get_ss_count(slot);
+        return dln2_spi_get_ss_count(port, slot);
     case DLN2_SPI_GET_MIN_FREQUENCY:
-        return dln2_spi_get_frequency(slot, dln2_spi_min_frequency());
+        return dln2_spi_get_frequency(port, slot, dln2_spi_min_frequency(port));
     case DLN2_SPI_GET_MAX_FREQUENCY:
-        return dln2_spi_get_frequency(slot, dln2_spi_max_frequency());
+        return dln2_spi_get_frequency(port, slot, dln2_spi_max_frequency(port));
+    case DLN2_SPI_STREAM_READ:
+        return dln2_spi_stream_start(port, slot, false);
+    case DLN2_SPI_STREAM_WRITE:
+        return dln2_spi_stream_start(port, slot, true);
+    case DLN2_SPI_STREAM_DATA:
+        return dln2_spi_stream_data(port, slot);
+    case DLN2_SPI_SET_SS_PINS:
+        return dln2_spi_set_ss_pins(port, slot);
+    case DLN2_SPI_GET_SS_PINS:
+        return dln2_spi_get_ss_pins(port, slot);
+    case DLN2_SPI_TRANSFER_LIST:
+        return dln2_spi_transfer_list(port, slot);
+    case DLN2_SPI_SET_ENGINE:
+        return dln2_spi_set_engine(port, slot);
+    case DLN2_SPI_GET_ENGINE:
+        return dln2_spi_get_engine(port, slot);
+    case DLN2_SPI_FLASH_READ_ID:
+        return dln2_spi_flash_read_id(port, slot);
+    case DLN2_SPI_FLASH_ERASE:
+        return dln2_spi_flash_erase(port, slot);
+    case DLN2_SPI_FLASH_PROGRAM:
+        return dln2_spi_flash_program(port, slot);
+    case DLN2_SPI_FLASH_READ:
+        return dln2_spi_flash_read(port, slot, false);
+    case DLN2_SPI_FLASH_CRC32:
+        return dln2_spi_flash_read(port, slot, true);
     default:
         LOG1("SPI: unknown command 0x%02x\n", hdr->id);
         return dln2_response_error(slot, DLN2_RES_COMMAND_NOT_SUPPORTED);
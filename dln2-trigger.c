@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the GPIO triggered transactions of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+// Transactions started by a GPIO event, like reading a sensor on its data ready line.
+//
+// A trigger holds a complete SPI or I2C transfer request message. Instead of sending an event for the pin,
+// dln2_gpio_task() queues a copy of the request as if it came from the host. The response is
+// turned into a DLN2_GPIO_TRIGGER_EV event with the time of the edge, its echo is the one in
+// the stored request. The host gets the sample in one transfer instead of paying for an event
+// and a request round trip.
+
+#include <stdio.h>
+#include <string.h>
+#include "dln2.h"
+
+#define LOG1    //printf
+
+#define DLN2_GPIO_TRIGGER_EV    DLN2_CMD(0x8A, DLN2_MODULE_GPIO)
+
+#ifndef DLN2_TRIGGERS
+#define DLN2_TRIGGERS   4
+#endif
+
+struct dln2_trigger_event {
+    uint16_t pin;
+    uint8_t value;
+    uint16_t missed;    // events that came while the previous transaction was still running
+    uint64_t timestamp;
+    uint16_t result;    // the response
+    uint8_t data[];
+} TU_ATTR_PACKED;
+
+#define DLN2_TRIGGER_MAX_DATA \
+    (DLN2_BUF_SIZE - sizeof(struct dln2_header) - sizeof(struct dln2_trigger_event))
+
+// An entry is kept until the transaction is done even if the trigger is removed meanwhile
+static struct dln2_trigger {
+    bool set;
+    bool busy;
+    uint8_t pin;
+    uint8_t value;
+    uint16_t missed;
+    uint64_t timestamp;
+    uint8_t msg[DLN2_BUF_SIZE];
+} dln2_triggers[DLN2_TRIGGERS];
+
+static struct dln2_trigger *dln2_trigger_find(uint pin)
+{
+    for (uint i = 0; i < DLN2_TRIGGERS; i++) {
+        if (dln2_triggers[i].set && dln2_triggers[i].pin == pin)
+            return &dln2_triggers[i];
+    }
+    return NULL;
+}
+
+void dln2_trigger_clear(uint pin)
+{
+    struct dln2_trigger *trigger = dln2_trigger_find(pin);
+
+    if (trigger)
+        trigger->set = false;
+}
+
+bool dln2_trigger_is_set(uint pin)
+{
+    return dln2_trigger_find(pin);
+}
+
+// The response becomes the event, the data is moved up to make room for the event fields
+static void dln2_trigger_complete(struct dln2_slot *slot)
+{
+    struct dln2_trigger *trigger = slot->context;
+    struct dln2_header *hdr = dln2_slot_header(slot);
+    struct dln2_trigger_event *ev = dln2_slot_header_data(slot);
+    uint16_t result = dln2_slot_response(slot)->result;
+    size_t len = dln2_slot_response_data_size(slot);
+
+    if (len > DLN2_TRIGGER_MAX_DATA) {
+        result = DLN2_RES_INVALID_BUFFER_SIZE;
+        len = 0;
+    }
+    memmove(ev->data, dln2_slot_response_data(slot), len);
+
+    ev->pin = trigger->pin;
+    ev->value = trigger->value;
+    ev->missed = trigger->missed;
+    ev->timestamp = trigger->timestamp;
+    ev->result = result;
+
+    hdr->size = sizeof(*hdr) + sizeof(*ev) + len;
+    hdr->id = DLN2_GPIO_TRIGGER_EV;
+    hdr->handle = DLN2_HANDLE_EVENT;
+
+    trigger->missed = 0;
+    trigger->busy = false;
+    slot->complete = NULL;
+    slot->context = NULL;
+
+    dln2_print_slot(slot);
+    dln2_queue_slot_in(slot);
+}
+
+// Returns false if there's no slot for the request, the event is tried again later
+bool dln2_trigger_run(uint pin, bool value, uint16_t count, uint64_t timestamp)
+{
+    struct dln2_trigger *trigger = dln2_trigger_find(pin);
+    struct dln2_header *msg = (struct dln2_header *)trigger->msg;
+
+    LOG1("%s: pin=%u value=%u count=%u busy=%u\n", __func__, pin, value, count, trigger->busy);
+
+    if (trigger->busy) {
+        trigger->missed += count;
+        return true;
+    }
+
+    struct dln2_slot *slot = dln2_get_event_slot();
+    if (!slot)
+        return false;
+
+    memcpy(slot->data, msg, msg->size);
+    slot->len = msg->size;
+    slot->complete = dln2_trigger_complete;
+    slot->context = trigger;
+
+    // Merged edges only start one transaction
+    trigger->busy = true;
+    trigger->value = value;
+    trigger->timestamp = timestamp;
+    trigger->missed += count - 1;
+
+    dln2_queue_request(slot);
+
+    return true;
+}
+
+// Called before the slots are reset, the transactions in progress are gone with them
+void dln2_trigger_reset(void)
+{
+    for (uint i = 0; i < DLN2_TRIGGERS; i++) {
+        dln2_triggers[i].busy = false;
+        dln2_triggers[i].missed = 0;
+    }
+}
+
+// The request message follows the pin, without it the trigger is removed
+bool dln2_trigger_set(struct dln2_slot *slot)
+{
+    struct {
+        uint16_t pin;
+        struct dln2_header msg;
+    } TU_ATTR_PACKED *cmd = dln2_slot_header_data(slot);
+    size_t len = dln2_slot_header_data_size(slot);
+
+    if (len < sizeof(cmd->pin))
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+    len -= sizeof(cmd->pin);
+
+    LOG1("%s: pin=%u len=%zu\n", __func__, cmd->pin, len);
+
+    if (!dln2_pin_is_requested(cmd->pin, DLN2_MODULE_GPIO))
+        return dln2_response_error(slot, DLN2_RES_INVALID_PIN_NUMBER);
+
+    dln2_trigger_clear(cmd->pin);
+    if (!len)
+        return dln2_response(slot, 0);
+
+    if (len < sizeof(cmd->msg) || cmd->msg.size != len)
+        return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+    if (cmd->msg.handle != DLN2_HANDLE_SPI && cmd->msg.handle != DLN2_HANDLE_I2C)
+        return dln2_response_error(slot, DLN2_RES_INVALID_HANDLE);
+
+    // Only data transfers, and the response has to fit in the event
+    int size = cmd->msg.handle == DLN2_HANDLE_SPI ? dln2_spi_response_size(&cmd->msg) :
+                                                    dln2_i2c_response_size(&cmd->msg);
+    if (size < 0)
+        return dln2_response_error(slot, DLN2_RES_COMMAND_NOT_SUPPORTED);
+    if (size > DLN2_TRIGGER_MAX_DATA)
+        return dln2_response_error(slot, DLN2_RES_INVALID_BUFFER_SIZE);
+
+    struct dln2_trigger *trigger = NULL;
+    for (uint i = 0; i < DLN2_TRIGGERS && !trigger; i++) {
+        if (!dln2_triggers[i].set && !dln2_triggers[i].busy)
+            trigger = &dln2_triggers[i];
+    }
+    if (!trigger)
+        return dln2_response_error(slot, DLN2_RES_FAIL);
+
+    trigger->pin = cmd->pin;
+    trigger->missed = 0;
+    memcpy(trigger->msg, &cmd->msg, len);
+    trigger->set = true;
+
+    return dln2_response(slot, 0);
+}
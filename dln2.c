@@ -11,7 +11,9 @@
  */
 
 #include "device/usbd_pvt.h"
+#include "pico/time.h"
 #include "pico/unique_id.h"
+#include "hardware/sync.h"
 #include "dln2.h"
 
 #define LOG1    //printf
@@ -22,6 +24,13 @@
 #define DLN2_CMD_GET_DEVICE_VER     DLN2_GENERIC_CMD(0x30)
 #define DLN2_CMD_GET_DEVICE_SN      DLN2_GENERIC_CMD(0x31)
 
+// Commands from 0x80 and up are extensions specific to this board
+#define DLN2_CMD_SET_FEATURES       DLN2_GENERIC_CMD(0x80)
+#define DLN2_CMD_GET_TIME           DLN2_GENERIC_CMD(0x81)
+
+#define DLN2_FEATURES_SUPPORTED     (DLN2_FEATURE_OUT_BATCH | DLN2_FEATURE_IN_COALESCE | \
+                                     DLN2_FEATURE_GPIO_TIMESTAMP)
+
 #define DLN2_HW_ID  0x200
 
 static uint8_t dln2_rhport;
@@ -31,46 +40,74 @@ static uint8_t dln2_ep_out;
 static struct dln2_slot dln2_slots[DLN2_MAX_SLOTS];
 static struct dln2_slot_queue dln2_slots_free;
 static struct dln2_slot_queue dln2_response_queue;
+static struct dln2_slot_queue dln2_request_queue;
 static struct dln2_slot *dln2_slot_out;
+static uint16_t dln2_slot_out_len;
 static struct dln2_slot *dln2_slot_in;
+static uint16_t dln2_slot_in_len;
+static uint32_t dln2_features;
 
+// A batch that is still being split because the slot pool ran out
+static struct dln2_slot *dln2_batch;
+static size_t dln2_batch_offset;
+
+// The queues are also fed from interrupt context (timer callbacks), so keep the
+// pointer updates atomic. Both operations are O(1) to keep the critical sections short.
 static void dln2_slot_enqueue(struct dln2_slot_queue *queue, struct dln2_slot *slot)
 {
     slot->next = NULL;
 
-    if (!queue->head) {
+    uint32_t ints = save_and_disable_interrupts();
+
+    if (queue->tail)
+        queue->tail->next = slot;
+    else
         queue->head = slot;
-        return;
-    }
+    queue->tail = slot;
+    queue->count++;
 
-    struct dln2_slot *cursor = queue->head;
-    while (cursor->next)
-        cursor = cursor->next;
-    cursor->next = slot;
+    restore_interrupts(ints);
 }
 
 static struct dln2_slot *dln2_slot_dequeue(struct dln2_slot_queue *queue)
 {
-    if (!queue->head)
-        return NULL;
+    uint32_t ints = save_and_disable_interrupts();
 
     struct dln2_slot *slot = queue->head;
-    queue->head = queue->head->next;
-    slot->next = NULL;
+    if (slot) {
+        queue->head = slot->next;
+        if (!queue->head)
+            queue->tail = NULL;
+        slot->next = NULL;
+        queue->count--;
+    }
+
+    restore_interrupts(ints);
+
     return slot;
 }
 
 static void dln2_slots_init(void)
 {
     dln2_slots_free.head = NULL;
+    dln2_slots_free.tail = NULL;
+    dln2_slots_free.count = 0;
     dln2_response_queue.head = NULL;
+    dln2_response_queue.tail = NULL;
+    dln2_response_queue.count = 0;
+    dln2_request_queue.head = NULL;
+    dln2_request_queue.tail = NULL;
+    dln2_request_queue.count = 0;
     dln2_slot_out = NULL;
     dln2_slot_in = NULL;
+    dln2_batch = NULL;
 
     for (uint i = 0; i < DLN2_MAX_SLOTS; i++) {
         struct dln2_slot *slot = &dln2_slots[i];
         slot->index = i;
         slot->len = 0;
+        slot->complete = NULL;
+        slot->context = NULL;
         dln2_slot_header(slot)->handle = DLN2_HANDLE_UNUSED;
         dln2_slot_enqueue(&dln2_slots_free, slot);
     }
@@ -103,7 +140,7 @@ void _dln2_print_slot(struct dln2_slot *slot, uint indent, const char *caller)
            slot->index, name, hdr->handle, hdr->id, hdr->size, hdr->echo, slot->len);
 }
 
-static struct dln2_slot *dln2_slot_print_queue(struct dln2_slot_queue *queue)
+static void __unused dln2_slot_print_queue(struct dln2_slot_queue *queue)
 {
     for (struct dln2_slot *slot = queue->head; slot; slot = slot->next)
         _dln2_print_slot(slot, 4, NULL);
@@ -114,17 +151,38 @@ struct dln2_slot *dln2_get_slot(void)
     return dln2_slot_dequeue(&dln2_slots_free);
 }
 
+// Events leave DLN2_EVENT_SLOTS_RESERVED slots for receiving and answering commands
+struct dln2_slot *dln2_get_event_slot(void)
+{
+    struct dln2_slot *slot = NULL;
+
+    uint32_t ints = save_and_disable_interrupts();
+
+    if (dln2_slots_free.count > DLN2_EVENT_SLOTS_RESERVED)
+        slot = dln2_slot_dequeue(&dln2_slots_free);
+
+    restore_interrupts(ints);
+
+    return slot;
+}
+
 static void dln2_put_slot(struct dln2_slot *slot)
 {
     dln2_print_slot(slot);
     memset(slot->data, 0, DLN2_BUF_SIZE);
     dln2_slot_header(slot)->handle = DLN2_HANDLE_UNUSED;
     slot->len = 0;
+    slot->complete = NULL;
+    slot->context = NULL;
     dln2_slot_enqueue(&dln2_slots_free, slot);
 }
 
 static void dln2_queue_slot_out(void)
 {
+    // The next transfer would overtake the rest of the batch
+    if (dln2_batch)
+        return;
+
     struct dln2_slot *slot = dln2_get_slot();
     if (!slot) {
         LOG1("Run out of slots!\n");
@@ -133,13 +191,18 @@ static void dln2_queue_slot_out(void)
 
     dln2_print_slot(slot);
 
-    bool ret = usbd_edpt_xfer(dln2_rhport, dln2_ep_out, slot->data, CFG_DLN2_BULK_ENPOINT_SIZE);
+    uint16_t len = CFG_DLN2_BULK_ENPOINT_SIZE;
+    if (dln2_features & DLN2_FEATURE_OUT_BATCH)
+        len = DLN2_BUF_SIZE;
+
+    bool ret = usbd_edpt_xfer(dln2_rhport, dln2_ep_out, slot->data, len);
     if (!ret) {
         dln2_put_slot(slot);
         return;
     }
 
     dln2_slot_out = slot;
+    dln2_slot_out_len = len;
 }
 
 bool dln2_init(uint8_t rhport, uint8_t ep_out, uint8_t ep_in)
@@ -147,32 +210,72 @@ bool dln2_init(uint8_t rhport, uint8_t ep_out, uint8_t ep_in)
     dln2_rhport = rhport;
     dln2_ep_out = ep_out;
     dln2_ep_in = ep_in;
+    dln2_features = 0;
 
+    // Transactions left running by the previous host hold slots
+    dln2_spi_reset();
+    dln2_i2c_reset();
+    dln2_trigger_reset();
     dln2_slots_init();
     dln2_queue_slot_out();
 
     return true;
 }
 
+// Append queued messages to @slot as long as they fit in one transfer
+static size_t dln2_slot_in_coalesce(struct dln2_slot *slot)
+{
+    size_t len = dln2_slot_header(slot)->size;
+
+    while (true) {
+        uint32_t ints = save_and_disable_interrupts();
+
+        struct dln2_slot *next = dln2_response_queue.head;
+        size_t size = next ? dln2_slot_header(next)->size : 0;
+        // Stop short of a packet boundary since that would need a ZLP to end the transfer
+        if (!next || len + size > DLN2_BUF_SIZE || !((len + size) % CFG_DLN2_BULK_ENPOINT_SIZE)) {
+            restore_interrupts(ints);
+            return len;
+        }
+        dln2_slot_dequeue(&dln2_response_queue);
+
+        restore_interrupts(ints);
+
+        memcpy(slot->data + len, next->data, size);
+        len += size;
+        dln2_put_slot(next);
+    }
+}
+
 static void dln2_slot_in_xfer(void)
 {
-    if (dln2_slot_in)
+    uint32_t ints = save_and_disable_interrupts();
+
+    if (dln2_slot_in) {
+        restore_interrupts(ints);
         return;
+    }
 
     LOG2("%s:\n", __func__);
 
     struct dln2_slot *slot = dln2_slot_dequeue(&dln2_response_queue);
+    dln2_slot_in = slot;
+
+    restore_interrupts(ints);
+
     if (!slot)
         return;
 
-    struct dln2_response *response = dln2_slot_response(slot);
-    bool ret = usbd_edpt_xfer(dln2_rhport, dln2_ep_in, slot->data, response->hdr.size);
+    size_t len = dln2_slot_response(slot)->hdr.size;
+    if (dln2_features & DLN2_FEATURE_IN_COALESCE)
+        len = dln2_slot_in_coalesce(slot);
+
+    dln2_slot_in_len = len;
+    bool ret = usbd_edpt_xfer(dln2_rhport, dln2_ep_in, slot->data, len);
     if (!ret) {
+        dln2_slot_in = NULL;
         dln2_put_slot(slot);
-        return;
     }
-
-    dln2_slot_in = slot;
 }
 
 // Host IN
@@ -190,7 +293,10 @@ static bool _dln2_response(struct dln2_slot *slot, size_t len, uint16_t result)
     response->hdr.size = sizeof(*response) + len;
     response->result = result;
 
-    dln2_queue_slot_in(slot);
+    if (slot->complete)
+        slot->complete(slot);
+    else
+        dln2_queue_slot_in(slot);
 
     return true;
 }
@@ -218,12 +324,35 @@ bool dln2_response_u32(struct dln2_slot *slot, uint32_t val)
     return _dln2_response(slot, sizeof(val), 0);
 }
 
+bool dln2_response_u64(struct dln2_slot *slot, uint64_t val)
+{
+    memcpy(dln2_slot_response_data(slot), &val, sizeof(val));
+    return _dln2_response(slot, sizeof(val), 0);
+}
+
 bool dln2_response_error(struct dln2_slot *slot, uint16_t result)
 {
     LOG1("%s: handle=%u: result=0x%x (%u)\n", __func__, dln2_slot_header(slot)->handle, result, result);
     return _dln2_response(slot, 0, result);
 }
 
+bool dln2_feature_enabled(uint32_t feature)
+{
+    return dln2_features & feature;
+}
+
+static bool dln2_set_features(struct dln2_slot *slot)
+{
+    uint32_t *features = dln2_slot_header_data(slot);
+
+    DLN2_VERIFY_COMMAND_SIZE(slot, sizeof(*features));
+
+    dln2_features = *features & DLN2_FEATURES_SUPPORTED;
+    LOG1("%s: requested=0x%x enabled=0x%x\n", __func__, *features, dln2_features);
+
+    return dln2_response_u32(slot, dln2_features);
+}
+
 static bool dln2_handle_ctrl(struct dln2_slot *slot)
 {
     struct dln2_header *hdr = dln2_slot_header(slot);
@@ -247,6 +376,13 @@ static bool dln2_handle_ctrl(struct dln2_slot *slot)
             serial |= board_id.id[i];
         }
         return dln2_response_u32(slot, serial); // truncates
+    case DLN2_CMD_SET_FEATURES:
+        return dln2_set_features(slot);
+    // The timebase of the GPIO event timestamps
+    case DLN2_CMD_GET_TIME:
+        if (len)
+            return dln2_response_error(slot, DLN2_RES_INVALID_COMMAND_SIZE);
+        return dln2_response_u64(slot, time_us_64());
     default:
         return dln2_response_error(slot, DLN2_RES_COMMAND_NOT_SUPPORTED);
     }
@@ -274,6 +410,98 @@ static bool dln2_handle(struct dln2_slot *slot)
     return dln2_response_error(slot, DLN2_RES_INVALID_HANDLE);
 }
 
+// Complete requests are queued and dispatched from dln2_task() so the OUT endpoint can be
+// re-armed right away. The host can then have several requests in flight while earlier
+// ones are being handled.
+void dln2_queue_request(struct dln2_slot *slot)
+{
+    dln2_slot_enqueue(&dln2_request_queue, slot);
+}
+
+// Copy the messages to slots of their own and queue them in order. The last one stays in
+// the batch slot. If the pool runs out, dln2_task() carries on when slots have been freed.
+static void dln2_split_batch_continue(void)
+{
+    struct dln2_slot *slot = dln2_batch;
+    size_t total = slot->len;
+
+    while (dln2_batch_offset < total) {
+        const struct dln2_header *next = (const struct dln2_header *)(slot->data + dln2_batch_offset);
+        size_t remaining = total - dln2_batch_offset;
+
+        if (remaining >= sizeof(*next) && next->size >= sizeof(*next) && next->size == remaining) {
+            memmove(slot->data, next, next->size);
+            slot->len = next->size;
+            dln2_batch = NULL;
+            dln2_queue_request(slot);
+            return;
+        }
+
+        struct dln2_slot *split = dln2_get_slot();
+        if (!split) {
+            LOG1("Run out of slots, %zu bytes of the batch left\n", remaining);
+            return;
+        }
+
+        if (remaining < sizeof(*next) || next->size < sizeof(*next) || next->size > remaining) {
+            memcpy(split->data, next, tu_min32(remaining, sizeof(*next)));
+            dln2_response_error(split, DLN2_RES_INVALID_MESSAGE_SIZE);
+            break;
+        }
+
+        memcpy(split->data, next, next->size);
+        split->len = next->size;
+        dln2_batch_offset += next->size;
+        dln2_queue_request(split);
+    }
+
+    dln2_batch = NULL;
+    dln2_put_slot(slot);
+}
+
+// Queue each message in a batch as a request of its own
+static void dln2_split_batch(struct dln2_slot *slot)
+{
+    struct dln2_header *hdr = dln2_slot_header(slot);
+    size_t total = slot->len;
+
+    if (total < sizeof(*hdr) || hdr->size < sizeof(*hdr) || hdr->size > total) {
+        dln2_response_error(slot, DLN2_RES_INVALID_MESSAGE_SIZE);
+        return;
+    }
+
+    dln2_batch = slot;
+    dln2_batch_offset = 0;
+    dln2_split_batch_continue();
+}
+
+static bool dln2_xfer_out_batch(struct dln2_slot *slot, size_t len)
+{
+    slot->len += len;
+
+    // A full transfer means there can be more to come. That only happens to the one packet transfer
+    // that was armed before DLN2_FEATURE_OUT_BATCH was enabled, the endpoint can't be re-armed while
+    // it's pending. The rest of the batch goes in the same slot, later transfers are DLN2_BUF_SIZE.
+    if (len == dln2_slot_out_len && slot->len < DLN2_BUF_SIZE) {
+        uint16_t rest = DLN2_BUF_SIZE - slot->len;
+        bool ret = usbd_edpt_xfer(dln2_rhport, dln2_ep_out, slot->data + slot->len, rest);
+        if (ret) {
+            dln2_slot_out = slot;
+            dln2_slot_out_len = rest;
+            return true;
+        }
+        dln2_response_error(slot, DLN2_RES_FAIL);
+    } else if (!slot->len) {
+        dln2_put_slot(slot);
+    } else {
+        dln2_split_batch(slot);
+    }
+
+    dln2_queue_slot_out();
+
+    return true;
+}
+
 bool dln2_xfer_out(size_t len)
 {
     LOG2("%s: len=%zu\n", __func__, len);
@@ -283,6 +511,9 @@ bool dln2_xfer_out(size_t len)
 
     dln2_slot_out = NULL;
 
+    if (dln2_features & DLN2_FEATURE_OUT_BATCH)
+        return dln2_xfer_out_batch(slot, len);
+
     struct dln2_header *hdr = dln2_slot_header(slot);
 
     size_t slot_len = slot->len;
@@ -294,21 +525,22 @@ bool dln2_xfer_out(size_t len)
             if (hdr->size != len)
                 dln2_response_error(slot, DLN2_RES_INVALID_MESSAGE_SIZE);
             else
-                dln2_handle(slot);
+                dln2_queue_request(slot);
         } else if (len > CFG_DLN2_BULK_ENPOINT_SIZE) {
             dln2_response_error(slot, DLN2_RES_FAIL); // shouldn't be possible...
         } else if (hdr->size > DLN2_BUF_SIZE) {
             dln2_response_error(slot, DLN2_RES_INVALID_MESSAGE_SIZE);
         } else if (hdr->size == CFG_DLN2_BULK_ENPOINT_SIZE) {
-            dln2_handle(slot);
+            dln2_queue_request(slot);
         } else {
-            bool ret = usbd_edpt_xfer(dln2_rhport, dln2_ep_out,
-                                      slot->data + CFG_DLN2_BULK_ENPOINT_SIZE, hdr->size - CFG_DLN2_BULK_ENPOINT_SIZE);
+            uint16_t rest = hdr->size - CFG_DLN2_BULK_ENPOINT_SIZE;
+            bool ret = usbd_edpt_xfer(dln2_rhport, dln2_ep_out, slot->data + CFG_DLN2_BULK_ENPOINT_SIZE, rest);
             if (!ret) {
                 dln2_response_error(slot, DLN2_RES_FAIL);
             } else {
                 // Wait for the rest of this message
                 dln2_slot_out = slot;
+                dln2_slot_out_len = rest;
                 return true;
             }
         }
@@ -316,7 +548,7 @@ bool dln2_xfer_out(size_t len)
         if (slot->len != hdr->size)
             dln2_response_error(slot, DLN2_RES_INVALID_MESSAGE_SIZE);
         else
-            dln2_handle(slot);
+            dln2_queue_request(slot);
     }
 
     dln2_queue_slot_out();
@@ -331,13 +563,20 @@ bool dln2_xfer_in(size_t len)
     struct dln2_slot *slot = dln2_slot_in;
     TU_ASSERT(slot);
 
-    dln2_slot_in = NULL;
-
     //dln2_print_slot(slot);
 
-    struct dln2_response *response = dln2_slot_response(slot);
-    if (len != response->hdr.size)
-        LOG1("len != response->hdr.size\n");
+    if (len != dln2_slot_in_len)
+        LOG1("len != dln2_slot_in_len\n");
+
+    // A coalesced transfer that fills its last packet is ended with a ZLP so the host read returns.
+    // The slot is held until the ZLP is sent so nothing else goes out in between.
+    if (len && !(len % CFG_DLN2_BULK_ENPOINT_SIZE) && (dln2_features & DLN2_FEATURE_IN_COALESCE)) {
+        dln2_slot_in_len = 0;
+        if (usbd_edpt_xfer(dln2_rhport, dln2_ep_in, NULL, 0))
+            return true;
+    }
+
+    dln2_slot_in = NULL;
 
     dln2_put_slot(slot);
 
@@ -348,3 +587,59 @@ bool dln2_xfer_in(size_t len)
 
     return true;
 }
+
+// A module that completes requests asynchronously gets the next one when it's done
+static bool dln2_handle_busy(struct dln2_slot *slot)
+{
+    switch (dln2_slot_header(slot)->handle) {
+    case DLN2_HANDLE_SPI:
+        return dln2_spi_busy(slot);
+    case DLN2_HANDLE_I2C:
+        return dln2_i2c_busy(slot);
+    }
+
+    return false;
+}
+
+static void dln2_slot_remove(struct dln2_slot_queue *queue, struct dln2_slot *prev, struct dln2_slot *slot)
+{
+    uint32_t ints = save_and_disable_interrupts();
+
+    if (prev)
+        prev->next = slot->next;
+    else
+        queue->head = slot->next;
+    if (queue->tail == slot)
+        queue->tail = prev;
+    slot->next = NULL;
+    queue->count--;
+
+    restore_interrupts(ints);
+}
+
+void dln2_task(void)
+{
+    struct dln2_slot *prev = NULL;
+    struct dln2_slot *slot;
+
+    if (dln2_batch)
+        dln2_split_batch_continue();
+
+    // Requests are only queued from the main loop, so the queue can be walked without locking.
+    // Requests for a busy module stay queued in order while the others go ahead.
+    for (slot = dln2_request_queue.head; slot;) {
+        if (dln2_handle_busy(slot)) {
+            prev = slot;
+            slot = slot->next;
+            continue;
+        }
+
+        dln2_slot_remove(&dln2_request_queue, prev, slot);
+        dln2_handle(slot);
+        slot = prev ? prev->next : dln2_request_queue.head;
+    }
+
+    // The slot pool might have been empty when the last OUT transfer completed
+    if (!dln2_slot_out && dln2_ep_out)
+        dln2_queue_slot_out();
+}
@@ -48,19 +48,30 @@ struct dln2_response {
 } TU_ATTR_PACKED;
 
 #define DLN2_MAX_SLOTS   16
-#define DLN2_BUF_SIZE    (256 + sizeof(struct dln2_response))
+// The largest message from the Linux driver is an I2C write with 256 bytes of data
+#define DLN2_BUF_SIZE    (sizeof(struct dln2_header) + 9 + 256)
 
 struct dln2_slot {
     uint8_t data[DLN2_BUF_SIZE];
     uint index;
     size_t len;
+    // Set on requests queued by the device itself, the response is passed on instead of sent
+    void (*complete)(struct dln2_slot *slot);
+    void *context;
     struct dln2_slot *next;
 };
 
 struct dln2_slot_queue {
     struct dln2_slot *head;
+    struct dln2_slot *tail;
+    uint count;
 };
 
+// Free slots that events can't take so a flood of them doesn't starve the command path
+#ifndef DLN2_EVENT_SLOTS_RESERVED
+#define DLN2_EVENT_SLOTS_RESERVED   4
+#endif
+
 static inline struct dln2_header *dln2_slot_header(struct dln2_slot *slot)
 {
     return (struct dln2_header *)slot->data;
@@ -121,6 +132,7 @@ static inline void put_unaligned_le16(uint16_t val, void *p)
 #define DLN2_RES_INVALID_PIN_NUMBER                         0xab
 #define DLN2_RES_INVALID_EVENT_PERIOD                       0xac
 #define DLN2_RES_INVALID_BUFFER_SIZE                        0xae
+#define DLN2_RES_SPI_INVALID_FRAME_SIZE                     0xb8
 #define DLN2_RES_SPI_MASTER_INVALID_SS_VALUE                0xb9
 #define DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED          0xba
 #define DLN2_RES_I2C_MASTER_SENDING_DATA_FAILED             0xbb
@@ -137,32 +149,73 @@ static inline void put_unaligned_le16(uint16_t val, void *p)
 
 #define DLN2_CMD(cmd, id)       ((cmd) | ((id) << 8))
 
+// Protocol features a host library can opt in to, the Linux driver doesn't know about them.
+// They are reset when the device is (re)configured.
+//
+// DLN2_FEATURE_OUT_BATCH:
+//   A bulk OUT transfer can carry several messages back to back, up to DLN2_BUF_SIZE in total.
+//   The transfer must end with a short packet (or a ZLP if it's a multiple of the packet size).
+//
+// DLN2_FEATURE_IN_COALESCE:
+//   Queued responses and events are packed back to back into one bulk IN transfer, up to
+//   DLN2_BUF_SIZE in total. The transfer always ends with a short packet, a ZLP follows when
+//   it's a multiple of the packet size (a single response can be).
+//
+// DLN2_FEATURE_GPIO_TIMESTAMP:
+//   GPIO events are extended with the time of the edge in microseconds (u64) since boot,
+//   the same timebase that DLN2_CMD_GET_TIME returns.
+#define DLN2_FEATURE_OUT_BATCH      (1 << 0)
+#define DLN2_FEATURE_IN_COALESCE    (1 << 1)
+#define DLN2_FEATURE_GPIO_TIMESTAMP (1 << 2)
+
 #define dln2_print_slot(slot)   _dln2_print_slot(slot, 0, __func__)
 void _dln2_print_slot(struct dln2_slot *slot, uint indent, const char *caller);
 
 struct dln2_slot *dln2_get_slot(void);
+struct dln2_slot *dln2_get_event_slot(void);
 void dln2_queue_slot_in(struct dln2_slot *slot);
+void dln2_queue_request(struct dln2_slot *slot);
 
 bool dln2_init(uint8_t rhport, uint8_t ep_out, uint8_t ep_in);
 bool dln2_xfer_out(size_t len);
 bool dln2_xfer_in(size_t len);
+void dln2_task(void);
+bool dln2_feature_enabled(uint32_t feature);
 
 bool dln2_response(struct dln2_slot *slot, size_t len);
 bool dln2_response_u8(struct dln2_slot *slot, uint8_t val);
 bool dln2_response_u16(struct dln2_slot *slot, uint16_t val);
 bool dln2_response_u32(struct dln2_slot *slot, uint32_t val);
+bool dln2_response_u64(struct dln2_slot *slot, uint64_t val);
 bool dln2_response_error(struct dln2_slot *slot, uint16_t result);
 
 void dln2_pin_set_available(uint32_t mask);
 bool dln2_pin_is_requested(uint16_t pin, uint8_t module);
+uint32_t dln2_pin_requested_mask(uint8_t module);
 uint16_t dln2_pin_request(uint16_t pin, uint8_t module);
 uint16_t dln2_pin_free(uint16_t pin, uint8_t module);
 
 void dln2_gpio_init(void);
 void dln2_gpio_task(void);
 bool dln2_handle_gpio(struct dln2_slot *slot);
+bool dln2_capture_start(struct dln2_slot *slot);
+bool dln2_capture_stop(struct dln2_slot *slot);
+void dln2_capture_task(void);
+bool dln2_trigger_set(struct dln2_slot *slot);
+void dln2_trigger_clear(uint pin);
+bool dln2_trigger_is_set(uint pin);
+bool dln2_trigger_run(uint pin, bool value, uint16_t count, uint64_t timestamp);
+void dln2_trigger_reset(void);
 bool dln2_handle_i2c(struct dln2_slot *slot);
+bool dln2_i2c_busy(struct dln2_slot *slot);
+void dln2_i2c_task(void);
+void dln2_i2c_reset(void);
+int dln2_i2c_response_size(const struct dln2_header *msg);
 bool dln2_handle_spi(struct dln2_slot *slot);
+bool dln2_spi_busy(struct dln2_slot *slot);
+void dln2_spi_task(void);
+void dln2_spi_reset(void);
+int dln2_spi_response_size(const struct dln2_header *msg);
 bool dln2_handle_adc(struct dln2_slot *slot);
 
 #endif
@@ -58,7 +58,7 @@ static uint32_t allocated_sector_offset;
 
 static uint32_t flash_sector_index(const void *sector)
 {
-    return ((uint32_t)sector - XIP_BASE - AT24_FLASH_START) / AT24_FLASH_SECTOR_SIZE;
+    return ((uintptr_t)sector - XIP_BASE - AT24_FLASH_START) / AT24_FLASH_SECTOR_SIZE;
 }
 
 static void flash_print_header(const struct at24_flash_header *hdr)
@@ -113,7 +113,7 @@ static bool flash_is_valid_sector(const struct at24_flash_sector *sector)
 
 static const struct at24_flash_sector *find_flash_sector(uint16_t address)
 {
-    const struct at24_flash_sector *sector, *ret = NULL;
+    const struct at24_flash_sector *ret = NULL;
     uint64_t version = 0;
     uint32_t flash_offs;
 
@@ -139,7 +139,7 @@ static const struct at24_flash_sector *find_flash_sector(uint16_t address)
 
 static uint32_t find_free_flash_sector(uint64_t *wear)
 {
-    const struct at24_flash_sector *sector, *ret = NULL;
+    const struct at24_flash_sector *sector;
     uint32_t flash_offs;
 
     *wear = 0;
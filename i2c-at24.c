@@ -39,7 +39,6 @@ bool i2c_at24_read(const struct dln2_i2c_device *dev, uint16_t address, void *bu
 {
     struct i2c_at24_device *at24 = (struct i2c_at24_device *)dev;
     unsigned int offset = at24->data->offset;
-    size_t cpy, fill;
 
     LOG1("0x%02x: AT24 READ %zu@%u\n", address, len, offset);
 
@@ -52,7 +52,11 @@ int main(void)
     while (1)
     {
         tud_task();
+        dln2_task();
+        dln2_spi_task();
+        dln2_i2c_task();
         dln2_gpio_task();
+        dln2_capture_task();
         cdc_uart_task();
     }
 
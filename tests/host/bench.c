@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Microbenchmarks for the slot, dispatch and handler hot paths.
+ *
+ * The numbers are host CPU time and only useful for comparing changes to the code,
+ * the mocked hardware calls take no time at all.
+ *
+ * Usage: bench [quick]
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include "test.h"
+
+static uint bench_iterations = 200000;
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_report(const char *name, uint64_t start, uint iterations)
+{
+    uint64_t elapsed = bench_now_ns() - start;
+    printf("%-40s %8.1f ns/op\n", name, (double)elapsed / iterations);
+}
+
+static void bench_queue_event(void)
+{
+    struct dln2_slot *slot = dln2_get_slot();
+    if (!slot)
+        abort();
+
+    struct dln2_header *hdr = dln2_slot_header(slot);
+    hdr->size = sizeof(*hdr) + 6;
+    hdr->id = 0;
+    hdr->echo = 0;
+    hdr->handle = DLN2_HANDLE_EVENT;
+    dln2_queue_slot_in(slot);
+}
+
+// Keep @depth messages queued behind the IN endpoint, then measure completing one
+// transfer (free + dequeue) and queueing a new message (get + enqueue).
+static void bench_slot_queue(uint depth)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    char name[64];
+
+    test_setup();
+
+    for (uint i = 0; i < depth; i++)
+        bench_queue_event();
+
+    uint64_t start = bench_now_ns();
+    for (uint i = 0; i < bench_iterations; i++) {
+        mock_usb_recv(buf, sizeof(buf));
+        bench_queue_event();
+    }
+
+    snprintf(name, sizeof(name), "slot queue depth=%u", depth);
+    bench_report(name, start, bench_iterations);
+}
+
+// Complete request/response round trip through the USB callbacks, dln2_task() and dln2_spi_task()
+static void bench_command(const char *name, uint16_t handle, uint16_t id, const void *data, size_t len)
+{
+    uint8_t msg[DLN2_BUF_SIZE];
+    uint8_t buf[DLN2_BUF_SIZE];
+
+    size_t size = test_build_msg(msg, handle, id, 1, data, len);
+
+    uint64_t start = bench_now_ns();
+    for (uint i = 0; i < bench_iterations; i++) {
+        mock_usb_send(msg, size);
+        dln2_task();
+        dln2_spi_task();
+        if (mock_usb_recv(buf, sizeof(buf)) < 0)
+            abort();
+    }
+
+    bench_report(name, start, bench_iterations);
+}
+
+static void bench_commands(void)
+{
+    struct test_rsp rsp;
+
+    test_setup();
+
+    bench_command("CTRL GET_DEVICE_VER", DLN2_HANDLE_CTRL, DLN2_CMD(0x30, DLN2_MODULE_GENERIC), NULL, 0);
+
+    uint16_t pin = 2;
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x10, DLN2_MODULE_GPIO), &pin, sizeof(pin), &rsp));
+    bench_command("GPIO PIN_GET_VAL", DLN2_HANDLE_GPIO, DLN2_CMD(0x0B, DLN2_MODULE_GPIO), &pin, sizeof(pin));
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x11, DLN2_MODULE_GPIO), &pin, sizeof(pin), &rsp));
+
+    uint8_t port = 0;
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_CMD(0x44, DLN2_MODULE_SPI), &port, sizeof(port), &rsp));
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_CMD(0x11, DLN2_MODULE_SPI), &port, sizeof(port), &rsp));
+    struct {
+        uint8_t port;
+        uint16_t size;
+        uint8_t attr;
+        uint8_t buf[32];
+    } TU_ATTR_PACKED spi = { .size = sizeof(spi.buf) };
+    bench_command("SPI READ_WRITE 32 bytes", DLN2_HANDLE_SPI, DLN2_CMD(0x1A, DLN2_MODULE_SPI), &spi, sizeof(spi));
+
+    uint16_t adc_chan = 0;
+    CHECK(test_cmd(DLN2_HANDLE_ADC, DLN2_CMD(0x01, DLN2_MODULE_ADC), &port, sizeof(port), &rsp));
+    bench_command("ADC CHANNEL_GET_VAL", DLN2_HANDLE_ADC, DLN2_CMD(0x0A, DLN2_MODULE_ADC), &adc_chan, sizeof(adc_chan));
+}
+
+// Edges from the irq callback through the event queue to the IN endpoint
+static void bench_gpio_events(void)
+{
+    struct { uint16_t pin; uint8_t type; uint16_t period; } TU_ATTR_PACKED cfg = { 7, 1, 0 };
+    uint16_t pin = 7;
+    struct test_rsp rsp;
+    uint8_t buf[DLN2_BUF_SIZE];
+
+    test_setup();
+
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x10, DLN2_MODULE_GPIO), &pin, sizeof(pin), &rsp));
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x1E, DLN2_MODULE_GPIO), &cfg, sizeof(cfg), &rsp));
+
+    uint64_t start = bench_now_ns();
+    for (uint i = 0; i < bench_iterations; i++) {
+        mock_gpio_set_input(7, !(i & 1));
+        dln2_gpio_task();
+        mock_usb_recv(buf, sizeof(buf));
+    }
+    bench_report("GPIO event", start, bench_iterations);
+
+    cfg.type = 0;
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x1E, DLN2_MODULE_GPIO), &cfg, sizeof(cfg), &rsp));
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x11, DLN2_MODULE_GPIO), &pin, sizeof(pin), &rsp));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "quick"))
+        bench_iterations = 1000;
+
+    for (uint depth = 1; depth < DLN2_MAX_SLOTS; depth *= 2)
+        bench_slot_queue(depth);
+    bench_slot_queue(DLN2_MAX_SLOTS - 1);
+
+    bench_commands();
+    bench_gpio_events();
+
+    return test_result();
+}
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for the TinyUSB common header
+
+#ifndef _HOST_TUSB_COMMON_H_
+#define _HOST_TUSB_COMMON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "pico/types.h"
+#include "pico/time.h"     // pulled in by the pico osal
+#include "tusb_config.h"
+
+#define TU_ATTR_PACKED          __attribute__ ((packed))
+#define TU_ARRAY_SIZE(_arr)     (sizeof(_arr) / sizeof(_arr[0]))
+
+static inline uint32_t tu_min32(uint32_t x, uint32_t y) { return (x < y) ? x : y; }
+static inline uint32_t tu_max32(uint32_t x, uint32_t y) { return (x > y) ? x : y; }
+
+#define TU_ASSERT(_cond, ...)   do { if (!(_cond)) return false; } while (0)
+#define TU_VERIFY(_cond, ...)   do { if (!(_cond)) return false; } while (0)
+
+#endif
@@ -0,0 +1,11 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for the TinyUSB device driver API
+
+#ifndef _HOST_USBD_PVT_H_
+#define _HOST_USBD_PVT_H_
+
+#include "common/tusb_common.h"
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes);
+
+#endif
@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk hardware/adc.h
+
+#ifndef _HOST_HARDWARE_ADC_H_
+#define _HOST_HARDWARE_ADC_H_
+
+#include "pico/types.h"
+
+void adc_init(void);
+void adc_gpio_init(uint gpio);
+void adc_select_input(uint input);
+uint16_t adc_read(void);
+
+#endif
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk hardware/flash.h
+//
+// The XIP window is backed by a host array so flash contents can be read through pointers.
+
+#ifndef _HOST_HARDWARE_FLASH_H_
+#define _HOST_HARDWARE_FLASH_H_
+
+#include "pico/types.h"
+
+#define PICO_FLASH_SIZE_BYTES   (2 * 1024 * 1024)
+#define FLASH_PAGE_SIZE         (1u << 8)
+#define FLASH_SECTOR_SIZE       (1u << 12)
+#define FLASH_BLOCK_SIZE        (1u << 16)
+
+extern uint8_t mock_flash[PICO_FLASH_SIZE_BYTES];
+
+#define XIP_BASE    ((uintptr_t)mock_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk hardware/i2c.h
+
+#ifndef _HOST_HARDWARE_I2C_H_
+#define _HOST_HARDWARE_I2C_H_
+
+#include "pico/types.h"
+
+typedef struct i2c_inst i2c_inst_t;
+
+// The registers used by the DMA driven transfers
+typedef struct {
+    volatile uint32_t tar;
+    volatile uint32_t data_cmd;
+    volatile uint32_t raw_intr_stat;
+    volatile uint32_t clr_tx_abrt;
+    volatile uint32_t clr_stop_det;
+    volatile uint32_t enable;
+    volatile uint32_t tx_abrt_source;
+} i2c_hw_t;
+
+#define I2C_IC_DATA_CMD_CMD_BITS                        0x00000100
+#define I2C_IC_DATA_CMD_STOP_BITS                       0x00000200
+#define I2C_IC_DATA_CMD_RESTART_BITS                    0x00000400
+#define I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS               0x00000040
+#define I2C_IC_RAW_INTR_STAT_STOP_DET_BITS              0x00000200
+#define I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS   0x00000001
+#define I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS    0x00000008
+
+extern i2c_inst_t *const mock_i2c0;
+
+#define i2c0            mock_i2c0
+#define i2c_default     i2c0
+
+i2c_hw_t *i2c_get_hw(i2c_inst_t *i2c);
+
+static inline uint i2c_get_dreq(i2c_inst_t *i2c, bool is_tx)
+{
+    (void)i2c;
+    return 32 + !is_tx;
+}
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate);
+void i2c_deinit(i2c_inst_t *i2c);
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint timeout_us);
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint timeout_us);
+
+#endif
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk hardware/spi.h
+
+#ifndef _HOST_HARDWARE_SPI_H_
+#define _HOST_HARDWARE_SPI_H_
+
+#include "pico/types.h"
+
+typedef struct spi_inst spi_inst_t;
+
+typedef struct {
+    volatile uint32_t dr;
+} spi_hw_t;
+
+extern spi_inst_t mock_spi0;
+extern spi_inst_t mock_spi1;
+
+#define spi0            (&mock_spi0)
+#define spi1            (&mock_spi1)
+#define spi_default     spi0
+
+typedef enum {
+    SPI_CPHA_0 = 0,
+    SPI_CPHA_1 = 1
+} spi_cpha_t;
+
+typedef enum {
+    SPI_CPOL_0 = 0,
+    SPI_CPOL_1 = 1
+} spi_cpol_t;
+
+typedef enum {
+    SPI_LSB_FIRST = 0,
+    SPI_MSB_FIRST = 1
+} spi_order_t;
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+void spi_deinit(spi_inst_t *spi);
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate);
+uint spi_get_baudrate(const spi_inst_t *spi);
+uint spi_get_index(const spi_inst_t *spi);
+spi_hw_t *spi_get_hw(spi_inst_t *spi);
+
+static inline uint spi_get_dreq(spi_inst_t *spi, bool is_tx)
+{
+    return 16 + spi_get_index(spi) * 2 + !is_tx;
+}
+
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order);
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+
+#endif
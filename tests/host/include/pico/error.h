@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk pico/error.h
+
+#ifndef _HOST_PICO_ERROR_H_
+#define _HOST_PICO_ERROR_H_
+
+enum pico_error_codes {
+    PICO_OK = 0,
+    PICO_ERROR_NONE = 0,
+    PICO_ERROR_TIMEOUT = -1,
+    PICO_ERROR_GENERIC = -2,
+    PICO_ERROR_NO_DATA = -3,
+    PICO_ERROR_NOT_PERMITTED = -4,
+    PICO_ERROR_INVALID_ARG = -5,
+    PICO_ERROR_IO = -6,
+};
+
+#endif
@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk pico/stdlib.h
+
+#ifndef _HOST_PICO_STDLIB_H_
+#define _HOST_PICO_STDLIB_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/types.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+#endif
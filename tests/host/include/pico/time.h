@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk pico/time.h
+//
+// Time only moves when a test calls mock_time_advance_us(), which also fires due timers.
+
+#ifndef _HOST_PICO_TIME_H_
+#define _HOST_PICO_TIME_H_
+
+#include "pico/types.h"
+
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t *rt);
+
+struct repeating_timer {
+    int64_t delay_us;
+    uint64_t next_us;
+    repeating_timer_callback_t callback;
+    void *user_data;
+    bool active;
+};
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void busy_wait_us_32(uint32_t delay_us);
+void busy_wait_at_least_cycles(uint32_t minimum_cycles);
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out);
+bool cancel_repeating_timer(repeating_timer_t *timer);
+
+#endif
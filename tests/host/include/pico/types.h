@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk pico/types.h
+
+#ifndef _HOST_PICO_TYPES_H_
+#define _HOST_PICO_TYPES_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "pico/error.h"
+
+typedef unsigned int uint;
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+#define PICO_DEFAULT_LED_PIN        25
+
+#define PICO_DEFAULT_I2C_SDA_PIN    4
+#define PICO_DEFAULT_I2C_SCL_PIN    5
+
+#define PICO_DEFAULT_SPI_SCK_PIN    18
+#define PICO_DEFAULT_SPI_TX_PIN     19
+#define PICO_DEFAULT_SPI_RX_PIN     16
+#define PICO_DEFAULT_SPI_CSN_PIN    17
+
+#endif
@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: CC0-1.0
+// Host build stand-in for pico-sdk pico/unique_id.h
+
+#ifndef _HOST_PICO_UNIQUE_ID_H_
+#define _HOST_PICO_UNIQUE_ID_H_
+
+#include "pico/types.h"
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+typedef struct {
+    uint8_t id[PICO_UNIQUE_BOARD_ID_SIZE_BYTES];
+} pico_unique_board_id_t;
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out);
+
+#endif
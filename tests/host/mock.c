@@ -0,0 +1,1243 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/unique_id.h"
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/i2c.h"
+#include "hardware/pio.h"
+#include "hardware/spi.h"
+#include "hardware/sync.h"
+#include "device/usbd_pvt.h"
+#include "dln2.h"
+#include "mock.h"
+
+/* USB */
+
+#define MOCK_PACKET_SIZE    CFG_DLN2_BULK_ENPOINT_SIZE
+
+struct mock_ep {
+    uint8_t *buf;
+    uint16_t len;
+    uint16_t received;
+    bool armed;
+};
+
+static struct mock_ep mock_ep_out, mock_ep_in;
+
+bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes)
+{
+    struct mock_ep *ep = ep_addr == MOCK_EP_IN ? &mock_ep_in : &mock_ep_out;
+
+    if (ep->armed)
+        return false;
+
+    ep->buf = buffer;
+    ep->len = total_bytes;
+    ep->received = 0;
+    ep->armed = true;
+    return true;
+}
+
+void mock_usb_reset(void)
+{
+    memset(&mock_ep_out, 0, sizeof(mock_ep_out));
+    memset(&mock_ep_in, 0, sizeof(mock_ep_in));
+}
+
+bool mock_usb_out_armed(void)
+{
+    return mock_ep_out.armed;
+}
+
+bool mock_usb_in_armed(void)
+{
+    return mock_ep_in.armed;
+}
+
+bool mock_usb_send(const void *data, size_t len)
+{
+    const uint8_t *buf = data;
+
+    // A transfer completes when the buffer is full or on a short packet
+    do {
+        if (!mock_ep_out.armed)
+            return false;
+
+        size_t packet = len < MOCK_PACKET_SIZE ? len : MOCK_PACKET_SIZE;
+        bool short_packet = packet < MOCK_PACKET_SIZE;
+        size_t space = mock_ep_out.len - mock_ep_out.received;
+        if (packet > space)
+            packet = space;
+
+        memcpy(mock_ep_out.buf + mock_ep_out.received, buf, packet);
+        mock_ep_out.received += packet;
+        buf += packet;
+        len -= packet;
+
+        if (short_packet || mock_ep_out.received == mock_ep_out.len) {
+            size_t xferred = mock_ep_out.received;
+
+            mock_ep_out.armed = false;
+            mock_ep_out.received = 0;
+            dln2_xfer_out(xferred);
+        }
+    } while (len);
+
+    return true;
+}
+
+int mock_usb_recv(void *buf, size_t len)
+{
+    if (!mock_ep_in.armed)
+        return -1;
+
+    size_t xfer = mock_ep_in.len;
+    if (xfer > len)
+        xfer = len;
+    memcpy(buf, mock_ep_in.buf, xfer);
+    mock_ep_in.armed = false;
+    dln2_xfer_in(xfer);
+
+    return xfer;
+}
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out)
+{
+    for (uint i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++)
+        id_out->id[i] = 0xe6 + i;
+}
+
+/* Interrupts */
+
+uint32_t mock_irq_disabled_count;
+
+uint32_t save_and_disable_interrupts(void)
+{
+    mock_irq_disabled_count++;
+    return 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    (void)status;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    (void)num;
+    (void)enabled;
+}
+
+/* GPIO */
+
+struct mock_gpio {
+    enum gpio_function fn;
+    uint outover;
+    bool out;
+    bool out_level;
+    bool in_level;
+    uint32_t irq_mask;
+};
+
+static struct mock_gpio mock_gpios[NUM_BANK0_GPIOS];
+static gpio_irq_callback_t mock_gpio_callback;
+static mock_gpio_output_hook_t mock_gpio_output_hook;
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+    mock_gpios[gpio].fn = fn;
+}
+
+enum gpio_function gpio_get_function(uint gpio)
+{
+    return mock_gpios[gpio].fn;
+}
+
+enum gpio_function mock_gpio_function(uint gpio)
+{
+    return mock_gpios[gpio].fn;
+}
+
+void gpio_init(uint gpio)
+{
+    mock_gpios[gpio].out = false;
+    mock_gpios[gpio].out_level = false;
+    mock_gpios[gpio].fn = GPIO_FUNC_SIO;
+}
+
+// Only inverting is supported, the pin flips right away
+void gpio_set_outover(uint gpio, uint value)
+{
+    struct mock_gpio *g = &mock_gpios[gpio];
+
+    if ((g->outover == GPIO_OVERRIDE_INVERT) != (value == GPIO_OVERRIDE_INVERT))
+        g->out_level = !g->out_level;
+    g->outover = value;
+}
+
+uint mock_gpio_outover(uint gpio)
+{
+    return mock_gpios[gpio].outover;
+}
+
+void mock_gpio_set_output_hook(mock_gpio_output_hook_t hook)
+{
+    mock_gpio_output_hook = hook;
+}
+
+static void mock_gpio_set_out_level(uint gpio, bool level);
+
+// A pin driven by a peripheral, goes through the output override
+static void mock_gpio_drive(uint gpio, bool value)
+{
+    mock_gpio_set_out_level(gpio, value ^ (mock_gpios[gpio].outover == GPIO_OVERRIDE_INVERT));
+}
+
+void gpio_deinit(uint gpio)
+{
+    mock_gpios[gpio].fn = GPIO_FUNC_NULL;
+}
+
+void gpio_pull_down(uint gpio)
+{
+    (void)gpio;
+}
+
+void gpio_pull_up(uint gpio)
+{
+    (void)gpio;
+}
+
+void gpio_disable_pulls(uint gpio)
+{
+    (void)gpio;
+}
+
+bool gpio_get(uint gpio)
+{
+    struct mock_gpio *g = &mock_gpios[gpio];
+    return g->out ? g->out_level : g->in_level;
+}
+
+uint32_t gpio_get_all(void)
+{
+    uint32_t val = 0;
+    for (uint i = 0; i < NUM_BANK0_GPIOS; i++)
+        val |= (uint32_t)gpio_get(i) << i;
+    return val;
+}
+
+static void mock_gpio_set_out_level(uint gpio, bool level)
+{
+    struct mock_gpio *g = &mock_gpios[gpio];
+
+    if (g->out_level == level)
+        return;
+    g->out_level = level;
+    if (mock_gpio_output_hook)
+        mock_gpio_output_hook(gpio, level);
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    mock_gpio_set_out_level(gpio, value);
+}
+
+void gpio_put_masked(uint32_t mask, uint32_t value)
+{
+    for (uint i = 0; i < NUM_BANK0_GPIOS; i++) {
+        if (mask & (1u << i))
+            mock_gpio_set_out_level(i, (value >> i) & 1);
+    }
+}
+
+bool gpio_get_out_level(uint gpio)
+{
+    return mock_gpios[gpio].out_level;
+}
+
+// Turning the pin around changes the level between the output value and the input level
+void gpio_set_dir(uint gpio, bool out)
+{
+    bool prev = gpio_get(gpio);
+
+    mock_gpios[gpio].out = out;
+    if (gpio_get(gpio) != prev && mock_gpio_output_hook)
+        mock_gpio_output_hook(gpio, !prev);
+}
+
+void gpio_set_dir_masked(uint32_t mask, uint32_t value)
+{
+    for (uint i = 0; i < NUM_BANK0_GPIOS; i++) {
+        if (mask & (1u << i))
+            mock_gpios[i].out = (value >> i) & 1;
+    }
+}
+
+uint gpio_get_dir(uint gpio)
+{
+    return mock_gpios[gpio].out;
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled)
+{
+    if (enabled)
+        mock_gpios[gpio].irq_mask |= events;
+    else
+        mock_gpios[gpio].irq_mask &= ~events;
+}
+
+void gpio_set_irq_callback(gpio_irq_callback_t callback)
+{
+    mock_gpio_callback = callback;
+}
+
+uint32_t mock_gpio_irq_mask(uint gpio)
+{
+    return mock_gpios[gpio].irq_mask;
+}
+
+void mock_gpio_set_input(uint gpio, bool value)
+{
+    struct mock_gpio *g = &mock_gpios[gpio];
+    bool prev = g->in_level;
+
+    g->in_level = value;
+    if (prev == value || !mock_gpio_callback)
+        return;
+
+    uint32_t event = value ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    if (g->irq_mask & event)
+        mock_gpio_callback(gpio, event);
+}
+
+/* Clocks and time */
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+    (void)clk_index;
+    return 125 * 1000 * 1000;
+}
+
+#define MOCK_MAX_TIMERS     16
+
+static uint64_t mock_time_us;
+static repeating_timer_t *mock_timers[MOCK_MAX_TIMERS];
+
+uint64_t time_us_64(void)
+{
+    return mock_time_us;
+}
+
+uint32_t time_us_32(void)
+{
+    return mock_time_us;
+}
+
+void sleep_us(uint64_t us)
+{
+    mock_time_us += us;
+}
+
+void sleep_ms(uint32_t ms)
+{
+    mock_time_us += ms * 1000ull;
+}
+
+void busy_wait_us_32(uint32_t delay_us)
+{
+    mock_time_us += delay_us;
+}
+
+static uint64_t mock_cycles;
+
+// Time moves in whole microseconds, the cycles in between are carried over
+void busy_wait_at_least_cycles(uint32_t minimum_cycles)
+{
+    uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+
+    mock_cycles += minimum_cycles;
+    mock_time_us += mock_cycles / mhz;
+    mock_cycles %= mhz;
+}
+
+static uint64_t mock_timer_period(const repeating_timer_t *rt)
+{
+    return rt->delay_us < 0 ? -rt->delay_us : rt->delay_us;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, repeating_timer_t *out)
+{
+    cancel_repeating_timer(out);
+
+    for (uint i = 0; i < MOCK_MAX_TIMERS; i++) {
+        if (mock_timers[i])
+            continue;
+
+        out->delay_us = delay_us;
+        out->callback = callback;
+        out->user_data = user_data;
+        out->active = true;
+        out->next_us = mock_time_us + mock_timer_period(out);
+        mock_timers[i] = out;
+        return true;
+    }
+
+    return false;
+}
+
+bool cancel_repeating_timer(repeating_timer_t *timer)
+{
+    for (uint i = 0; i < MOCK_MAX_TIMERS; i++) {
+        if (mock_timers[i] == timer) {
+            mock_timers[i] = NULL;
+            timer->active = false;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void mock_time_advance_us(uint64_t us)
+{
+    uint64_t end = mock_time_us + us;
+
+    while (true) {
+        repeating_timer_t *next = NULL;
+        uint idx = 0;
+
+        for (uint i = 0; i < MOCK_MAX_TIMERS; i++) {
+            repeating_timer_t *rt = mock_timers[i];
+            if (rt && rt->next_us <= end && (!next || rt->next_us < next->next_us)) {
+                next = rt;
+                idx = i;
+            }
+        }
+
+        if (!next)
+            break;
+
+        mock_time_us = next->next_us;
+        next->next_us += mock_timer_period(next);
+        if (!next->callback(next) && mock_timers[idx] == next) {
+            mock_timers[idx] = NULL;
+            next->active = false;
+        }
+    }
+
+    mock_time_us = end;
+}
+
+/* ADC */
+
+static uint16_t mock_adc_values[5];
+static uint mock_adc_input;
+
+void adc_init(void)
+{
+}
+
+void adc_gpio_init(uint gpio)
+{
+    gpio_set_function(gpio, GPIO_FUNC_NULL);
+}
+
+void adc_select_input(uint input)
+{
+    mock_adc_input = input;
+}
+
+uint16_t adc_read(void)
+{
+    return mock_adc_values[mock_adc_input];
+}
+
+void mock_adc_set_value(uint input, uint16_t value)
+{
+    mock_adc_values[input] = value;
+}
+
+/* SPI */
+
+struct spi_inst {
+    uint index;
+    uint baudrate;
+    uint data_bits;
+    spi_hw_t hw;
+};
+
+spi_inst_t mock_spi0 = { .index = 0 };
+spi_inst_t mock_spi1 = { .index = 1 };
+static spi_inst_t *const mock_spi_insts[2] = { &mock_spi0, &mock_spi1 };
+
+static mock_spi_device_t mock_spi_device;
+static uint mock_spi_dma_frames_per_poll;
+
+static bool mock_dma_dreq(uint dreq);
+static bool mock_dma_timer_dreq(volatile void *write_addr);
+static bool mock_pio_is_txf(uintptr_t addr);
+static void mock_pio_poll(void);
+
+void mock_spi_set_device(mock_spi_device_t device)
+{
+    mock_spi_device = device;
+}
+
+uint mock_spi_data_bits(uint index)
+{
+    return mock_spi_insts[index]->data_bits;
+}
+
+static uint mock_spi_clamp(uint baudrate)
+{
+    uint max = clock_get_hz(clk_peri) / 2;
+    return baudrate > max ? max : baudrate;
+}
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi)
+{
+    return &spi->hw;
+}
+
+void mock_spi_set_dma_frames_per_poll(uint frames)
+{
+    mock_spi_dma_frames_per_poll = frames;
+}
+
+uint spi_init(spi_inst_t *spi, uint baudrate)
+{
+    spi->data_bits = 8;
+    spi->baudrate = mock_spi_clamp(baudrate);
+    return spi->baudrate;
+}
+
+void spi_deinit(spi_inst_t *spi)
+{
+    spi->baudrate = 0;
+}
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate)
+{
+    spi->baudrate = mock_spi_clamp(baudrate);
+    return spi->baudrate;
+}
+
+uint spi_get_baudrate(const spi_inst_t *spi)
+{
+    return spi->baudrate;
+}
+
+uint spi_get_index(const spi_inst_t *spi)
+{
+    return spi->index;
+}
+
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order)
+{
+    (void)cpol;
+    (void)cpha;
+    (void)order;
+    spi->data_bits = data_bits;
+}
+
+static void mock_spi_xfer(spi_inst_t *spi, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    if (mock_spi_device)
+        mock_spi_device(spi->index, tx, rx, len);
+    else
+        memmove(rx, tx, len);
+}
+
+// One frame through the data register, fed and drained by the channels paced by the SPI dreqs.
+// The device sees frames wider than 8 bits as two bytes, little endian.
+static bool mock_spi_dma_frame(spi_inst_t *spi)
+{
+    uint32_t mask = (1u << spi->data_bits) - 1;
+    size_t len = spi->data_bits > 8 ? 2 : 1;
+    uint8_t tx[2], rx[2] = { 0, 0 };
+
+    spi->hw.dr = 0;
+    if (!mock_dma_dreq(spi_get_dreq(spi, true)) && !mock_dma_timer_dreq(&spi->hw.dr))
+        return false;
+
+    uint32_t dr = spi->hw.dr & mask;
+    tx[0] = dr;
+    tx[1] = dr >> 8;
+    mock_spi_xfer(spi, tx, rx, len);
+    spi->hw.dr = (rx[0] | rx[1] << 8) & mask;
+    mock_dma_dreq(spi_get_dreq(spi, false));
+
+    return true;
+}
+
+static void mock_spi_dma_poll(void)
+{
+    for (uint i = 0; i < 2; i++) {
+        for (uint n = 0; !mock_spi_dma_frames_per_poll || n < mock_spi_dma_frames_per_poll; n++) {
+            if (!mock_spi_dma_frame(mock_spi_insts[i]))
+                break;
+        }
+    }
+}
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len)
+{
+    mock_spi_xfer(spi, src, dst, len);
+    return len;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+    uint8_t rx[len ? len : 1];
+    mock_spi_xfer(spi, src, rx, len);
+    return len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len)
+{
+    uint8_t tx[len ? len : 1];
+    memset(tx, repeated_tx_data, len);
+    mock_spi_xfer(spi, tx, dst, len);
+    return len;
+}
+
+/* I2C */
+
+struct i2c_inst {
+    uint baudrate;
+    bool hung;
+    i2c_hw_t hw;
+};
+
+static struct i2c_inst mock_i2c_insts[1];
+i2c_inst_t *const mock_i2c0 = &mock_i2c_insts[0];
+
+static mock_i2c_device_t mock_i2c_device;
+
+void mock_i2c_set_device(mock_i2c_device_t device)
+{
+    mock_i2c_device = device;
+}
+
+i2c_hw_t *i2c_get_hw(i2c_inst_t *i2c)
+{
+    return &i2c->hw;
+}
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate)
+{
+    memset(&i2c->hw, 0, sizeof(i2c->hw));
+    i2c->hung = false;
+    i2c->baudrate = baudrate;
+    return baudrate;
+}
+
+void i2c_deinit(i2c_inst_t *i2c)
+{
+    i2c->baudrate = 0;
+}
+
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint timeout_us)
+{
+    if (!mock_i2c_device)
+        return PICO_ERROR_GENERIC;
+    return mock_i2c_device(addr, false, (uint8_t *)src, len, nostop);
+}
+
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint timeout_us)
+{
+    if (!mock_i2c_device)
+        return PICO_ERROR_GENERIC;
+    return mock_i2c_device(addr, true, dst, len, nostop);
+}
+
+static void mock_i2c_abort(i2c_inst_t *i2c, uint32_t source)
+{
+    i2c->hw.tx_abrt_source = source;
+    i2c->hw.raw_intr_stat |= I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS | I2C_IC_RAW_INTR_STAT_STOP_DET_BITS;
+}
+
+// The commands DMA has written to IC_DATA_CMD are run as soon as they're all in. They're split into
+// messages on restarts and direction changes, the read data goes out through the RX dreq.
+static void mock_i2c_dma_poll(void)
+{
+    i2c_inst_t *i2c = mock_i2c0;
+    static uint32_t cmds[1024];
+    uint n = 0;
+
+    if (!i2c->baudrate || i2c->hung)
+        return;
+
+    while (n < 1024) {
+        if (!mock_dma_dreq(i2c_get_dreq(i2c, true)))
+            break;
+        cmds[n++] = i2c->hw.data_cmd;
+    }
+    if (!n)
+        return;
+
+    i2c->hw.raw_intr_stat = 0;
+    i2c->hw.tx_abrt_source = 0;
+
+    for (uint i = 0; i < n;) {
+        bool read = cmds[i] & I2C_IC_DATA_CMD_CMD_BITS;
+        uint8_t buf[1024];
+        uint j = i;
+
+        while (j + 1 < n && !(cmds[j] & I2C_IC_DATA_CMD_STOP_BITS) &&
+               !(cmds[j + 1] & I2C_IC_DATA_CMD_RESTART_BITS) &&
+               !!(cmds[j + 1] & I2C_IC_DATA_CMD_CMD_BITS) == read)
+            j++;
+
+        size_t len = j - i + 1;
+        for (uint k = 0; k < len; k++)
+            buf[k] = cmds[i + k];
+
+        bool stop = cmds[j] & I2C_IC_DATA_CMD_STOP_BITS;
+        int ret = mock_i2c_device ? mock_i2c_device(i2c->hw.tar, read, buf, len, !stop) : PICO_ERROR_GENERIC;
+        if (ret == PICO_ERROR_TIMEOUT) {
+            i2c->hung = true;
+            return;
+        }
+        if (ret < 0) {
+            mock_i2c_abort(i2c, I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS);
+            return;
+        }
+        if (!read && ret != len) {
+            mock_i2c_abort(i2c, I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS);
+            return;
+        }
+
+        for (uint k = 0; read && k < len; k++) {
+            i2c->hw.data_cmd = buf[k];
+            mock_dma_dreq(i2c_get_dreq(i2c, false));
+        }
+        if (stop)
+            i2c->hw.raw_intr_stat |= I2C_IC_RAW_INTR_STAT_STOP_DET_BITS;
+
+        i = j + 1;
+    }
+}
+
+/* Flash */
+
+uint8_t mock_flash[PICO_FLASH_SIZE_BYTES];
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    memset(mock_flash + flash_offs, 0xff, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        mock_flash[flash_offs + i] &= data[i];
+}
+
+/* DMA */
+
+struct mock_dma {
+    bool claimed;
+    bool busy;
+    dma_channel_config config;
+    dma_channel_hw_t hw;
+};
+
+static struct mock_dma mock_dmas[NUM_DMA_CHANNELS];
+
+static struct mock_dma_timer {
+    bool claimed;
+    uint16_t numerator;
+    uint16_t denominator;
+} mock_dma_timers[NUM_DMA_TIMERS];
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel)
+{
+    return &mock_dmas[channel].hw;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    dma_channel_config c = {
+        .transfer_size = DMA_SIZE_32,
+        .read_increment = true,
+        .dreq = MOCK_DREQ_FORCE,
+    };
+    return c;
+}
+
+int dma_claim_unused_channel(bool required)
+{
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (!mock_dmas[i].claimed) {
+            mock_dmas[i].claimed = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void dma_channel_unclaim(uint channel)
+{
+    mock_dmas[channel].claimed = false;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    struct mock_dma *dma = &mock_dmas[channel];
+
+    dma->config = *config;
+    dma->hw.write_addr = (uintptr_t)write_addr;
+    dma->hw.read_addr = (uintptr_t)read_addr;
+    dma->hw.transfer_count = transfer_count;
+    dma->busy = trigger && transfer_count;
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger)
+{
+    struct mock_dma *dma = &mock_dmas[channel];
+
+    dma->hw.transfer_count = trans_count;
+    if (trigger)
+        dma->busy = trans_count;
+}
+
+void dma_start_channel_mask(uint32_t chan_mask)
+{
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (chan_mask & (1u << i))
+            mock_dmas[i].busy = mock_dmas[i].hw.transfer_count;
+    }
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+    // Transfers paced by the SPI and PIO make progress while the driver polls
+    mock_spi_dma_poll();
+    mock_i2c_dma_poll();
+    mock_pio_poll();
+    return mock_dmas[channel].busy;
+}
+
+void dma_channel_abort(uint channel)
+{
+    mock_dmas[channel].busy = false;
+}
+
+int dma_claim_unused_timer(bool required)
+{
+    for (uint i = 0; i < NUM_DMA_TIMERS; i++) {
+        if (!mock_dma_timers[i].claimed) {
+            mock_dma_timers[i].claimed = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void dma_timer_unclaim(uint timer)
+{
+    mock_dma_timers[timer].claimed = false;
+}
+
+void dma_timer_set_fraction(uint timer, uint16_t numerator, uint16_t denominator)
+{
+    mock_dma_timers[timer].numerator = numerator;
+    mock_dma_timers[timer].denominator = denominator;
+}
+
+static uintptr_t mock_dma_advance(uintptr_t addr, uint size, bool ring, uint ring_bits)
+{
+    uintptr_t next = addr + size;
+
+    if (ring && ring_bits) {
+        uintptr_t mask = (1u << ring_bits) - 1;
+        next = (addr & ~mask) | (next & mask);
+    }
+    return next;
+}
+
+// One transfer on each busy channel paced by @dreq, returns false if there was none
+static bool mock_dma_dreq(uint dreq)
+{
+    bool done = false;
+
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        struct mock_dma *dma = &mock_dmas[i];
+        dma_channel_config *c = &dma->config;
+
+        if (!dma->busy || c->dreq != dreq)
+            continue;
+
+        uint size = 1 << c->transfer_size;
+        if (mock_pio_is_txf(dma->hw.write_addr)) {
+            // Narrow writes to the PIO fifos are replicated across the word
+            uint32_t val = 0;
+            memcpy(&val, (const void *)dma->hw.read_addr, size);
+            *(volatile uint32_t *)dma->hw.write_addr = size == 1 ? val * 0x01010101 :
+                                                       size == 2 ? val * 0x00010001 : val;
+        } else {
+            memcpy((void *)dma->hw.write_addr, (const void *)dma->hw.read_addr, size);
+        }
+        if (c->read_increment)
+            dma->hw.read_addr = mock_dma_advance(dma->hw.read_addr, size, !c->ring_write, c->ring_size_bits);
+        if (c->write_increment)
+            dma->hw.write_addr = mock_dma_advance(dma->hw.write_addr, size, c->ring_write, c->ring_size_bits);
+        if (!--dma->hw.transfer_count)
+            dma->busy = false;
+        done = true;
+    }
+
+    return done;
+}
+
+// One transfer to @write_addr on a timer paced channel, time moves a timer period
+static bool mock_dma_timer_dreq(volatile void *write_addr)
+{
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        struct mock_dma *dma = &mock_dmas[i];
+        uint dreq = dma->config.dreq;
+
+        if (!dma->busy || dma->hw.write_addr != (uintptr_t)write_addr ||
+            dreq < DREQ_DMA_TIMER0 || dreq >= DREQ_DMA_TIMER0 + NUM_DMA_TIMERS)
+            continue;
+
+        struct mock_dma_timer *timer = &mock_dma_timers[dreq - DREQ_DMA_TIMER0];
+        busy_wait_at_least_cycles(timer->denominator / timer->numerator);
+        return mock_dma_dreq(dreq);
+    }
+    return false;
+}
+
+/* PIO */
+
+struct mock_pio_sm {
+    bool claimed;
+    bool enabled;
+    uint pc;
+    pio_sm_config config;
+    uint32_t isr;
+    uint isr_count;
+    uint32_t osr;
+    uint osr_count;
+    uint32_t x;
+};
+
+static struct {
+    uint32_t used;
+    uint16_t instructions[PIO_INSTRUCTION_COUNT];
+    struct mock_pio_sm sm[NUM_PIO_STATE_MACHINES];
+} mock_pios[2];
+
+pio_hw_t mock_pio_hw[2];
+
+uint pio_get_index(PIO pio)
+{
+    return pio - mock_pio_hw;
+}
+
+static int mock_pio_find_offset(PIO pio, const pio_program_t *program)
+{
+    uint32_t mask = (1u << program->length) - 1;
+
+    if (program->origin >= 0)
+        return mock_pios[pio_get_index(pio)].used & (mask << program->origin) ? -1 : program->origin;
+
+    for (int offset = PIO_INSTRUCTION_COUNT - program->length; offset >= 0; offset--) {
+        if (!(mock_pios[pio_get_index(pio)].used & (mask << offset)))
+            return offset;
+    }
+    return -1;
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program)
+{
+    return mock_pio_find_offset(pio, program) >= 0;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+    int offset = mock_pio_find_offset(pio, program);
+
+    assert(offset >= 0);
+    memcpy(&mock_pios[pio_get_index(pio)].instructions[offset], program->instructions,
+           program->length * sizeof(uint16_t));
+    mock_pios[pio_get_index(pio)].used |= ((1u << program->length) - 1) << offset;
+    return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset)
+{
+    mock_pios[pio_get_index(pio)].used &= ~(((1u << program->length) - 1) << loaded_offset);
+}
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+    for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++) {
+        struct mock_pio_sm *sm = &mock_pios[pio_get_index(pio)].sm[i];
+        if (!sm->claimed) {
+            sm->claimed = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void pio_sm_unclaim(PIO pio, uint sm)
+{
+    mock_pios[pio_get_index(pio)].sm[sm].claimed = false;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+    struct mock_pio_sm *s = &mock_pios[pio_get_index(pio)].sm[sm];
+
+    s->enabled = false;
+    s->pc = initial_pc;
+    s->config = *config;
+    s->isr = 0;
+    s->isr_count = 0;
+    s->osr = 0;
+    s->osr_count = 32;
+    s->x = 0;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+    mock_pios[pio_get_index(pio)].sm[sm].enabled = enabled;
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm)
+{
+}
+
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac)
+{
+    pio_sm_config *c = &mock_pios[pio_get_index(pio)].sm[sm].config;
+
+    c->clkdiv_int = div_int;
+    c->clkdiv_frac = div_frac;
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask)
+{
+    for (uint i = 0; i < NUM_BANK0_GPIOS; i++) {
+        if (pin_mask & (1u << i))
+            mock_gpio_drive(i, (pin_values >> i) & 1);
+    }
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask)
+{
+    gpio_set_dir_masked(pin_mask, pin_dirs);
+}
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base, uint pin_count, bool is_out)
+{
+    uint32_t mask = ((1u << pin_count) - 1) << pin_base;
+
+    gpio_set_dir_masked(mask, is_out ? mask : 0);
+}
+
+void pio_gpio_init(PIO pio, uint pin)
+{
+    gpio_set_function(pin, pio_get_index(pio) ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0);
+}
+
+static bool mock_pio_is_txf(uintptr_t addr)
+{
+    for (uint p = 0; p < 2; p++) {
+        if (addr >= (uintptr_t)mock_pio_hw[p].txf && addr < (uintptr_t)(mock_pio_hw[p].txf + NUM_PIO_STATE_MACHINES))
+            return true;
+    }
+    return false;
+}
+
+const pio_sm_config *mock_pio_sm_config(PIO pio, uint sm)
+{
+    return &mock_pios[pio_get_index(pio)].sm[sm].config;
+}
+
+static void mock_pio_push(PIO pio, uint sm, uint32_t value)
+{
+    pio->rxf[sm] = value;
+    // Without a DMA channel to take it, the value is lost as if the fifo was full
+    mock_dma_dreq(pio_get_dreq(pio, sm, false));
+}
+
+static void mock_pio_set_pins(uint base, uint count, uint32_t value)
+{
+    for (uint i = 0; i < count; i++)
+        mock_gpio_drive((base + i) % NUM_BANK0_GPIOS, (value >> i) & 1);
+}
+
+// Autopull from the TX fifo, fed by a DMA channel paced by the TX dreq
+static bool mock_pio_pull(PIO pio, uint smi, struct mock_pio_sm *sm)
+{
+    if (!mock_dma_dreq(pio_get_dreq(pio, smi, true)))
+        return false;
+    sm->osr = pio->txf[smi];
+    sm->osr_count = 0;
+    return true;
+}
+
+static uint32_t mock_pio_shift_out(struct mock_pio_sm *sm, uint count)
+{
+    uint32_t data;
+
+    if (count == 32) {
+        data = sm->osr;
+        sm->osr = 0;
+    } else if (sm->config.out_shift_right) {
+        data = sm->osr & ((1u << count) - 1);
+        sm->osr >>= count;
+    } else {
+        data = sm->osr >> (32 - count);
+        sm->osr <<= count;
+    }
+    sm->osr_count += count;
+    return data;
+}
+
+static void mock_pio_shift_in(PIO pio, uint smi, struct mock_pio_sm *sm, uint32_t data, uint count)
+{
+    if (count != 32)
+        data &= (1u << count) - 1;
+
+    if (sm->config.in_shift_right)
+        sm->isr = count == 32 ? data : (sm->isr >> count) | (data << (32 - count));
+    else
+        sm->isr = count == 32 ? data : (sm->isr << count) | data;
+    sm->isr_count += count;
+
+    if (sm->config.autopush && sm->isr_count >= sm->config.push_threshold) {
+        mock_pio_push(pio, smi, sm->isr);
+        sm->isr = 0;
+        sm->isr_count = 0;
+    }
+}
+
+// Enough of the instruction set for the capture and SPI programs: IN from pins, OUT to pins, X
+// or NULL with autopull, MOV between pins, X and Y, and side-set. Delays are ignored.
+// Returns false if the state machine stalled on an empty TX fifo.
+static bool mock_pio_step(PIO pio, uint smi)
+{
+    struct mock_pio_sm *sm = &mock_pios[pio_get_index(pio)].sm[smi];
+    uint16_t insn = mock_pios[pio_get_index(pio)].instructions[sm->pc];
+    uint count = insn & 0x1f ? insn & 0x1f : 32;
+    uint dest = (insn >> 5) & 7;
+
+    // Side-set takes effect even if the instruction stalls
+    if (sm->config.sideset_bits) {
+        uint bits = sm->config.sideset_bits;
+        mock_pio_set_pins(sm->config.sideset_base, bits, (insn >> (13 - bits)) & ((1u << bits) - 1));
+    }
+
+    switch (insn >> 13) {
+    case 2: { // IN
+        assert(dest == 0);
+        uint32_t pins = gpio_get_all();
+        uint base = sm->config.in_base;
+        pins = base ? (pins >> base) | (pins << (32 - base)) : pins;
+        mock_pio_shift_in(pio, smi, sm, pins, count);
+        break;
+    }
+    case 3: { // OUT
+        if (sm->config.autopull && sm->osr_count >= sm->config.pull_threshold &&
+            !mock_pio_pull(pio, smi, sm))
+            return false;
+        uint32_t data = mock_pio_shift_out(sm, count);
+        if (dest == 0)
+            mock_pio_set_pins(sm->config.out_base, count, data);
+        else if (dest == 1)
+            sm->x = data;
+        else
+            assert(dest == 3);
+        break;
+    }
+    case 5: { // MOV
+        uint src = insn & 7;
+        assert(!(insn & 0x18) && (src == 1 || src == 2));
+        uint32_t data = src == 1 ? sm->x : 0;
+        if (dest == 0)
+            mock_pio_set_pins(sm->config.out_base, sm->config.out_count, data);
+        else
+            assert(dest == 2 && src == 2);
+        break;
+    }
+    default:
+        assert(0);
+    }
+
+    sm->pc = sm->pc == sm->config.wrap ? sm->config.wrap_target : sm->pc + 1;
+    return true;
+}
+
+static void mock_pio_poll(void)
+{
+    for (uint p = 0; p < 2; p++) {
+        for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++) {
+            struct mock_pio_sm *sm = &mock_pios[p].sm[i];
+            for (uint n = 0; sm->enabled && sm->config.autopull && n < 1000000; n++) {
+                if (!mock_pio_step(&mock_pio_hw[p], i))
+                    break;
+            }
+        }
+    }
+}
+
+void mock_pio_run(uint cycles)
+{
+    for (uint c = 0; c < cycles; c++) {
+        for (uint p = 0; p < 2; p++) {
+            for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++) {
+                if (mock_pios[p].sm[i].enabled)
+                    mock_pio_step(&mock_pio_hw[p], i);
+            }
+        }
+    }
+}
+
+void mock_reset(void)
+{
+    mock_usb_reset();
+    memset(mock_gpios, 0, sizeof(mock_gpios));
+    for (uint i = 0; i < NUM_BANK0_GPIOS; i++)
+        mock_gpios[i].fn = GPIO_FUNC_NULL;
+    for (uint i = 0; i < MOCK_MAX_TIMERS; i++) {
+        if (mock_timers[i])
+            mock_timers[i]->active = false;
+        mock_timers[i] = NULL;
+    }
+    memset(mock_adc_values, 0, sizeof(mock_adc_values));
+    mock_gpio_output_hook = NULL;
+    mock_spi_device = NULL;
+    mock_spi_dma_frames_per_poll = 0;
+    mock_i2c_device = NULL;
+    memset(mock_i2c_insts, 0, sizeof(mock_i2c_insts));
+    memset(mock_flash, 0xff, sizeof(mock_flash));
+    mock_irq_disabled_count = 0;
+    memset(mock_dmas, 0, sizeof(mock_dmas));
+    memset(mock_dma_timers, 0, sizeof(mock_dma_timers));
+    mock_cycles = 0;
+    memset(mock_pios, 0, sizeof(mock_pios));
+    memset(mock_pio_hw, 0, sizeof(mock_pio_hw));
+}
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef _MOCK_H_
+#define _MOCK_H_
+
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+
+#define MOCK_RHPORT     0
+#define MOCK_EP_OUT     0x09
+#define MOCK_EP_IN      0x89
+
+void mock_reset(void);
+
+// USB: the bulk endpoint pair used by dln2.c
+bool mock_usb_out_armed(void);
+bool mock_usb_in_armed(void);
+// Bus reset: the transfers in progress are dropped
+void mock_usb_reset(void);
+// Host -> device transfer sent as max size packets, a short or zero length packet ends it.
+// Returns false if the endpoint isn't armed.
+bool mock_usb_send(const void *data, size_t len);
+// Device -> host, returns the transfer length or -1 if nothing is armed
+int mock_usb_recv(void *buf, size_t len);
+
+// GPIO: level seen on an input pin, fires the irq callback if enabled for the edge
+void mock_gpio_set_input(uint gpio, bool value);
+enum gpio_function mock_gpio_function(uint gpio);
+uint mock_gpio_outover(uint gpio);
+// Called when the level of an output pin changes, to model a device on the pins.
+// An open drain line changes level when gpio_set_dir() drives it low or releases it.
+typedef void (*mock_gpio_output_hook_t)(uint gpio, bool value);
+void mock_gpio_set_output_hook(mock_gpio_output_hook_t hook);
+uint32_t mock_gpio_irq_mask(uint gpio);
+
+// SPI: the device on the bus, the default is a loopback (MISO = MOSI)
+typedef void (*mock_spi_device_t)(uint index, const uint8_t *tx, uint8_t *rx, size_t len);
+void mock_spi_set_device(mock_spi_device_t device);
+uint mock_spi_data_bits(uint index);
+// SPI: DMA transfers progress while the channels are polled, limit the frames per poll (0 = all)
+void mock_spi_set_dma_frames_per_poll(uint frames);
+
+// I2C: the device on the bus, returns bytes transferred or a PICO_ERROR_* code.
+// PICO_ERROR_TIMEOUT hangs the DMA driven controller until it's initialized again.
+typedef int (*mock_i2c_device_t)(uint8_t addr, bool read, uint8_t *buf, size_t len, bool nostop);
+void mock_i2c_set_device(mock_i2c_device_t device);
+
+void mock_adc_set_value(uint input, uint16_t value);
+
+// DMA: dreq for unpaced transfers
+#define MOCK_DREQ_FORCE     0x3f
+
+// PIO: run the enabled state machines for a number of cycles (clock dividers are ignored).
+// State machines with autopull also run by themselves while DMA is polled, until they stall on an empty TX fifo.
+void mock_pio_run(uint cycles);
+const pio_sm_config *mock_pio_sm_config(PIO pio, uint sm);
+
+// Advance the clock, firing due timers on the way
+void mock_time_advance_us(uint64_t us);
+
+extern uint32_t mock_irq_disabled_count;
+
+#endif
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "test.h"
+
+int test_failures;
+static uint16_t test_echo;
+
+void test_setup(void)
+{
+    static bool initialized;
+
+    mock_reset();
+
+    // Module state lives for the whole run like it does on the device, so tests
+    // have to release what they request.
+    if (!initialized) {
+        dln2_pin_set_available(~((1 << 29) | (1 << 24) | (1 << 23)));
+        dln2_gpio_init();
+        initialized = true;
+    }
+
+    dln2_init(MOCK_RHPORT, MOCK_EP_OUT, MOCK_EP_IN);
+}
+
+int test_result(void)
+{
+    if (test_failures)
+        printf("%d check(s) FAILED\n", test_failures);
+    else
+        printf("OK\n");
+    return test_failures ? 1 : 0;
+}
+
+size_t test_build_msg(void *buf, uint16_t handle, uint16_t id, uint16_t echo, const void *data, size_t len)
+{
+    struct dln2_header *hdr = buf;
+
+    hdr->size = sizeof(*hdr) + len;
+    hdr->id = id;
+    hdr->echo = echo;
+    hdr->handle = handle;
+    if (len)
+        memcpy(hdr + 1, data, len);
+
+    return hdr->size;
+}
+
+void test_tasks(void)
+{
+    dln2_task();
+    dln2_spi_task();
+    dln2_i2c_task();
+    dln2_gpio_task();
+    dln2_capture_task();
+}
+
+bool test_recv(struct test_rsp *rsp)
+{
+    uint8_t buf[sizeof(rsp->hdr) + sizeof(rsp->data)];
+
+    test_tasks();
+
+    int ret = mock_usb_recv(buf, sizeof(buf));
+    if (ret < (int)sizeof(struct dln2_header))
+        return false;
+
+    memset(rsp, 0, sizeof(*rsp));
+    memcpy(&rsp->hdr, buf, ret < (int)sizeof(rsp->hdr) ? ret : sizeof(rsp->hdr));
+    if (ret > (int)sizeof(rsp->hdr)) {
+        rsp->len = ret - sizeof(rsp->hdr);
+        memcpy(rsp->data, buf + sizeof(rsp->hdr), rsp->len);
+    }
+
+    return true;
+}
+
+bool test_cmd(uint16_t handle, uint16_t id, const void *data, size_t len, struct test_rsp *rsp)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    uint16_t echo = ++test_echo;
+
+    size_t size = test_build_msg(buf, handle, id, echo, data, len);
+    if (!mock_usb_send(buf, size))
+        return false;
+
+    if (!test_recv(rsp))
+        return false;
+
+    return rsp->hdr.hdr.echo == echo && rsp->hdr.hdr.handle == handle && rsp->hdr.hdr.id == id;
+}
+
+void test_set_features(uint32_t features)
+{
+    struct test_rsp rsp;
+    uint32_t enabled;
+
+    CHECK(test_cmd(DLN2_HANDLE_CTRL, DLN2_CMD_SET_FEATURES, &features, sizeof(features), &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    memcpy(&enabled, rsp.data, sizeof(enabled));
+    CHECK_EQ(enabled, features);
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include "dln2.h"
+#include "mock.h"
+
+extern int test_failures;
+
+#define CHECK(_cond)                                                            \
+    do {                                                                        \
+        if (!(_cond)) {                                                         \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #_cond); \
+            test_failures++;                                                    \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_EQ(_a, _b)                                                        \
+    do {                                                                        \
+        long long __a = (_a), __b = (_b);                                       \
+        if (__a != __b) {                                                       \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n",   \
+                    __FILE__, __LINE__, #_a, #_b, __a, __b);                    \
+            test_failures++;                                                    \
+        }                                                                       \
+    } while (0)
+
+#define RUN_TEST(_fn)                       \
+    do {                                    \
+        printf("%s\n", #_fn);               \
+        test_setup();                       \
+        _fn();                              \
+    } while (0)
+
+#define DLN2_CMD_SET_FEATURES       DLN2_CMD(0x80, DLN2_MODULE_GENERIC)
+
+struct test_rsp {
+    struct dln2_response hdr;
+    uint8_t data[DLN2_BUF_SIZE];
+    size_t len;     // payload length
+};
+
+void test_setup(void);
+int test_result(void);
+
+size_t test_build_msg(void *buf, uint16_t handle, uint16_t id, uint16_t echo, const void *data, size_t len);
+// Send a command, run the main loop and fetch the response
+bool test_cmd(uint16_t handle, uint16_t id, const void *data, size_t len, struct test_rsp *rsp);
+// Run the main loop tasks
+void test_tasks(void);
+// Fetch the next device -> host message, the header result is only valid for responses
+bool test_recv(struct test_rsp *rsp);
+// Enable DLN2_FEATURE_* flags
+void test_set_features(uint32_t features);
+
+#endif
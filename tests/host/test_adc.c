@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "test.h"
+
+#define DLN2_ADC_CMD(cmd)   ((DLN2_MODULE_ADC << 8) | (cmd))
+
+#define DLN2_ADC_GET_CHANNEL_COUNT      DLN2_ADC_CMD(0x01)
+#define DLN2_ADC_ENABLE                 DLN2_ADC_CMD(0x02)
+#define DLN2_ADC_DISABLE                DLN2_ADC_CMD(0x03)
+#define DLN2_ADC_CHANNEL_ENABLE         DLN2_ADC_CMD(0x05)
+#define DLN2_ADC_CHANNEL_DISABLE        DLN2_ADC_CMD(0x06)
+#define DLN2_ADC_CHANNEL_GET_VAL        DLN2_ADC_CMD(0x0A)
+#define DLN2_ADC_CHANNEL_GET_ALL_VAL    DLN2_ADC_CMD(0x0B)
+#define DLN2_ADC_CHANNEL_SET_CFG        DLN2_ADC_CMD(0x0C)
+#define DLN2_ADC_CONDITION_MET_EV       DLN2_ADC_CMD(0x10)
+
+#define DLN2_ADC_EVENT_NONE         0
+#define DLN2_ADC_EVENT_ALWAYS       5
+
+struct port_chan {
+    uint8_t port;
+    uint8_t chan;
+} TU_ATTR_PACKED;
+
+struct chan_cfg {
+    struct port_chan port_chan;
+    uint8_t type;
+    uint16_t period;
+    uint16_t low;
+    uint16_t high;
+} TU_ATTR_PACKED;
+
+static uint16_t adc_cmd(uint16_t id, const void *data, size_t len, struct test_rsp *rsp)
+{
+    CHECK(test_cmd(DLN2_HANDLE_ADC, id, data, len, rsp));
+    return rsp->hdr.result;
+}
+
+static void test_channel_values(void)
+{
+    struct port_chan port_chan = { 0, 1 };
+    uint8_t port = 0;
+    struct test_rsp rsp;
+    uint16_t val;
+
+    CHECK_EQ(adc_cmd(DLN2_ADC_GET_CHANNEL_COUNT, &port, 1, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.data[0], 3);
+    CHECK_EQ(adc_cmd(DLN2_ADC_ENABLE, &port, 1, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(adc_cmd(DLN2_ADC_CHANNEL_ENABLE, &port_chan, sizeof(port_chan), &rsp), DLN2_RES_SUCCESS);
+
+    mock_adc_set_value(0, 0x100);
+    mock_adc_set_value(1, 0xffc);
+    mock_adc_set_value(2, 0x800);
+
+    CHECK_EQ(adc_cmd(DLN2_ADC_CHANNEL_GET_VAL, &port_chan, sizeof(port_chan), &rsp), DLN2_RES_SUCCESS);
+    memcpy(&val, rsp.data, sizeof(val));
+    CHECK_EQ(val, 0xffc >> 2);
+
+    CHECK_EQ(adc_cmd(DLN2_ADC_CHANNEL_GET_ALL_VAL, &port, 1, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 * 9);
+    memcpy(&val, rsp.data + 2 * 3, sizeof(val));
+    CHECK_EQ(val, 0x800 >> 2);
+
+    CHECK_EQ(adc_cmd(DLN2_ADC_CHANNEL_DISABLE, &port_chan, sizeof(port_chan), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(adc_cmd(DLN2_ADC_DISABLE, &port, 1, &rsp), DLN2_RES_SUCCESS);
+}
+
+static void test_periodic_event(void)
+{
+    struct chan_cfg cfg = { .port_chan = { 0, 0 }, .type = DLN2_ADC_EVENT_ALWAYS, .period = 10 };
+    uint8_t port = 0;
+    struct test_rsp rsp;
+
+    CHECK_EQ(adc_cmd(DLN2_ADC_CHANNEL_SET_CFG, &cfg, sizeof(cfg), &rsp), DLN2_RES_SUCCESS);
+
+    for (uint i = 0; i < 3; i++) {
+        mock_time_advance_us(10 * 1000);
+        CHECK(test_recv(&rsp));
+        CHECK_EQ(rsp.hdr.hdr.handle, DLN2_HANDLE_EVENT);
+        CHECK_EQ(rsp.hdr.hdr.id, DLN2_ADC_CONDITION_MET_EV);
+    }
+    CHECK(!test_recv(&rsp));
+
+    CHECK_EQ(adc_cmd(DLN2_ADC_DISABLE, &port, 1, &rsp), DLN2_RES_SUCCESS);
+    mock_time_advance_us(100 * 1000);
+    CHECK(!test_recv(&rsp));
+}
+
+int main(void)
+{
+    RUN_TEST(test_channel_values);
+    RUN_TEST(test_periodic_event);
+
+    return test_result();
+}
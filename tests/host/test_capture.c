@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "test.h"
+
+#define DLN2_GPIO_CMD(cmd)       DLN2_CMD(cmd, DLN2_MODULE_GPIO)
+
+#define DLN2_GPIO_PIN_DISABLE           DLN2_GPIO_CMD(0x11)
+#define DLN2_GPIO_CAPTURE_START         DLN2_GPIO_CMD(0x86)
+#define DLN2_GPIO_CAPTURE_STOP          DLN2_GPIO_CMD(0x87)
+#define DLN2_GPIO_CAPTURE_EV            DLN2_GPIO_CMD(0x88)
+
+#define RING_SIZE   (16384 / 4)
+
+struct capture_start {
+    uint32_t mask;
+    uint32_t rate;
+    uint32_t trigger_mask;
+    uint32_t trigger_value;
+} TU_ATTR_PACKED;
+
+struct capture_record {
+    uint32_t value;
+    uint16_t run;
+} TU_ATTR_PACKED;
+
+struct capture_event {
+    uint16_t count;
+    uint32_t lost;
+    struct capture_record records[64];
+} TU_ATTR_PACKED;
+
+static uint16_t capture_start(uint32_t mask, uint32_t rate, uint32_t trigger_mask, uint32_t trigger_value,
+                              uint32_t *actual)
+{
+    struct capture_start cmd = { mask, rate, trigger_mask, trigger_value };
+    struct test_rsp rsp;
+
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_CAPTURE_START, &cmd, sizeof(cmd), &rsp));
+    if (actual && !rsp.hdr.result)
+        memcpy(actual, rsp.data, sizeof(*actual));
+    return rsp.hdr.result;
+}
+
+// The last events are sent before the response
+static uint32_t capture_stop(struct capture_event *last)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    uint32_t lost = 0;
+
+    size_t len = test_build_msg(buf, DLN2_HANDLE_GPIO, DLN2_GPIO_CAPTURE_STOP, 99, NULL, 0);
+    CHECK(mock_usb_send(buf, len));
+
+    while (test_recv(&rsp)) {
+        struct dln2_header *hdr = &rsp.hdr.hdr;
+        if (hdr->handle == DLN2_HANDLE_EVENT) {
+            CHECK_EQ(hdr->id, DLN2_GPIO_CAPTURE_EV);
+            if (last) {
+                memset(last, 0, sizeof(*last));
+                memcpy(last, (uint8_t *)&rsp.hdr + sizeof(*hdr), hdr->size - sizeof(*hdr));
+            }
+            continue;
+        }
+        CHECK_EQ(hdr->echo, 99);
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+        memcpy(&lost, rsp.data, sizeof(lost));
+    }
+    return lost;
+}
+
+static bool capture_recv_event(struct capture_event *ev)
+{
+    struct test_rsp rsp;
+
+    if (!test_recv(&rsp))
+        return false;
+
+    struct dln2_header *hdr = &rsp.hdr.hdr;
+    CHECK_EQ(hdr->handle, DLN2_HANDLE_EVENT);
+    CHECK_EQ(hdr->id, DLN2_GPIO_CAPTURE_EV);
+    memset(ev, 0, sizeof(*ev));
+    memcpy(ev, (uint8_t *)&rsp.hdr + sizeof(*hdr), hdr->size - sizeof(*hdr));
+    CHECK_EQ(hdr->size - sizeof(*hdr), 6 + ev->count * sizeof(struct capture_record));
+    return true;
+}
+
+static void test_start_errors(void)
+{
+    struct test_rsp rsp;
+
+    CHECK_EQ(capture_start(0, 1000000, 0, 0, NULL), DLN2_RES_INVALID_PIN_NUMBER);
+    CHECK_EQ(capture_start(1 << 24, 1000000, 0, 0, NULL), DLN2_RES_PIN_IN_USE);
+    CHECK_EQ(capture_start(1 << 10, 1000000, 1 << 11, 0, NULL), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(capture_start(1 << 10, 0, 0, 0, NULL), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(capture_start(1 << 10, 1000, 0, 0, NULL), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(capture_start(1 << 10, 200000000, 0, 0, NULL), DLN2_RES_INVALID_VALUE);
+
+    // Failing to start doesn't leave pins claimed
+    CHECK_EQ(capture_start((1 << 10) | (1 << 24), 1000000, 0, 0, NULL), DLN2_RES_PIN_IN_USE);
+    uint16_t pin = 10;
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_DISABLE, &pin, sizeof(pin), &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_CAPTURE_STOP, NULL, 0, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_INVALID_MODE);
+}
+
+static void test_rle(void)
+{
+    struct capture_event ev;
+    uint32_t rate;
+
+    CHECK_EQ(capture_start((1 << 10) | (1 << 11), 1000000, 0, 0, &rate), DLN2_RES_SUCCESS);
+    CHECK_EQ(rate, 1000000);
+    CHECK_EQ(mock_pio_sm_config(pio0, 0)->clkdiv_int, 125);
+    CHECK_EQ(mock_pio_sm_config(pio0, 0)->clkdiv_frac, 0);
+    CHECK_EQ(capture_start(1 << 12, 1000000, 0, 0, NULL), DLN2_RES_INVALID_MODE);
+
+    mock_gpio_set_input(10, 1);
+    mock_gpio_set_input(12, 1); // not captured
+    mock_pio_run(100);
+    mock_gpio_set_input(12, 0);
+    mock_pio_run(100);
+    mock_gpio_set_input(10, 0);
+    mock_gpio_set_input(11, 1);
+    mock_pio_run(50);
+    CHECK(!capture_recv_event(&ev));
+
+    // The open run is sent when it's time to flush
+    mock_time_advance_us(10000);
+    CHECK(capture_recv_event(&ev));
+    CHECK_EQ(ev.lost, 0);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.records[0].value, 1 << 10);
+    CHECK_EQ(ev.records[0].run, 200);
+    CHECK_EQ(ev.records[1].value, 1 << 11);
+    CHECK_EQ(ev.records[1].run, 50);
+
+    // Long runs are split
+    for (uint i = 0; i < 70; i++) {
+        mock_pio_run(1000);
+        test_tasks();
+    }
+    mock_time_advance_us(10000);
+    CHECK(capture_recv_event(&ev));
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.records[0].run, 65535);
+    CHECK_EQ(ev.records[1].run, 70000 - 65535);
+    CHECK(!capture_recv_event(&ev));
+
+    // A full event is sent right away
+    for (uint i = 0; i < 100; i++) {
+        mock_gpio_set_input(10, i & 1);
+        mock_pio_run(1);
+    }
+    CHECK(capture_recv_event(&ev));
+    CHECK_EQ(ev.count, (DLN2_BUF_SIZE - sizeof(struct dln2_header) - 6) / sizeof(struct capture_record));
+    for (uint i = 0; i < ev.count; i++) {
+        CHECK_EQ(ev.records[i].value, (1 << 11) | ((i & 1) << 10));
+        CHECK_EQ(ev.records[i].run, 1);
+    }
+
+    CHECK_EQ(capture_stop(&ev), 0);
+    CHECK_EQ(ev.records[ev.count - 1].value, (1 << 11) | (1 << 10));
+
+    mock_gpio_set_input(10, 0);
+    mock_gpio_set_input(11, 0);
+}
+
+static void test_trigger(void)
+{
+    struct capture_event ev;
+
+    CHECK_EQ(capture_start((1 << 10) | (1 << 11), 1000000, 1 << 11, 1 << 11, NULL), DLN2_RES_SUCCESS);
+
+    mock_gpio_set_input(10, 1);
+    mock_pio_run(500);
+    test_tasks();
+    mock_time_advance_us(20000);
+    CHECK(!capture_recv_event(&ev));
+
+    mock_gpio_set_input(11, 1);
+    mock_pio_run(5);
+    mock_gpio_set_input(10, 0);
+    mock_pio_run(7);
+
+    CHECK_EQ(capture_stop(&ev), 0);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.records[0].value, (1 << 10) | (1 << 11));
+    CHECK_EQ(ev.records[0].run, 5);
+    CHECK_EQ(ev.records[1].value, 1 << 11);
+    CHECK_EQ(ev.records[1].run, 7);
+
+    mock_gpio_set_input(11, 0);
+}
+
+// Samples overwritten before they were handled are counted
+static void test_overflow(void)
+{
+    struct capture_event ev;
+
+    CHECK_EQ(capture_start(1 << 10, 1000000, 0, 0, NULL), DLN2_RES_SUCCESS);
+
+    mock_pio_run(RING_SIZE + 1000);
+    test_tasks();
+    mock_time_advance_us(10000);
+    CHECK(capture_recv_event(&ev));
+    CHECK_EQ(ev.lost, RING_SIZE / 2 + 1000);
+
+    CHECK_EQ(capture_stop(NULL), RING_SIZE / 2 + 1000);
+}
+
+int main(void)
+{
+    RUN_TEST(test_start_errors);
+    RUN_TEST(test_rle);
+    RUN_TEST(test_trigger);
+    RUN_TEST(test_overflow);
+
+    return test_result();
+}
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "test.h"
+
+#define DLN2_CMD_GET_DEVICE_VER     DLN2_CMD(0x30, DLN2_MODULE_GENERIC)
+#define DLN2_CMD_GET_TIME           DLN2_CMD(0x81, DLN2_MODULE_GENERIC)
+
+static void test_get_device_ver(void)
+{
+    struct test_rsp rsp;
+    uint32_t ver;
+
+    CHECK(test_cmd(DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, NULL, 0, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, sizeof(ver));
+    memcpy(&ver, rsp.data, sizeof(ver));
+    CHECK_EQ(ver, 0x200);
+    CHECK(mock_usb_out_armed());
+}
+
+static uint64_t test_get_time(void)
+{
+    struct test_rsp rsp;
+    uint64_t time;
+
+    CHECK(test_cmd(DLN2_HANDLE_CTRL, DLN2_CMD_GET_TIME, NULL, 0, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, sizeof(time));
+    memcpy(&time, rsp.data, sizeof(time));
+    return time;
+}
+
+static void test_time(void)
+{
+    uint64_t start = test_get_time();
+
+    mock_time_advance_us(1234567);
+    CHECK_EQ(test_get_time() - start, 1234567);
+}
+
+static void test_invalid_handle(void)
+{
+    struct test_rsp rsp;
+
+    CHECK(test_cmd(42, 0x1234, NULL, 0, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_INVALID_HANDLE);
+}
+
+static void test_short_message(void)
+{
+    struct dln2_header hdr = { .size = 20, .id = 1, .echo = 7, .handle = DLN2_HANDLE_CTRL };
+    struct test_rsp rsp;
+
+    CHECK(mock_usb_send(&hdr, sizeof(hdr)));
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_INVALID_MESSAGE_SIZE);
+}
+
+// Slots are recycled, so many more commands than slots must go through
+static void test_slot_recycling(void)
+{
+    struct test_rsp rsp;
+
+    for (uint i = 0; i < 10 * DLN2_MAX_SLOTS; i++) {
+        CHECK(test_cmd(DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, NULL, 0, &rsp));
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    }
+}
+
+// The OUT endpoint is re-armed before the requests are handled
+static void test_pipelined_requests(void)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+
+    for (uint16_t echo = 1; echo <= 4; echo++) {
+        size_t len = test_build_msg(buf, DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, echo, NULL, 0);
+        CHECK(mock_usb_send(buf, len));
+    }
+
+    for (uint16_t echo = 1; echo <= 4; echo++) {
+        CHECK(test_recv(&rsp));
+        CHECK_EQ(rsp.hdr.hdr.echo, echo);
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    }
+    CHECK(!test_recv(&rsp));
+}
+
+static void test_out_batch(void)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    size_t len = 0;
+
+    uint32_t features = DLN2_FEATURE_OUT_BATCH;
+
+    // The transfer armed when the feature is enabled is one packet long. The rest of the first batch
+    // follows in the same slot, the last message straddles the packet boundary.
+    test_set_features(0);
+    test_set_features(DLN2_FEATURE_OUT_BATCH);
+    for (uint16_t echo = 1; echo <= 7; echo++)
+        len += test_build_msg(buf + len, DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, echo, NULL, 0);
+    len += test_build_msg(buf + len, DLN2_HANDLE_CTRL, DLN2_CMD_SET_FEATURES, 8, &features, sizeof(features));
+    CHECK(mock_usb_send(buf, len));
+    for (uint16_t echo = 1; echo <= 8; echo++) {
+        CHECK(test_recv(&rsp));
+        CHECK_EQ(rsp.hdr.hdr.echo, echo);
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    }
+    CHECK(!test_recv(&rsp));
+
+    // 16 GET_DEVICE_VER requests is 128 bytes, a multiple of the packet size so a ZLP ends it
+    len = 0;
+    for (uint16_t echo = 1; echo <= 16; echo++)
+        len += test_build_msg(buf + len, DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, echo, NULL, 0);
+    CHECK(mock_usb_send(buf, len));
+    CHECK(mock_usb_send(NULL, 0));
+
+    for (uint16_t echo = 1; echo <= 16; echo++) {
+        CHECK(test_recv(&rsp));
+        CHECK_EQ(rsp.hdr.hdr.echo, echo);
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    }
+    CHECK(!test_recv(&rsp));
+
+    // More messages than there are slots, the rest of the batch waits for slots to be freed
+    len = 0;
+    for (uint16_t echo = 1; echo <= 25; echo++)
+        len += test_build_msg(buf + len, DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, echo, NULL, 0);
+    CHECK(mock_usb_send(buf, len));
+
+    for (uint16_t echo = 1; echo <= 25; echo++) {
+        CHECK(test_recv(&rsp));
+        CHECK_EQ(rsp.hdr.hdr.echo, echo);
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    }
+    CHECK(!test_recv(&rsp));
+    CHECK(mock_usb_out_armed());
+
+    // A truncated message at the end is rejected, the ones before it are handled.
+    // Errors are sent right away so the responses can come out of order.
+    len = test_build_msg(buf, DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, 1, NULL, 0);
+    len += test_build_msg(buf + len, DLN2_HANDLE_CTRL, DLN2_CMD_SET_FEATURES, 2, "\0\0\0\0", 4);
+    CHECK(mock_usb_send(buf, len - 2));
+    for (uint i = 0; i < 2; i++) {
+        CHECK(test_recv(&rsp));
+        if (rsp.hdr.hdr.echo == 1)
+            CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+        else
+            CHECK_EQ(rsp.hdr.result, DLN2_RES_INVALID_MESSAGE_SIZE);
+    }
+    CHECK(!test_recv(&rsp));
+}
+
+static void test_in_coalesce(void)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    size_t len;
+
+    test_set_features(DLN2_FEATURE_IN_COALESCE);
+
+    // Queue up responses while the IN endpoint is busy with the first one
+    for (uint16_t echo = 1; echo <= 8; echo++) {
+        len = test_build_msg(buf, DLN2_HANDLE_CTRL, DLN2_CMD_GET_DEVICE_VER, echo, NULL, 0);
+        CHECK(mock_usb_send(buf, len));
+    }
+    dln2_task();
+
+    len = mock_usb_recv(buf, sizeof(buf));
+    CHECK_EQ(len, sizeof(struct dln2_response) + 4);
+
+    // 7 responses of 14 bytes are 98 bytes, no packet boundary is hit
+    len = mock_usb_recv(buf, sizeof(buf));
+    CHECK_EQ(len, 7 * (sizeof(struct dln2_response) + 4));
+    for (uint i = 0; i < 7; i++) {
+        struct dln2_response *response = (void *)(buf + i * (sizeof(struct dln2_response) + 4));
+        CHECK_EQ(response->hdr.echo, i + 2);
+        CHECK_EQ(response->result, DLN2_RES_SUCCESS);
+    }
+    CHECK_EQ(mock_usb_recv(buf, sizeof(buf)), -1);
+}
+
+int main(void)
+{
+    RUN_TEST(test_get_device_ver);
+    RUN_TEST(test_time);
+    RUN_TEST(test_invalid_handle);
+    RUN_TEST(test_short_message);
+    RUN_TEST(test_slot_recycling);
+    RUN_TEST(test_pipelined_requests);
+    RUN_TEST(test_out_batch);
+    RUN_TEST(test_in_coalesce);
+
+    return test_result();
+}
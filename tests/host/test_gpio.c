@@ -0,0 +1,623 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "test.h"
+
+#define DLN2_GPIO_CMD(cmd)       DLN2_CMD(cmd, DLN2_MODULE_GPIO)
+
+#define DLN2_GPIO_GET_PIN_COUNT         DLN2_GPIO_CMD(0x01)
+#define DLN2_GPIO_SET_DEBOUNCE          DLN2_GPIO_CMD(0x04)
+#define DLN2_GPIO_GET_DEBOUNCE          DLN2_GPIO_CMD(0x05)
+#define DLN2_GPIO_PIN_GET_VAL           DLN2_GPIO_CMD(0x0B)
+#define DLN2_GPIO_PIN_SET_OUT_VAL       DLN2_GPIO_CMD(0x0C)
+#define DLN2_GPIO_PIN_GET_OUT_VAL       DLN2_GPIO_CMD(0x0D)
+#define DLN2_GPIO_CONDITION_MET_EV      DLN2_GPIO_CMD(0x0F)
+#define DLN2_GPIO_PIN_ENABLE            DLN2_GPIO_CMD(0x10)
+#define DLN2_GPIO_PIN_DISABLE           DLN2_GPIO_CMD(0x11)
+#define DLN2_GPIO_PIN_SET_DIRECTION     DLN2_GPIO_CMD(0x13)
+#define DLN2_GPIO_PIN_SET_EVENT_CFG     DLN2_GPIO_CMD(0x1E)
+#define DLN2_GPIO_GET_EVENT_OVERFLOWS   DLN2_GPIO_CMD(0x80)
+#define DLN2_GPIO_PIN_SET_EVENT_POLICY  DLN2_GPIO_CMD(0x81)
+#define DLN2_GPIO_PORT_GET_VAL          DLN2_GPIO_CMD(0x82)
+#define DLN2_GPIO_PORT_GET_OUT_VAL      DLN2_GPIO_CMD(0x83)
+#define DLN2_GPIO_PORT_SET_OUT_VAL      DLN2_GPIO_CMD(0x84)
+#define DLN2_GPIO_PORT_SET_DIRECTION    DLN2_GPIO_CMD(0x85)
+
+#define DLN2_GPIO_EVENT_NONE            0
+#define DLN2_GPIO_EVENT_CHANGE          1
+#define DLN2_GPIO_EVENT_LVL_HIGH        2
+#define DLN2_GPIO_EVENT_LVL_LOW         3
+#define DLN2_GPIO_EVENT_ALWAYS          4
+
+#define DLN2_GPIO_EVENT_POLICY_ALL          0
+#define DLN2_GPIO_EVENT_POLICY_COALESCE     1
+#define DLN2_GPIO_EVENT_POLICY_RATE_LIMIT   2
+
+struct pin_val {
+    uint16_t pin;
+    uint8_t value;
+} TU_ATTR_PACKED;
+
+struct event_cfg {
+    uint16_t pin;
+    uint8_t type;
+    uint16_t period;
+} TU_ATTR_PACKED;
+
+struct event_policy {
+    uint16_t pin;
+    uint8_t policy;
+    uint16_t rate;
+} TU_ATTR_PACKED;
+
+struct gpio_event {
+    uint16_t count;
+    uint8_t type;
+    uint16_t pin;
+    uint8_t value;
+    uint64_t timestamp; // DLN2_FEATURE_GPIO_TIMESTAMP
+} TU_ATTR_PACKED;
+
+static uint16_t gpio_cmd(uint16_t id, const void *data, size_t len, struct test_rsp *rsp)
+{
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, id, data, len, rsp));
+    return rsp->hdr.result;
+}
+
+static uint16_t gpio_pin_cmd(uint16_t id, uint16_t pin)
+{
+    struct test_rsp rsp;
+    return gpio_cmd(id, &pin, sizeof(pin), &rsp);
+}
+
+static uint16_t gpio_pin_val_cmd(uint16_t id, uint16_t pin, uint8_t value)
+{
+    struct pin_val cmd = { .pin = pin, .value = value };
+    struct test_rsp rsp;
+    return gpio_cmd(id, &cmd, sizeof(cmd), &rsp);
+}
+
+static int gpio_get_val(uint16_t id, uint16_t pin)
+{
+    struct test_rsp rsp;
+
+    if (gpio_cmd(id, &pin, sizeof(pin), &rsp))
+        return -1;
+    CHECK_EQ(rsp.len, 3);
+    return rsp.data[2];
+}
+
+static uint16_t gpio_set_event_cfg(uint16_t pin, uint8_t type, uint16_t period)
+{
+    struct event_cfg cfg = { .pin = pin, .type = type, .period = period };
+    struct test_rsp rsp;
+    return gpio_cmd(DLN2_GPIO_PIN_SET_EVENT_CFG, &cfg, sizeof(cfg), &rsp);
+}
+
+static uint16_t gpio_set_event_policy(uint16_t pin, uint8_t policy, uint16_t rate)
+{
+    struct event_policy cmd = { .pin = pin, .policy = policy, .rate = rate };
+    struct test_rsp rsp;
+    return gpio_cmd(DLN2_GPIO_PIN_SET_EVENT_POLICY, &cmd, sizeof(cmd), &rsp);
+}
+
+static bool gpio_recv_event_size(struct gpio_event *event, size_t size)
+{
+    struct test_rsp rsp;
+
+    if (!test_recv(&rsp))
+        return false;
+
+    struct dln2_header *hdr = &rsp.hdr.hdr;
+    CHECK_EQ(hdr->handle, DLN2_HANDLE_EVENT);
+    CHECK_EQ(hdr->id, DLN2_GPIO_CONDITION_MET_EV);
+    CHECK_EQ(hdr->size, sizeof(*hdr) + size);
+    // events have no result field
+    memset(event, 0, sizeof(*event));
+    memcpy(event, (uint8_t *)&rsp.hdr + sizeof(*hdr), size);
+    return true;
+}
+
+static bool gpio_recv_event(struct gpio_event *event)
+{
+    return gpio_recv_event_size(event, offsetof(struct gpio_event, timestamp));
+}
+
+static void test_pin_count(void)
+{
+    struct test_rsp rsp;
+    uint16_t count;
+
+    CHECK_EQ(gpio_cmd(DLN2_GPIO_GET_PIN_COUNT, NULL, 0, &rsp), DLN2_RES_SUCCESS);
+    memcpy(&count, rsp.data, sizeof(count));
+    CHECK_EQ(count, 29);
+}
+
+static void test_pin_ownership(void)
+{
+    CHECK_EQ(gpio_pin_val_cmd(DLN2_GPIO_PIN_SET_OUT_VAL, 2, 1), DLN2_RES_INVALID_PIN_NUMBER);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 2), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_val_cmd(DLN2_GPIO_PIN_SET_OUT_VAL, 2, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 2), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_val_cmd(DLN2_GPIO_PIN_SET_OUT_VAL, 2, 1), DLN2_RES_INVALID_PIN_NUMBER);
+
+    // VBUS sense is not available
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 24), DLN2_RES_PIN_IN_USE);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 29), DLN2_RES_INVALID_PIN_NUMBER);
+}
+
+static void test_in_out(void)
+{
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 3), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 6), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_val_cmd(DLN2_GPIO_PIN_SET_DIRECTION, 6, 1), DLN2_RES_SUCCESS);
+
+    for (uint8_t val = 0; val < 2; val++) {
+        CHECK_EQ(gpio_pin_val_cmd(DLN2_GPIO_PIN_SET_OUT_VAL, 6, val), DLN2_RES_SUCCESS);
+        CHECK_EQ(gpio_get_val(DLN2_GPIO_PIN_GET_OUT_VAL, 6), val);
+        CHECK_EQ(gpio_get_val(DLN2_GPIO_PIN_GET_VAL, 6), val);
+
+        mock_gpio_set_input(3, val);
+        CHECK_EQ(gpio_get_val(DLN2_GPIO_PIN_GET_VAL, 3), val);
+    }
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 3), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 6), DLN2_RES_SUCCESS);
+}
+
+static uint16_t gpio_port_set(uint16_t id, uint32_t mask, uint32_t values)
+{
+    uint32_t cmd[2] = { mask, values };
+    struct test_rsp rsp;
+    return gpio_cmd(id, cmd, sizeof(cmd), &rsp);
+}
+
+static uint32_t gpio_port_get(uint16_t id)
+{
+    struct test_rsp rsp;
+    uint32_t values;
+
+    CHECK_EQ(gpio_cmd(id, NULL, 0, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, sizeof(values));
+    memcpy(&values, rsp.data, sizeof(values));
+    return values;
+}
+
+static void test_port(void)
+{
+    for (uint pin = 8; pin < 16; pin++)
+        CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, pin), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 3), DLN2_RES_SUCCESS);
+
+    // Only enabled pins can be written
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_DIRECTION, 0x1ff00, 0x1ff00), DLN2_RES_INVALID_PIN_NUMBER);
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_OUT_VAL, 0x1ff00, 0), DLN2_RES_INVALID_PIN_NUMBER);
+
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_DIRECTION, 0xff00, 0xff00), DLN2_RES_SUCCESS);
+    for (uint pin = 8; pin < 16; pin++)
+        CHECK_EQ(gpio_get_dir(pin), 1);
+    CHECK_EQ(gpio_get_dir(3), 0);
+
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_OUT_VAL, 0xff00, 0xa500), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_port_get(DLN2_GPIO_PORT_GET_OUT_VAL), 0xa500);
+    // Pins outside the mask keep their value
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_OUT_VAL, 0x0f00, 0xffff), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_port_get(DLN2_GPIO_PORT_GET_OUT_VAL), 0xaf00);
+
+    mock_gpio_set_input(3, 1);
+    mock_gpio_set_input(2, 1); // not enabled
+    CHECK_EQ(gpio_port_get(DLN2_GPIO_PORT_GET_VAL), 0xaf08);
+    mock_gpio_set_input(3, 0);
+    mock_gpio_set_input(2, 0);
+
+    // The LED pin can't be an input
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 25), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_DIRECTION, 1 << 25, 0), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_DIRECTION, 1 << 25, 1 << 25), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 25), DLN2_RES_SUCCESS);
+
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_OUT_VAL, 0xff00, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_port_set(DLN2_GPIO_PORT_SET_DIRECTION, 0xff00, 0), DLN2_RES_SUCCESS);
+    for (uint pin = 8; pin < 16; pin++)
+        CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, pin), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 3), DLN2_RES_SUCCESS);
+}
+
+static void test_events(void)
+{
+    struct gpio_event event;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+
+    mock_gpio_set_input(7, 1);
+    CHECK(gpio_recv_event(&event));
+    CHECK_EQ(event.pin, 7);
+    CHECK_EQ(event.value, 1);
+
+    mock_gpio_set_input(7, 0);
+    CHECK(gpio_recv_event(&event));
+    CHECK_EQ(event.pin, 7);
+    CHECK_EQ(event.value, 0);
+    CHECK(!gpio_recv_event(&event));
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    mock_gpio_set_input(7, 1);
+    CHECK(!gpio_recv_event(&event));
+    mock_gpio_set_input(7, 0);
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+static uint32_t gpio_get_event_overflows(void)
+{
+    struct test_rsp rsp;
+    uint32_t overflows;
+
+    CHECK_EQ(gpio_cmd(DLN2_GPIO_GET_EVENT_OVERFLOWS, NULL, 0, &rsp), DLN2_RES_SUCCESS);
+    memcpy(&overflows, rsp.data, sizeof(overflows));
+    return overflows;
+}
+
+// Edges are counted as overflows when the event queue is full
+static void test_event_overflow(void)
+{
+    uint32_t overflows = gpio_get_event_overflows();
+    struct gpio_event event;
+    uint count = 0;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+
+    for (uint i = 0; i < 40; i++)
+        mock_gpio_set_input(7, !(i & 1));
+
+    CHECK_EQ(gpio_get_event_overflows() - overflows, 40 - 32);
+
+    while (gpio_recv_event(&event)) {
+        CHECK_EQ(event.value, !(count & 1));
+        count++;
+    }
+    CHECK_EQ(count, 32);
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    mock_gpio_set_input(7, 0);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+static void test_event_coalesce(void)
+{
+    struct gpio_event event;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_policy(7, 3, 0), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(gpio_set_event_policy(7, DLN2_GPIO_EVENT_POLICY_RATE_LIMIT, 0), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(gpio_set_event_policy(7, DLN2_GPIO_EVENT_POLICY_COALESCE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+
+    for (uint i = 0; i < 41; i++)
+        mock_gpio_set_input(7, !(i & 1));
+
+    CHECK(gpio_recv_event(&event));
+    CHECK_EQ(event.pin, 7);
+    CHECK_EQ(event.value, 1);
+    CHECK_EQ(event.count, 41);
+    CHECK(!gpio_recv_event(&event));
+
+    mock_gpio_set_input(7, 0);
+    CHECK(gpio_recv_event(&event));
+    CHECK_EQ(event.value, 0);
+    CHECK_EQ(event.count, 1);
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    // Disabling the pin resets the policy
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+static void test_event_rate_limit(void)
+{
+    struct gpio_event event;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_policy(7, DLN2_GPIO_EVENT_POLICY_RATE_LIMIT, 2), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+
+    for (uint ms = 0; ms < 2; ms++) {
+        mock_time_advance_us(1000);
+
+        for (uint i = 0; i < 10; i++)
+            mock_gpio_set_input(7, !(i & 1));
+
+        // Two separate events and then the rest merged into one
+        CHECK(gpio_recv_event(&event));
+        CHECK_EQ(event.value, 1);
+        CHECK_EQ(event.count, 1);
+        CHECK(gpio_recv_event(&event));
+        CHECK_EQ(event.value, 0);
+        CHECK_EQ(event.count, 1);
+        CHECK(gpio_recv_event(&event));
+        CHECK_EQ(event.value, 0);
+        CHECK_EQ(event.count, 8);
+        CHECK(!gpio_recv_event(&event));
+    }
+
+    // The window is in milliseconds of the 64-bit clock, not of its low 32 bits
+    mock_time_advance_us(1ull << 32);
+    for (uint i = 0; i < 2; i++)
+        mock_gpio_set_input(7, !(i & 1));
+    for (uint i = 0; i < 2; i++) {
+        CHECK(gpio_recv_event(&event));
+        CHECK_EQ(event.count, 1);
+    }
+    CHECK(!gpio_recv_event(&event));
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+
+    // The policy is back to one event per edge
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+    for (uint i = 0; i < 4; i++)
+        mock_gpio_set_input(7, !(i & 1));
+    for (uint i = 0; i < 4; i++) {
+        CHECK(gpio_recv_event(&event));
+        CHECK_EQ(event.count, 1);
+    }
+    CHECK(!gpio_recv_event(&event));
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+// Events can't use up the slots needed to receive and answer commands
+static void test_event_slot_reserve(void)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    uint16_t pin = 7;
+    uint responses = 0;
+    struct test_rsp rsp;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+
+    for (uint i = 0; i < 32; i++)
+        mock_gpio_set_input(7, !(i & 1));
+    test_tasks();
+
+    // The host isn't reading, so the commands have to be received and answered from the reserve
+    for (uint i = 0; i < 2; i++) {
+        size_t len = test_build_msg(buf, DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_GET_VAL, 100 + i, &pin, sizeof(pin));
+        CHECK(mock_usb_send(buf, len));
+        test_tasks();
+    }
+
+    while (test_recv(&rsp)) {
+        if (rsp.hdr.hdr.handle == DLN2_HANDLE_GPIO) {
+            CHECK_EQ(rsp.hdr.hdr.echo, 100 + responses);
+            CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+            responses++;
+        }
+    }
+    CHECK_EQ(responses, 2);
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+static void test_event_timestamp(void)
+{
+    struct gpio_event event;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+    test_set_features(DLN2_FEATURE_GPIO_TIMESTAMP);
+
+    uint64_t start = time_us_64();
+    mock_time_advance_us(100);
+    mock_gpio_set_input(7, 1);
+    mock_time_advance_us(37);
+    mock_gpio_set_input(7, 0);
+
+    CHECK(gpio_recv_event_size(&event, sizeof(event)));
+    CHECK_EQ(event.value, 1);
+    CHECK_EQ(event.timestamp - start, 100);
+    CHECK(gpio_recv_event_size(&event, sizeof(event)));
+    CHECK_EQ(event.value, 0);
+    CHECK_EQ(event.timestamp - start, 137);
+
+    // Merged events carry the time of the latest edge
+    CHECK_EQ(gpio_set_event_policy(7, DLN2_GPIO_EVENT_POLICY_COALESCE, 0), DLN2_RES_SUCCESS);
+    for (uint i = 0; i < 5; i++) {
+        mock_time_advance_us(10);
+        mock_gpio_set_input(7, !(i & 1));
+    }
+    CHECK(gpio_recv_event_size(&event, sizeof(event)));
+    CHECK_EQ(event.value, 1);
+    CHECK_EQ(event.count, 5);
+    CHECK_EQ(event.timestamp - start, 187);
+
+    test_set_features(0);
+    mock_gpio_set_input(7, 0);
+    CHECK(gpio_recv_event(&event));
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+// LVL_HIGH and LVL_LOW are edge events with period=0
+static void test_event_level_edges(void)
+{
+    struct gpio_event event;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_LVL_HIGH, 0), DLN2_RES_SUCCESS);
+    for (uint i = 0; i < 3; i++) {
+        mock_gpio_set_input(7, 1);
+        mock_gpio_set_input(7, 0);
+        CHECK(gpio_recv_event(&event));
+        CHECK_EQ(event.value, 1);
+    }
+    CHECK(!gpio_recv_event(&event));
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_LVL_LOW, 0), DLN2_RES_SUCCESS);
+    for (uint i = 0; i < 3; i++) {
+        mock_gpio_set_input(7, 1);
+        mock_gpio_set_input(7, 0);
+        CHECK(gpio_recv_event(&event));
+        CHECK_EQ(event.value, 0);
+    }
+    CHECK(!gpio_recv_event(&event));
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+static uint gpio_count_events(uint16_t pin, uint8_t value)
+{
+    struct gpio_event event;
+    uint count = 0;
+
+    while (gpio_recv_event(&event)) {
+        CHECK_EQ(event.pin, pin);
+        CHECK_EQ(event.value, value);
+        count++;
+    }
+    return count;
+}
+
+static void test_event_periodic(void)
+{
+    struct gpio_event event;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 8), DLN2_RES_SUCCESS);
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 10), DLN2_RES_INVALID_EVENT_PERIOD);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_ALWAYS, 0), DLN2_RES_INVALID_EVENT_PERIOD);
+
+    // Repeated while the level is high
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_LVL_HIGH, 10), DLN2_RES_SUCCESS);
+    mock_time_advance_us(50 * 1000);
+    CHECK(!gpio_recv_event(&event));
+    mock_gpio_set_input(7, 1);
+    CHECK_EQ(gpio_count_events(7, 1), 1);
+    mock_time_advance_us(9 * 1000);
+    CHECK(!gpio_recv_event(&event));
+    mock_time_advance_us(1000);
+    CHECK_EQ(gpio_count_events(7, 1), 1);
+    mock_time_advance_us(25 * 1000);
+    CHECK_EQ(gpio_count_events(7, 1), 2);
+    mock_gpio_set_input(7, 0);
+    mock_time_advance_us(50 * 1000);
+    CHECK(!gpio_recv_event(&event));
+
+    // The pins run at their own rate from the same timer
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_ALWAYS, 2), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(8, DLN2_GPIO_EVENT_ALWAYS, 3), DLN2_RES_SUCCESS);
+    mock_gpio_set_input(8, 1);
+    mock_time_advance_us(12 * 1000);
+    uint count7 = 0, count8 = 0;
+    while (gpio_recv_event(&event)) {
+        if (event.pin == 7) {
+            CHECK_EQ(event.value, 0);
+            count7++;
+        } else {
+            CHECK_EQ(event.pin, 8);
+            CHECK_EQ(event.value, 1);
+            count8++;
+        }
+    }
+    CHECK_EQ(count7, 6);
+    CHECK_EQ(count8, 4);
+
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(8, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    mock_time_advance_us(10 * 1000);
+    CHECK(!gpio_recv_event(&event));
+    mock_gpio_set_input(8, 0);
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 8), DLN2_RES_SUCCESS);
+}
+
+static uint32_t gpio_set_debounce(uint32_t duration_us)
+{
+    struct test_rsp rsp;
+    uint32_t val;
+
+    CHECK_EQ(gpio_cmd(DLN2_GPIO_SET_DEBOUNCE, &duration_us, sizeof(duration_us), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_cmd(DLN2_GPIO_GET_DEBOUNCE, NULL, 0, &rsp), DLN2_RES_SUCCESS);
+    memcpy(&val, rsp.data, sizeof(val));
+    return val;
+}
+
+static void test_debounce(void)
+{
+    struct gpio_event event;
+
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_ENABLE, 7), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_CHANGE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_set_debounce(1000), 1000);
+    test_set_features(DLN2_FEATURE_GPIO_TIMESTAMP);
+
+    // Bounce and settle high
+    uint64_t start = time_us_64();
+    for (uint i = 0; i < 5; i++) {
+        mock_gpio_set_input(7, !(i & 1));
+        mock_time_advance_us(200);
+    }
+    CHECK(!gpio_recv_event_size(&event, sizeof(event)));
+    mock_time_advance_us(500);
+    CHECK(!gpio_recv_event_size(&event, sizeof(event)));
+    mock_time_advance_us(500);
+    CHECK(gpio_recv_event_size(&event, sizeof(event)));
+    CHECK_EQ(event.value, 1);
+    CHECK_EQ(event.count, 1);
+    CHECK_EQ(event.timestamp - start, 800);
+    CHECK(!gpio_recv_event_size(&event, sizeof(event)));
+
+    // A glitch that goes back to the same level is not reported
+    mock_gpio_set_input(7, 0);
+    mock_time_advance_us(10);
+    mock_gpio_set_input(7, 1);
+    mock_time_advance_us(5000);
+    CHECK(!gpio_recv_event_size(&event, sizeof(event)));
+
+    // Turned off the edges go straight through
+    CHECK_EQ(gpio_set_debounce(0), 0);
+    mock_gpio_set_input(7, 0);
+    CHECK(gpio_recv_event_size(&event, sizeof(event)));
+    CHECK_EQ(event.value, 0);
+
+    test_set_features(0);
+    CHECK_EQ(gpio_set_event_cfg(7, DLN2_GPIO_EVENT_NONE, 0), DLN2_RES_SUCCESS);
+    CHECK_EQ(gpio_pin_cmd(DLN2_GPIO_PIN_DISABLE, 7), DLN2_RES_SUCCESS);
+}
+
+int main(void)
+{
+    RUN_TEST(test_pin_count);
+    RUN_TEST(test_pin_ownership);
+    RUN_TEST(test_in_out);
+    RUN_TEST(test_port);
+    RUN_TEST(test_events);
+    RUN_TEST(test_event_overflow);
+    RUN_TEST(test_event_coalesce);
+    RUN_TEST(test_event_rate_limit);
+    RUN_TEST(test_event_slot_reserve);
+    RUN_TEST(test_event_timestamp);
+    RUN_TEST(test_event_level_edges);
+    RUN_TEST(test_debounce);
+    RUN_TEST(test_event_periodic);
+
+    return test_result();
+}
@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "test.h"
+#include "hardware/dma.h"
+#include "i2c-at24.h"
+
+#define DLN2_I2C_CMD(cmd)       DLN2_CMD(cmd, DLN2_MODULE_I2C)
+
+#define DLN2_I2C_ENABLE                 DLN2_I2C_CMD(0x01)
+#define DLN2_I2C_DISABLE                DLN2_I2C_CMD(0x02)
+#define DLN2_I2C_WRITE                  DLN2_I2C_CMD(0x06)
+#define DLN2_I2C_READ                   DLN2_I2C_CMD(0x07)
+#define DLN2_I2C_TRANSFER               DLN2_I2C_CMD(0x80)
+
+#define I2C_M_RD        (1 << 0)
+
+#define SENSOR_ADDR     0x48
+#define EEPROM_ADDR     0x50
+#define HUNG_ADDR       0x20
+
+struct i2c_msg_tx {
+    uint8_t port;
+    uint8_t addr;
+    uint8_t mem_addr_len;
+    uint32_t mem_addr;
+    uint16_t buf_len;
+    uint8_t buf[256];
+} TU_ATTR_PACKED;
+
+#define I2C_MSG_HDR_SIZE    9
+
+struct i2c_msg {
+    uint8_t addr;
+    uint8_t flags;
+    uint16_t len;
+} TU_ATTR_PACKED;
+
+static const uint8_t eeprom_initial[] = "HELLO";
+DEFINE_I2C_AT24C32(eeprom, EEPROM_ADDR, eeprom_initial, sizeof(eeprom_initial));
+
+static struct dln2_i2c_device *i2c_devices[] = {
+    &eeprom.base,
+    NULL,
+};
+
+// Register file device: a write sets the register pointer followed by data
+static uint8_t sensor_regs[16];
+static uint8_t sensor_reg;
+// Bus conditions seen by the sensor, 'S' for stop and 'R' for repeated start
+static char sensor_bus[16];
+static size_t sensor_bus_len;
+
+static int i2c_device(uint8_t addr, bool read, uint8_t *buf, size_t len, bool nostop)
+{
+    if (addr == HUNG_ADDR)
+        return PICO_ERROR_TIMEOUT;
+    if (addr != SENSOR_ADDR)
+        return PICO_ERROR_GENERIC;
+
+    if (sensor_bus_len < sizeof(sensor_bus) - 1)
+        sensor_bus[sensor_bus_len++] = nostop ? 'R' : 'S';
+
+    for (size_t i = 0; i < len; i++) {
+        if (read) {
+            buf[i] = sensor_regs[sensor_reg++ % sizeof(sensor_regs)];
+        } else if (!i) {
+            sensor_reg = buf[0];
+        } else {
+            sensor_regs[sensor_reg++ % sizeof(sensor_regs)] = buf[i];
+        }
+    }
+
+    return len;
+}
+
+static uint16_t i2c_echo;
+
+// Blocking messages go out one per task pass
+static uint16_t i2c_cmd(uint16_t id, const void *data, size_t len, struct test_rsp *rsp)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    uint16_t echo = ++i2c_echo;
+    uint passes = 0;
+
+    size_t size = test_build_msg(buf, DLN2_HANDLE_I2C, id, echo, data, len);
+    CHECK(mock_usb_send(buf, size));
+    while (!test_recv(rsp) && ++passes < 32)
+        ;
+    CHECK(passes < 32);
+    CHECK_EQ(rsp->hdr.hdr.echo, echo);
+    CHECK_EQ(rsp->hdr.hdr.id, id);
+    return rsp->hdr.result;
+}
+
+static uint16_t i2c_write(uint8_t addr, const void *buf, uint16_t len)
+{
+    struct i2c_msg_tx msg = { .addr = addr, .buf_len = len };
+    struct test_rsp rsp;
+
+    memcpy(msg.buf, buf, len);
+    return i2c_cmd(DLN2_I2C_WRITE, &msg, I2C_MSG_HDR_SIZE + len, &rsp);
+}
+
+static uint16_t i2c_read(uint8_t addr, void *buf, uint16_t len)
+{
+    struct i2c_msg_tx msg = { .addr = addr, .buf_len = len };
+    struct test_rsp rsp;
+    uint16_t rx_len;
+
+    uint16_t res = i2c_cmd(DLN2_I2C_READ, &msg, I2C_MSG_HDR_SIZE, &rsp);
+    if (res)
+        return res;
+
+    memcpy(&rx_len, rsp.data, sizeof(rx_len));
+    CHECK_EQ(rx_len, len);
+    CHECK_EQ(rsp.len, 2 + len);
+    memcpy(buf, rsp.data + 2, len);
+    return res;
+}
+
+static uint16_t i2c_read_reg(uint8_t addr, uint8_t mem_addr_len, uint32_t mem_addr, void *buf, uint16_t len)
+{
+    struct i2c_msg_tx msg = { .addr = addr, .mem_addr_len = mem_addr_len, .mem_addr = mem_addr, .buf_len = len };
+    struct test_rsp rsp;
+
+    uint16_t res = i2c_cmd(DLN2_I2C_READ, &msg, I2C_MSG_HDR_SIZE, &rsp);
+    if (res)
+        return res;
+
+    CHECK_EQ(rsp.len, 2 + len);
+    memcpy(buf, rsp.data + 2, len);
+    return res;
+}
+
+static uint16_t i2c_write_reg(uint8_t addr, uint8_t mem_addr_len, uint32_t mem_addr, const void *buf, uint16_t len)
+{
+    struct i2c_msg_tx msg = { .addr = addr, .mem_addr_len = mem_addr_len, .mem_addr = mem_addr, .buf_len = len };
+    struct test_rsp rsp;
+
+    memcpy(msg.buf, buf, len);
+    return i2c_cmd(DLN2_I2C_WRITE, &msg, I2C_MSG_HDR_SIZE + len, &rsp);
+}
+
+static void i2c_setup(void)
+{
+    uint8_t port = 0;
+    struct test_rsp rsp;
+
+    mock_i2c_set_device(i2c_device);
+    sensor_bus_len = 0;
+    dln2_i2c_set_devices(i2c_devices);
+    CHECK_EQ(i2c_cmd(DLN2_I2C_ENABLE, &port, sizeof(port), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(mock_gpio_function(PICO_DEFAULT_I2C_SDA_PIN), GPIO_FUNC_I2C);
+}
+
+static void i2c_teardown(void)
+{
+    uint8_t port = 0;
+    struct test_rsp rsp;
+
+    CHECK_EQ(i2c_cmd(DLN2_I2C_DISABLE, &port, sizeof(port), &rsp), DLN2_RES_SUCCESS);
+}
+
+static void test_write_read(void)
+{
+    const uint8_t data[] = { 2, 0xaa, 0xbb, 0xcc };
+    uint8_t reg = 2;
+    uint8_t buf[3];
+
+    i2c_setup();
+
+    CHECK_EQ(i2c_write(SENSOR_ADDR, data, sizeof(data)), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_write(SENSOR_ADDR, &reg, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_read(SENSOR_ADDR, buf, sizeof(buf)), DLN2_RES_SUCCESS);
+    CHECK(!memcmp(buf, data + 1, sizeof(buf)));
+
+    i2c_teardown();
+}
+
+static uint i2c_free_dma_channels(void)
+{
+    int claimed[NUM_DMA_CHANNELS];
+    uint count = 0;
+    int ch;
+
+    while ((ch = dma_claim_unused_channel(false)) >= 0)
+        claimed[count++] = ch;
+    for (uint i = 0; i < count; i++)
+        dma_channel_unclaim(claimed[i]);
+    return count;
+}
+
+// Without DMA the messages go out one per pass so the other modules get their turn in between
+static void test_no_dma(void)
+{
+    const struct i2c_msg msgs[] = {
+        { SENSOR_ADDR, 0, 1 },
+        { SENSOR_ADDR, I2C_M_RD, 2 },
+        { EEPROM_ADDR, 0, 2 },
+        { EEPROM_ADDR, I2C_M_RD, 5 },
+    };
+    const uint8_t tx[] = { 2, 0x00, 0x00 };
+    const uint8_t data[] = { 2, 0x12, 0x34 };
+    int claimed[NUM_DMA_CHANNELS];
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    uint count = 0;
+    int ch;
+
+    while ((ch = dma_claim_unused_channel(false)) >= 0)
+        claimed[count++] = ch;
+    i2c_setup();
+    CHECK_EQ(i2c_write(SENSOR_ADDR, data, sizeof(data)), DLN2_RES_SUCCESS);
+
+    struct {
+        uint8_t port;
+        uint8_t count;
+        struct i2c_msg msgs[4];
+        uint8_t tx[3];
+    } TU_ATTR_PACKED cmd = { .count = 4 };
+    memcpy(cmd.msgs, msgs, sizeof(msgs));
+    memcpy(cmd.tx, tx, sizeof(tx));
+    sensor_bus_len = 0;
+    size_t len = test_build_msg(buf, DLN2_HANDLE_I2C, DLN2_I2C_TRANSFER, 1, &cmd, sizeof(cmd));
+    CHECK(mock_usb_send(buf, len));
+
+    for (uint i = 1; i <= 2; i++) {
+        CHECK(!test_recv(&rsp));
+        CHECK_EQ(sensor_bus_len, i);
+        CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x01, DLN2_MODULE_GPIO), NULL, 0, &rsp));
+    }
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 1);
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + 2 + 5);
+    CHECK_EQ(rsp.data[2], 0x12);
+    CHECK_EQ(rsp.data[3], 0x34);
+    CHECK(!memcmp(rsp.data + 4, eeprom_initial, 5));
+    CHECK(!memcmp(sensor_bus, "RS", 2));
+
+    i2c_teardown();
+    for (uint i = 0; i < count; i++)
+        dma_channel_unclaim(claimed[i]);
+}
+
+// Enabling the port again keeps the DMA channels it has
+static void test_enable_twice(void)
+{
+    uint free = i2c_free_dma_channels();
+    uint8_t port = 0;
+    struct test_rsp rsp;
+
+    i2c_setup();
+    CHECK_EQ(i2c_free_dma_channels(), free - 2);
+    CHECK_EQ(i2c_cmd(DLN2_I2C_ENABLE, &port, sizeof(port), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_free_dma_channels(), free - 2);
+    i2c_teardown();
+    CHECK_EQ(i2c_free_dma_channels(), free);
+}
+
+static void test_no_device(void)
+{
+    uint8_t buf[1] = { 0 };
+
+    i2c_setup();
+
+    CHECK_EQ(i2c_write(0x10, buf, 1), DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+    CHECK_EQ(i2c_read(0x10, buf, 1), DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+
+    i2c_teardown();
+}
+
+static void test_at24_eeprom(void)
+{
+    const uint8_t write[] = { 0x00, 0x10, 'd', 'l', 'n', '2' };
+    const uint8_t offset[] = { 0x00, 0x00 };
+    uint8_t buf[6];
+
+    i2c_setup();
+
+    CHECK_EQ(i2c_write(EEPROM_ADDR, offset, sizeof(offset)), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_read(EEPROM_ADDR, buf, sizeof(buf)), DLN2_RES_SUCCESS);
+    CHECK(!memcmp(buf, eeprom_initial, sizeof(eeprom_initial)));
+
+    CHECK_EQ(i2c_write(EEPROM_ADDR, write, sizeof(write)), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_write(EEPROM_ADDR, write, 2), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_read(EEPROM_ADDR, buf, 4), DLN2_RES_SUCCESS);
+    CHECK(!memcmp(buf, write + 2, 4));
+
+    i2c_teardown();
+}
+
+static void test_mem_addr(void)
+{
+    const uint8_t data[] = { 5, 0x11, 0x22, 0x33 };
+    const uint8_t eeprom_write[] = { 0x01, 0x00, 'a', 'b' };
+    struct test_rsp rsp;
+    uint8_t buf[4];
+
+    i2c_setup();
+
+    CHECK_EQ(i2c_write(SENSOR_ADDR, data, sizeof(data)), DLN2_RES_SUCCESS);
+    sensor_bus_len = 0;
+
+    // The register address goes out in the same transfer
+    CHECK_EQ(i2c_read_reg(SENSOR_ADDR, 1, 6, buf, 2), DLN2_RES_SUCCESS);
+    CHECK(!memcmp(buf, data + 2, 2));
+    CHECK_EQ(sensor_bus_len, 2);
+    CHECK(!memcmp(sensor_bus, "RS", 2));
+
+    // MSB first
+    CHECK_EQ(i2c_write(EEPROM_ADDR, eeprom_write, sizeof(eeprom_write)), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_read_reg(EEPROM_ADDR, 2, 0x0100, buf, 2), DLN2_RES_SUCCESS);
+    CHECK(!memcmp(buf, "ab", 2));
+
+    // Writes put the register address in front of the data
+    sensor_bus_len = 0;
+    CHECK_EQ(i2c_write_reg(SENSOR_ADDR, 1, 9, data + 1, 3), DLN2_RES_SUCCESS);
+    CHECK_EQ(sensor_bus_len, 1);
+    CHECK(!memcmp(sensor_regs + 9, data + 1, 3));
+    CHECK_EQ(i2c_write_reg(EEPROM_ADDR, 2, 0x0102, "cd", 2), DLN2_RES_SUCCESS);
+    CHECK_EQ(i2c_read_reg(EEPROM_ADDR, 2, 0x0100, buf, 4), DLN2_RES_SUCCESS);
+    CHECK(!memcmp(buf, "abcd", 4));
+
+    CHECK_EQ(i2c_read_reg(SENSOR_ADDR, 5, 0, buf, 1), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(i2c_write_reg(SENSOR_ADDR, 5, 0, buf, 1), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(i2c_read_reg(0x10, 1, 0, buf, 1), DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+
+    // The read data has to fit in the response
+    CHECK_EQ(i2c_read_reg(SENSOR_ADDR, 0, 0, NULL, DLN2_BUF_SIZE), DLN2_RES_INVALID_BUFFER_SIZE);
+
+    // buf_len has to match the data
+    struct i2c_msg_tx msg = { .addr = SENSOR_ADDR, .buf_len = 4 };
+    CHECK_EQ(i2c_cmd(DLN2_I2C_WRITE, &msg, I2C_MSG_HDR_SIZE + 2, &rsp), DLN2_RES_INVALID_COMMAND_SIZE);
+
+    i2c_teardown();
+}
+
+static uint16_t i2c_transfer(const struct i2c_msg *msgs, uint count, const void *tx, size_t tx_len,
+                             struct test_rsp *rsp)
+{
+    uint8_t buf[DLN2_BUF_SIZE] = { 0, count };
+    size_t len = 2;
+
+    memcpy(buf + len, msgs, count * sizeof(*msgs));
+    len += count * sizeof(*msgs);
+    memcpy(buf + len, tx, tx_len);
+    len += tx_len;
+
+    return i2c_cmd(DLN2_I2C_TRANSFER, buf, len, rsp);
+}
+
+static void test_transfer(void)
+{
+    const uint8_t data[] = { 8, 0xa0, 0xa1, 0xa2, 0xa3 };
+    struct test_rsp rsp;
+
+    i2c_setup();
+
+    CHECK_EQ(i2c_write(SENSOR_ADDR, data, sizeof(data)), DLN2_RES_SUCCESS);
+    sensor_bus_len = 0;
+
+    // Register read: write the address, read 2, then again from a register further on
+    const struct i2c_msg msgs[] = {
+        { SENSOR_ADDR, 0, 1 },
+        { SENSOR_ADDR, I2C_M_RD, 2 },
+        { SENSOR_ADDR, 0, 1 },
+        { SENSOR_ADDR, I2C_M_RD, 1 },
+    };
+    const uint8_t tx[] = { 9, 11 };
+    CHECK_EQ(i2c_transfer(msgs, 4, tx, sizeof(tx), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + 3);
+    CHECK_EQ(rsp.data[0] | rsp.data[1] << 8, 3);
+    CHECK_EQ(rsp.data[2], 0xa1);
+    CHECK_EQ(rsp.data[3], 0xa2);
+    CHECK_EQ(rsp.data[4], 0xa3);
+    CHECK_EQ(sensor_bus_len, 4);
+    CHECK(!memcmp(sensor_bus, "RRRS", 4));
+
+    // Stop before changing address
+    const struct i2c_msg eeprom_msgs[] = {
+        { EEPROM_ADDR, 0, 2 },
+        { EEPROM_ADDR, I2C_M_RD, 5 },
+        { SENSOR_ADDR, 0, 1 },
+        { SENSOR_ADDR, I2C_M_RD, 1 },
+    };
+    const uint8_t eeprom_tx[] = { 0x00, 0x00, 8 };
+    sensor_bus_len = 0;
+    CHECK_EQ(i2c_transfer(eeprom_msgs, 4, eeprom_tx, sizeof(eeprom_tx), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + 6);
+    CHECK(!memcmp(rsp.data + 2, eeprom_initial, 5));
+    CHECK_EQ(rsp.data[7], 0xa0);
+    CHECK(!memcmp(sensor_bus, "RS", 2));
+
+    // The largest group: a full write and the largest read to the same device
+    static uint8_t full_tx[DLN2_BUF_SIZE - 8 - 2 - 2 * 4];
+    const struct i2c_msg full[] = {
+        { SENSOR_ADDR, 0, sizeof(full_tx) },
+        { SENSOR_ADDR, I2C_M_RD, DLN2_BUF_SIZE - 10 - 2 },
+    };
+    for (uint i = 0; i < sizeof(full_tx); i++)
+        full_tx[i] = i;
+    sensor_bus_len = 0;
+    CHECK_EQ(i2c_transfer(full, 2, full_tx, sizeof(full_tx), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + full[1].len);
+    // The pointer wrapped around the 16 registers and ended up at 0
+    for (uint i = 0; i < full[1].len; i++)
+        CHECK_EQ(rsp.data[2 + i], (uint8_t)(sizeof(full_tx) - 16 + i % 16));
+    CHECK(!memcmp(sensor_bus, "RS", 2));
+
+    // Errors
+    const struct i2c_msg bad_flags[] = { { SENSOR_ADDR, 0x80, 1 } };
+    CHECK_EQ(i2c_transfer(bad_flags, 1, tx, 1, &rsp), DLN2_RES_BAD_PARAMETER);
+    const struct i2c_msg empty[] = { { SENSOR_ADDR, 0, 0 } };
+    CHECK_EQ(i2c_transfer(empty, 1, NULL, 0, &rsp), DLN2_RES_INVALID_BUFFER_SIZE);
+    const struct i2c_msg big[] = { { SENSOR_ADDR, I2C_M_RD, 200 }, { SENSOR_ADDR, I2C_M_RD, 200 } };
+    CHECK_EQ(i2c_transfer(big, 2, NULL, 0, &rsp), DLN2_RES_INVALID_BUFFER_SIZE);
+    CHECK_EQ(i2c_transfer(msgs, 4, tx, 1, &rsp), DLN2_RES_INVALID_COMMAND_SIZE);
+    CHECK_EQ(i2c_transfer(msgs, 0, NULL, 0, &rsp), DLN2_RES_BAD_PARAMETER);
+    const struct i2c_msg missing[] = { { 0x10, I2C_M_RD, 1 } };
+    CHECK_EQ(i2c_transfer(missing, 1, NULL, 0, &rsp), DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+
+    i2c_teardown();
+}
+
+static uint scl_clocks;
+
+// The stuck device lets go of SDA after three clocks. SCL is never driven high, only released.
+static void i2c_recovery_hook(uint gpio, bool value)
+{
+    if (gpio != PICO_DEFAULT_I2C_SCL_PIN)
+        return;
+    if (value) {
+        CHECK(!gpio_get_dir(gpio));
+        return;
+    }
+    if (++scl_clocks == 3)
+        mock_gpio_set_input(PICO_DEFAULT_I2C_SDA_PIN, 1);
+}
+
+// A hung bus doesn't hold up the other modules or the requests queued behind it
+static void test_timeout(void)
+{
+    struct i2c_msg_tx read = { .addr = HUNG_ADDR, .buf_len = 1 };
+    struct i2c_msg_tx write = { .addr = SENSOR_ADDR, .buf_len = 2, .buf = { 3, 0x55 } };
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    size_t len;
+
+    i2c_setup();
+    // SCL has its pull-up
+    mock_gpio_set_input(PICO_DEFAULT_I2C_SCL_PIN, 1);
+    mock_gpio_set_input(PICO_DEFAULT_I2C_SDA_PIN, 0);
+    mock_gpio_set_output_hook(i2c_recovery_hook);
+    scl_clocks = 0;
+
+    len = test_build_msg(buf, DLN2_HANDLE_I2C, DLN2_I2C_READ, 1, &read, I2C_MSG_HDR_SIZE);
+    CHECK(mock_usb_send(buf, len));
+    len = test_build_msg(buf, DLN2_HANDLE_I2C, DLN2_I2C_WRITE, 2, &write, I2C_MSG_HDR_SIZE + 2);
+    CHECK(mock_usb_send(buf, len));
+
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_CMD(0x01, DLN2_MODULE_GPIO), NULL, 0, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK(!test_recv(&rsp));
+
+    mock_time_advance_us(150 * 1000 + 1);
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 1);
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+    // Three clocks and the stop
+    CHECK_EQ(scl_clocks, 4);
+    CHECK(gpio_get(PICO_DEFAULT_I2C_SDA_PIN));
+    CHECK_EQ(mock_gpio_function(PICO_DEFAULT_I2C_SCL_PIN), GPIO_FUNC_I2C);
+    CHECK_EQ(mock_gpio_function(PICO_DEFAULT_I2C_SDA_PIN), GPIO_FUNC_I2C);
+
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 2);
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK_EQ(sensor_regs[3], 0x55);
+
+    // A device that's gone doesn't need recovery
+    CHECK_EQ(i2c_read(0x10, buf, 1), DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+    CHECK_EQ(scl_clocks, 4);
+
+    // Recovery gives up on a clock that's held low for good
+    mock_gpio_set_input(PICO_DEFAULT_I2C_SCL_PIN, 0);
+    mock_gpio_set_input(PICO_DEFAULT_I2C_SDA_PIN, 0);
+    scl_clocks = 0;
+    len = test_build_msg(buf, DLN2_HANDLE_I2C, DLN2_I2C_READ, 3, &read, I2C_MSG_HDR_SIZE);
+    CHECK(mock_usb_send(buf, len));
+    CHECK(!test_recv(&rsp));
+    mock_time_advance_us(150 * 1000 + 1);
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 3);
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_I2C_MASTER_SENDING_ADDRESS_FAILED);
+    CHECK_EQ(scl_clocks, 0);
+    CHECK(!gpio_get_dir(PICO_DEFAULT_I2C_SCL_PIN));
+    CHECK_EQ(mock_gpio_function(PICO_DEFAULT_I2C_SCL_PIN), GPIO_FUNC_I2C);
+
+    i2c_teardown();
+}
+
+int main(void)
+{
+    RUN_TEST(test_write_read);
+    RUN_TEST(test_no_dma);
+    RUN_TEST(test_enable_twice);
+    RUN_TEST(test_no_device);
+    RUN_TEST(test_at24_eeprom);
+    RUN_TEST(test_mem_addr);
+    RUN_TEST(test_transfer);
+    RUN_TEST(test_timeout);
+
+    return test_result();
+}
@@ -0,0 +1,1222 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include "test.h"
+#include "hardware/dma.h"
+#include "hardware/spi.h"
+
+#define DLN2_SPI_CMD(cmd)       DLN2_CMD(cmd, DLN2_MODULE_SPI)
+
+#define DLN2_SPI_ENABLE                         DLN2_SPI_CMD(0x11)
+#define DLN2_SPI_DISABLE                        DLN2_SPI_CMD(0x12)
+#define DLN2_SPI_SET_FRAME_SIZE                 DLN2_SPI_CMD(0x16)
+#define DLN2_SPI_SET_FREQUENCY                  DLN2_SPI_CMD(0x18)
+#define DLN2_SPI_READ_WRITE                     DLN2_SPI_CMD(0x1A)
+#define DLN2_SPI_READ                           DLN2_SPI_CMD(0x1B)
+#define DLN2_SPI_WRITE                          DLN2_SPI_CMD(0x1C)
+#define DLN2_SPI_SET_DELAY_BETWEEN_SS           DLN2_SPI_CMD(0x20)
+#define DLN2_SPI_SET_DELAY_AFTER_SS             DLN2_SPI_CMD(0x22)
+#define DLN2_SPI_GET_DELAY_AFTER_SS             DLN2_SPI_CMD(0x23)
+#define DLN2_SPI_SET_DELAY_BETWEEN_FRAMES       DLN2_SPI_CMD(0x24)
+#define DLN2_SPI_GET_DELAY_BETWEEN_FRAMES       DLN2_SPI_CMD(0x25)
+#define DLN2_SPI_SS_MULTI_ENABLE                DLN2_SPI_CMD(0x38)
+#define DLN2_SPI_SS_MULTI_DISABLE               DLN2_SPI_CMD(0x39)
+#define DLN2_SPI_GET_SS_COUNT                   DLN2_SPI_CMD(0x44)
+#define DLN2_SPI_STREAM_READ                    DLN2_SPI_CMD(0x80)
+#define DLN2_SPI_STREAM_WRITE                   DLN2_SPI_CMD(0x81)
+#define DLN2_SPI_STREAM_DATA                    DLN2_SPI_CMD(0x82)
+#define DLN2_SPI_STREAM_READ_EV                 DLN2_SPI_CMD(0x83)
+#define DLN2_SPI_SET_SS_PINS                    DLN2_SPI_CMD(0x84)
+#define DLN2_SPI_GET_SS_PINS                    DLN2_SPI_CMD(0x85)
+#define DLN2_SPI_TRANSFER_LIST                  DLN2_SPI_CMD(0x86)
+#define DLN2_SPI_SET_ENGINE                     DLN2_SPI_CMD(0x87)
+#define DLN2_SPI_GET_ENGINE                     DLN2_SPI_CMD(0x88)
+#define DLN2_SPI_FLASH_READ_ID                  DLN2_SPI_CMD(0x89)
+#define DLN2_SPI_FLASH_ERASE                    DLN2_SPI_CMD(0x8A)
+#define DLN2_SPI_FLASH_PROGRAM                  DLN2_SPI_CMD(0x8B)
+#define DLN2_SPI_FLASH_READ                     DLN2_SPI_CMD(0x8C)
+#define DLN2_SPI_FLASH_CRC32                    DLN2_SPI_CMD(0x8D)
+#define DLN2_SPI_SET_SS                         DLN2_SPI_CMD(0x26)
+
+#define DLN2_SPI_ATTR_LEAVE_SS_LOW      (1 << 0)
+
+#define DLN2_SPI_SEGMENT_TX             (1 << 0)
+#define DLN2_SPI_SEGMENT_RX             (1 << 1)
+#define DLN2_SPI_SEGMENT_CS_CHANGE      (1 << 2)
+#define DLN2_SPI_SEGMENT_QUAD           (1 << 4)
+
+#define DLN2_SPI_ENGINE_HW              0
+#define DLN2_SPI_ENGINE_PIO             1
+
+#define DLN2_SPI_PIO_LSB_FIRST          (1 << 0)
+#define DLN2_SPI_PIO_3WIRE              (1 << 1)
+#define DLN2_SPI_PIO_QUAD               (1 << 3)
+
+#define SPI_CSN_PIN     PICO_DEFAULT_SPI_CSN_PIN
+#define SPI1_SCK_PIN    10
+#define SPI1_CSN_PIN    13
+#define PIO_SCK_PIN     2
+#define PIO_IO0_PIN     3
+
+struct spi_xfer {
+    uint8_t port;
+    uint16_t size;
+    uint8_t attr;
+    uint8_t buf[256];
+} TU_ATTR_PACKED;
+
+struct spi_stream {
+    uint8_t port;
+    uint32_t size;
+    uint8_t attr;
+} TU_ATTR_PACKED;
+
+struct spi_stream_event {
+    uint32_t offset;
+    uint16_t size;
+    uint8_t buf[];
+} TU_ATTR_PACKED;
+
+struct spi_segment {
+    uint8_t flags;
+    uint8_t bpw;
+    uint16_t len;
+    uint16_t delay_us;
+} TU_ATTR_PACKED;
+
+struct spi_flash_range {
+    uint8_t port;
+    uint32_t addr;
+    uint32_t size;
+} TU_ATTR_PACKED;
+
+struct spi_flash_page {
+    uint8_t port;
+    uint32_t addr;
+    uint8_t buf[256];
+} TU_ATTR_PACKED;
+
+struct spi_engine {
+    uint8_t port;
+    uint8_t engine;
+    uint8_t flags;
+    uint8_t sck;
+    uint8_t mosi;
+    uint8_t miso;
+} TU_ATTR_PACKED;
+
+struct spi_list {
+    uint8_t port;
+    uint8_t count;
+    uint8_t attr;
+    struct spi_segment segs[3];
+    uint8_t tx[4];
+} TU_ATTR_PACKED;
+
+static uint8_t spi_written[1024];
+static size_t spi_written_len;
+static size_t spi_frames[2];
+// Chip selects that have to be active or inactive during a transfer on each port
+static uint32_t spi_cs_low[2] = { 1 << SPI_CSN_PIN, 1 << SPI1_CSN_PIN };
+static uint32_t spi_cs_high[2];
+
+// Shift register device: MISO is the inverse of MOSI, records what was written
+static void spi_device(uint index, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    for (uint pin = 0; pin < NUM_BANK0_GPIOS; pin++) {
+        if (spi_cs_low[index] & (1 << pin))
+            CHECK(!gpio_get_out_level(pin));
+        if (spi_cs_high[index] & (1 << pin))
+            CHECK(gpio_get_out_level(pin));
+    }
+    spi_frames[index] += len;
+
+    for (size_t i = 0; i < len; i++) {
+        if (spi_written_len < sizeof(spi_written))
+            spi_written[spi_written_len++] = tx[i];
+        rx[i] = ~tx[i];
+    }
+}
+
+static uint16_t spi_cmd(uint16_t id, const void *data, size_t len, struct test_rsp *rsp)
+{
+    CHECK(test_cmd(DLN2_HANDLE_SPI, id, data, len, rsp));
+    return rsp->hdr.result;
+}
+
+static uint16_t spi_port_cmd(uint16_t id, const void *data, size_t len)
+{
+    struct test_rsp rsp;
+    return spi_cmd(id, data, len, &rsp);
+}
+
+static void spi_setup(void)
+{
+    uint8_t port = 0;
+    uint8_t cs[2] = { 0, 0x01 };
+
+    mock_spi_set_device(spi_device);
+    spi_written_len = 0;
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_GET_SS_COUNT, &port, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_ENABLE, &port, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs, sizeof(cs)), DLN2_RES_SUCCESS);
+    CHECK_EQ(mock_gpio_function(PICO_DEFAULT_SPI_SCK_PIN), GPIO_FUNC_SPI);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+}
+
+static void spi_teardown(void)
+{
+    uint8_t disable[2] = { 0, 0 };
+    uint8_t cs[2] = { 0, 0x01 };
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_DISABLE, cs, sizeof(cs)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_DISABLE, disable, sizeof(disable)), DLN2_RES_SUCCESS);
+}
+
+static void test_read_write(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 256 };
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    for (uint i = 0; i < xfer.size; i++)
+        xfer.buf[i] = i;
+
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + xfer.size);
+    CHECK_EQ(rsp.data[0] | rsp.data[1] << 8, xfer.size);
+    CHECK_EQ(spi_written_len, xfer.size);
+    for (uint i = 0; i < xfer.size; i++) {
+        CHECK_EQ(spi_written[i], i);
+        CHECK_EQ(rsp.data[2 + i], (uint8_t)~i);
+    }
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    spi_teardown();
+}
+
+static void test_read(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 10 };
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ, &xfer, 4, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + xfer.size);
+    for (uint i = 0; i < xfer.size; i++)
+        CHECK_EQ(rsp.data[2 + i], 0xff);
+
+    spi_teardown();
+}
+
+static void test_write_leave_ss_low(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 3, .attr = DLN2_SPI_ATTR_LEAVE_SS_LOW, .buf = { 1, 2, 3 } };
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK(!gpio_get_out_level(SPI_CSN_PIN));
+    xfer.attr = 0;
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+    CHECK_EQ(spi_written_len, 6);
+
+    spi_teardown();
+}
+
+// Other requests are handled while a transfer is running, SPI requests wait their turn
+static void test_async(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 200 };
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    size_t len;
+
+    spi_setup();
+    mock_spi_set_dma_frames_per_poll(16);
+
+    for (uint i = 0; i < xfer.size; i++)
+        xfer.buf[i] = i;
+
+    len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_READ_WRITE, 1, &xfer, 4 + xfer.size);
+    CHECK(mock_usb_send(buf, len));
+    xfer.size = 5;
+    len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_WRITE, 2, &xfer, 4 + xfer.size);
+    CHECK(mock_usb_send(buf, len));
+    len = test_build_msg(buf, DLN2_HANDLE_CTRL, DLN2_CMD(0x30, DLN2_MODULE_GENERIC), 3, NULL, 0);
+    CHECK(mock_usb_send(buf, len));
+
+    // The write waits for the running transfer, the request for the other module goes ahead
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 3);
+    CHECK(spi_written_len > 0 && spi_written_len < 200);
+    CHECK(!gpio_get_out_level(SPI_CSN_PIN));
+
+    uint polls = 1;
+    while (!test_recv(&rsp) && polls < 100)
+        polls++;
+    CHECK(polls >= 200 / 16);
+    CHECK_EQ(rsp.hdr.hdr.echo, 1);
+    CHECK_EQ(rsp.len, 2 + 200);
+    for (uint i = 0; i < 200; i++)
+        CHECK_EQ(rsp.data[2 + i], (uint8_t)~i);
+
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 2);
+    CHECK_EQ(spi_written_len, 205);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    mock_spi_set_dma_frames_per_poll(0);
+    spi_teardown();
+}
+
+// A host that goes away in the middle of a transfer doesn't leave the port busy
+static void test_reset(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 200 };
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+
+    spi_setup();
+    mock_spi_set_dma_frames_per_poll(16);
+
+    size_t len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_READ_WRITE, 1, &xfer, 4 + xfer.size);
+    CHECK(mock_usb_send(buf, len));
+    test_tasks();
+    CHECK(spi_written_len > 0 && spi_written_len < 200);
+    CHECK(!gpio_get_out_level(SPI_CSN_PIN));
+
+    mock_usb_reset();
+    dln2_init(MOCK_RHPORT, MOCK_EP_OUT, MOCK_EP_IN);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    mock_spi_set_dma_frames_per_poll(0);
+    spi_written_len = 0;
+    xfer.size = 5;
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_written_len, 5);
+    CHECK(!test_recv(&rsp));
+
+    spi_teardown();
+}
+
+// A coalesced transfer that fills its last packet is ended with a ZLP
+static void test_in_coalesce_zlp(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 64 - 10 - 2 };
+    uint8_t buf[DLN2_BUF_SIZE];
+
+    spi_setup();
+    test_set_features(DLN2_FEATURE_IN_COALESCE);
+
+    size_t len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_READ, 1, &xfer, 4);
+    CHECK(mock_usb_send(buf, len));
+    test_tasks();
+    CHECK_EQ(mock_usb_recv(buf, sizeof(buf)), 64);
+    CHECK_EQ(mock_usb_recv(buf, sizeof(buf)), 0);
+    CHECK_EQ(mock_usb_recv(buf, sizeof(buf)), -1);
+
+    test_set_features(0);
+    spi_teardown();
+}
+
+// The data comes as events while CS is held, the request is answered at the end
+static void test_stream_read(void)
+{
+    struct spi_stream stream = { .port = 0, .size = 5000 };
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    uint32_t offset = 0;
+    uint events = 0;
+
+    spi_setup();
+
+    size_t len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_STREAM_READ, 7, &stream, sizeof(stream));
+    CHECK(mock_usb_send(buf, len));
+
+    for (uint polls = 0; polls < 1000; polls++) {
+        if (!test_recv(&rsp))
+            continue;
+
+        struct dln2_header *hdr = &rsp.hdr.hdr;
+        if (hdr->handle == DLN2_HANDLE_SPI)
+            break;
+
+        struct spi_stream_event *ev = (struct spi_stream_event *)((uint8_t *)&rsp.hdr + sizeof(*hdr));
+        CHECK_EQ(hdr->id, DLN2_SPI_STREAM_READ_EV);
+        CHECK_EQ(ev->offset, offset);
+        CHECK_EQ(hdr->size, sizeof(*hdr) + sizeof(*ev) + ev->size);
+        for (uint i = 0; i < ev->size; i++)
+            CHECK_EQ(ev->buf[i], 0xff);
+        offset += ev->size;
+        if (offset < stream.size)
+            CHECK(!gpio_get_out_level(SPI_CSN_PIN));
+        events++;
+    }
+
+    CHECK_EQ(rsp.hdr.hdr.echo, 7);
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK_EQ(offset, 5000);
+    CHECK_EQ(events, (5000 + DLN2_BUF_SIZE - 15) / (DLN2_BUF_SIZE - 14));
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    spi_teardown();
+}
+
+static void test_stream_write(void)
+{
+    struct spi_stream stream = { .port = 0, .size = 600 };
+    struct spi_xfer xfer = { .port = 0, .size = 4 };
+    struct {
+        uint8_t port;
+        uint8_t buf[200];
+    } TU_ATTR_PACKED data = { .port = 0 };
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_DATA, &data, sizeof(data)), DLN2_RES_INVALID_MODE);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_WRITE, &stream, sizeof(stream)), DLN2_RES_SUCCESS);
+    CHECK(!gpio_get_out_level(SPI_CSN_PIN));
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ, &xfer, 4, &rsp), DLN2_RES_INVALID_MODE);
+
+    // The host doesn't have to wait for each chunk to be written
+    for (uint i = 0; i < 3; i++) {
+        for (uint j = 0; j < sizeof(data.buf); j++)
+            data.buf[j] = i * sizeof(data.buf) + j;
+        size_t len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_STREAM_DATA, i, &data, sizeof(data));
+        CHECK(mock_usb_send(buf, len));
+    }
+
+    for (uint i = 0; i < 3; i++) {
+        CHECK(test_recv(&rsp));
+        CHECK_EQ(rsp.hdr.hdr.echo, i);
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    }
+
+    CHECK_EQ(spi_written_len, 600);
+    for (uint i = 0; i < 600; i++)
+        CHECK_EQ(spi_written[i], (uint8_t)i);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    // Going past the stream size
+    stream.size = 100;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_WRITE, &stream, sizeof(stream)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_DATA, &data, sizeof(data)), DLN2_RES_BAD_PARAMETER);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_DATA, &data, 1 + 100), DLN2_RES_SUCCESS);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    spi_teardown();
+}
+
+// Devices behind the extra chip selects share the bus
+static void test_ss_pins(void)
+{
+    struct {
+        uint8_t port;
+        uint8_t count;
+        uint8_t pins[3];
+    } TU_ATTR_PACKED pins = { .port = 0, .count = 3, .pins = { SPI_CSN_PIN, 20, 21 } };
+    struct spi_xfer xfer = { .port = 0, .size = 2, .buf = { 0x12, 0x34 } };
+    uint8_t port = 0;
+    uint8_t cs[2] = { 0, 0x07 };
+    struct test_rsp rsp;
+
+    // Not while a chip select is enabled
+    spi_setup();
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins, sizeof(pins)), DLN2_RES_INVALID_MODE);
+    spi_teardown();
+
+    pins.pins[2] = 20;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins, sizeof(pins)), DLN2_RES_INVALID_PIN_NUMBER);
+    // Not the port's own data pins or the pins of the other port
+    pins.pins[2] = PICO_DEFAULT_SPI_SCK_PIN;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins, sizeof(pins)), DLN2_RES_PIN_IN_USE);
+    port = 1;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_ENABLE, &port, 1), DLN2_RES_SUCCESS);
+    pins.pins[2] = SPI1_SCK_PIN;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins, sizeof(pins)), DLN2_RES_PIN_IN_USE);
+    uint8_t disable1[2] = { 1, 0 };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_DISABLE, disable1, sizeof(disable1)), DLN2_RES_SUCCESS);
+    port = 0;
+
+    pins.pins[2] = 21;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins, sizeof(pins) - 1), DLN2_RES_INVALID_COMMAND_SIZE);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins, sizeof(pins)), DLN2_RES_SUCCESS);
+
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_GET_SS_PINS, &port, 1, &rsp));
+    CHECK_EQ(rsp.len, 4);
+    CHECK_EQ(rsp.data[0], 3);
+    CHECK_EQ(rsp.data[3], 21);
+
+    mock_spi_set_device(spi_device);
+    spi_written_len = 0;
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_GET_SS_COUNT, &port, 1, &rsp));
+    CHECK_EQ(rsp.data[0], 3);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_ENABLE, &port, 1), DLN2_RES_SUCCESS);
+
+    // A chip select the other port has enabled
+    struct {
+        uint8_t port;
+        uint8_t count;
+        uint8_t pins[2];
+    } TU_ATTR_PACKED pins1 = { .port = 1, .count = 2, .pins = { SPI1_CSN_PIN, 21 } };
+    uint8_t cs1[2] = { 1, 0x02 };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins1, sizeof(pins1)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs1, sizeof(cs1)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs, sizeof(cs)), DLN2_RES_PIN_IN_USE);
+    CHECK(!dln2_pin_is_requested(20, DLN2_MODULE_SPI));
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_DISABLE, cs1, sizeof(cs1)), DLN2_RES_SUCCESS);
+    pins1.count = 1;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins1, 2 + 1), DLN2_RES_SUCCESS);
+
+    // A pin in use leaves none of them claimed
+    cs[1] = 0x08;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs, sizeof(cs)), DLN2_RES_SPI_MASTER_INVALID_SS_VALUE);
+    CHECK_EQ(dln2_pin_request(21, DLN2_MODULE_GPIO), 0);
+    cs[1] = 0x07;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs, sizeof(cs)), DLN2_RES_PIN_IN_USE);
+    CHECK(!dln2_pin_is_requested(20, DLN2_MODULE_SPI));
+    CHECK_EQ(dln2_pin_free(21, DLN2_MODULE_GPIO), 0);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs, sizeof(cs)), DLN2_RES_SUCCESS);
+
+    uint8_t set_ss[2] = { 0, 0xfd };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS, set_ss, sizeof(set_ss)), DLN2_RES_SUCCESS);
+    spi_cs_low[0] = 1 << 20;
+    spi_cs_high[0] = (1 << SPI_CSN_PIN) | (1 << 21);
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK(gpio_get_out_level(20));
+
+    // Both at once
+    set_ss[1] = 0xfa;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS, set_ss, sizeof(set_ss)), DLN2_RES_SUCCESS);
+    spi_cs_low[0] = (1 << SPI_CSN_PIN) | (1 << 21);
+    spi_cs_high[0] = 1 << 20;
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_written_len, 4);
+
+    set_ss[1] = 0xf7;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS, set_ss, sizeof(set_ss)), DLN2_RES_SPI_MASTER_INVALID_SS_VALUE);
+    set_ss[1] = 0xfe;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS, set_ss, sizeof(set_ss)), DLN2_RES_SUCCESS);
+    spi_cs_low[0] = 1 << SPI_CSN_PIN;
+    spi_cs_high[0] = 0;
+
+    uint8_t disable[2] = { 0, 0 };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_DISABLE, cs, sizeof(cs)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_DISABLE, disable, sizeof(disable)), DLN2_RES_SUCCESS);
+    CHECK(!dln2_pin_is_requested(21, DLN2_MODULE_SPI));
+
+    pins.count = 1;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_SS_PINS, &pins, 2 + 1), DLN2_RES_SUCCESS);
+}
+
+// The ports have their own settings and run transfers at the same time
+static void test_port1(void)
+{
+    struct spi_xfer xfer0 = { .port = 0, .size = 200 };
+    struct spi_xfer xfer1 = { .port = 1, .size = 32 };
+    uint8_t port = 1;
+    uint8_t cs[2] = { 1, 0x01 };
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    size_t len;
+
+    spi_setup();
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_GET_SS_COUNT, &port, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_ENABLE, &port, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs, sizeof(cs)), DLN2_RES_SUCCESS);
+    CHECK_EQ(mock_gpio_function(SPI1_SCK_PIN), GPIO_FUNC_SPI);
+    CHECK(gpio_get_out_level(SPI1_CSN_PIN));
+
+    struct {
+        uint8_t port;
+        uint32_t speed;
+    } TU_ATTR_PACKED freq = { .port = 1, .speed = 4000000 };
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_SET_FREQUENCY, &freq, sizeof(freq), &rsp));
+    CHECK_EQ(spi_get_baudrate(spi1), 4000000);
+    CHECK_EQ(spi_get_baudrate(spi0), 1000000);
+
+    mock_spi_set_dma_frames_per_poll(16);
+    memset(spi_frames, 0, sizeof(spi_frames));
+
+    len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_READ, 1, &xfer0, 4);
+    CHECK(mock_usb_send(buf, len));
+    len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_READ_WRITE, 2, &xfer1, 4 + xfer1.size);
+    CHECK(mock_usb_send(buf, len));
+
+    uint polls = 1;
+    while (!test_recv(&rsp) && polls < 100)
+        polls++;
+    CHECK_EQ(rsp.hdr.hdr.echo, 2);
+    CHECK_EQ(rsp.len, 2 + 32);
+    CHECK_EQ(spi_frames[1], 32);
+    CHECK(spi_frames[0] > 0 && spi_frames[0] < 200);
+
+    while (!test_recv(&rsp) && polls < 100)
+        polls++;
+    CHECK_EQ(rsp.hdr.hdr.echo, 1);
+    CHECK_EQ(spi_frames[0], 200);
+    mock_spi_set_dma_frames_per_poll(0);
+
+    uint8_t disable[2] = { 1, 0 };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_DISABLE, cs, sizeof(cs)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_DISABLE, disable, sizeof(disable)), DLN2_RES_SUCCESS);
+    CHECK_EQ(mock_gpio_function(SPI1_SCK_PIN), GPIO_FUNC_NULL);
+    spi_teardown();
+}
+
+// Each segment is started from a pass through the main loop
+static uint16_t spi_list_cmd(struct spi_list *list, size_t len, struct test_rsp *rsp)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+
+    len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_TRANSFER_LIST, 5, list, len);
+    CHECK(mock_usb_send(buf, len));
+
+    uint polls = 1;
+    while (!test_recv(rsp) && polls < 200) {
+        mock_time_advance_us(1);
+        polls++;
+    }
+    CHECK_EQ(rsp->hdr.hdr.echo, 5);
+    return rsp->hdr.result;
+}
+
+// A register read: write the command, read the value, all in one request
+static void test_transfer_list(void)
+{
+    struct spi_list list = {
+        .port = 0,
+        .count = 3,
+        .segs = {
+            { .flags = DLN2_SPI_SEGMENT_TX | DLN2_SPI_SEGMENT_CS_CHANGE, .len = 2, .delay_us = 100 },
+            { .flags = DLN2_SPI_SEGMENT_RX, .len = 3 },
+            { .flags = DLN2_SPI_SEGMENT_TX | DLN2_SPI_SEGMENT_RX, .len = 2, .bpw = 8 },
+        },
+        .tx = { 0x9f, 0x01, 0x10, 0x20 },
+    };
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    // Other requests are answered during the delay after the first segment
+    uint64_t start = time_us_64();
+    size_t len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_TRANSFER_LIST, 5, &list, sizeof(list));
+    CHECK(mock_usb_send(buf, len));
+    len = test_build_msg(buf, DLN2_HANDLE_CTRL, DLN2_CMD(0x30, DLN2_MODULE_GENERIC), 6, NULL, 0);
+    CHECK(mock_usb_send(buf, len));
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 6);
+    CHECK(!test_recv(&rsp));
+    CHECK_EQ(spi_written_len, 2);
+
+    mock_time_advance_us(100);
+    for (uint polls = 0; polls < 10 && !test_recv(&rsp); polls++)
+        ;
+    CHECK_EQ(rsp.hdr.hdr.echo, 5);
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    // CS edges take half a clock period each, the CS change adds two of them to the two others
+    CHECK_EQ(time_us_64() - start, 100 + 4 / 2);
+    CHECK_EQ(rsp.len, 2 + 5);
+    CHECK_EQ(rsp.data[0] | rsp.data[1] << 8, 5);
+    CHECK_EQ(rsp.data[2], 0xff);
+    CHECK_EQ(rsp.data[4], 0xff);
+    CHECK_EQ(rsp.data[5], 0xef);
+    CHECK_EQ(rsp.data[6], 0xdf);
+    CHECK_EQ(spi_written_len, 7);
+    CHECK_EQ(spi_written[1], 0x01);
+    CHECK_EQ(spi_written[2], 0x00);
+    CHECK_EQ(spi_written[6], 0x20);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    list.attr = DLN2_SPI_ATTR_LEAVE_SS_LOW;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_SUCCESS);
+    CHECK(!gpio_get_out_level(SPI_CSN_PIN));
+    list.attr = 0;
+
+    spi_written_len = 0;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list) - 1, &rsp), DLN2_RES_INVALID_BUFFER_SIZE);
+    CHECK_EQ(spi_list_cmd(&list, 3 + 2, &rsp), DLN2_RES_INVALID_COMMAND_SIZE);
+    list.segs[2].bpw = 17;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_SPI_INVALID_FRAME_SIZE);
+    // 16-bit words following an odd number of bytes
+    list.segs[2].bpw = 16;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_INVALID_BUFFER_SIZE);
+    list.segs[2].bpw = 0;
+    list.segs[1].flags = 0x80;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_BAD_PARAMETER);
+    list.segs[1].flags = DLN2_SPI_SEGMENT_RX;
+    list.segs[1].len = 256;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_BAD_PARAMETER);
+    list.count = 0;
+    CHECK_EQ(spi_list_cmd(&list, 3, &rsp), DLN2_RES_BAD_PARAMETER);
+    CHECK_EQ(spi_written_len, 0);
+
+    spi_teardown();
+}
+
+static uint32_t spi_set_delay(uint16_t id, uint32_t ns)
+{
+    struct {
+        uint8_t port;
+        uint32_t delay;
+    } TU_ATTR_PACKED cmd = { .port = 0, .delay = ns };
+    struct test_rsp rsp;
+    uint32_t actual = 0;
+
+    CHECK_EQ(spi_cmd(id, &cmd, sizeof(cmd), &rsp), DLN2_RES_SUCCESS);
+    memcpy(&actual, rsp.data, sizeof(actual));
+    return actual;
+}
+
+static uint64_t spi_timed_write(struct spi_xfer *xfer)
+{
+    struct test_rsp rsp;
+    uint64_t start = time_us_64();
+
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, xfer, 4 + xfer->size, &rsp), DLN2_RES_SUCCESS);
+    return time_us_64() - start;
+}
+
+static void test_delays(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 10 };
+    uint8_t port = 0;
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    // By default the CS edges take half a clock period each
+    CHECK_EQ(spi_timed_write(&xfer), 1);
+
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_AFTER_SS, 20000), 20000);
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_GET_DELAY_AFTER_SS, &port, 1, &rsp));
+    CHECK_EQ(rsp.data[0] | rsp.data[1] << 8, 20000);
+    uint64_t us = spi_timed_write(&xfer);
+    CHECK(us >= 20 && us <= 21);
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_AFTER_SS, 0), 0);
+
+    // Only the part of the delay that hasn't passed yet is waited for
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_BETWEEN_SS, 50000), 50000);
+    spi_timed_write(&xfer);
+    CHECK(spi_timed_write(&xfer) >= 50);
+    mock_time_advance_us(100);
+    CHECK(spi_timed_write(&xfer) <= 2);
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_BETWEEN_SS, 0), 0);
+
+    // 8 bit frames at 1MHz paced 1125 cycles apart
+    spi_written_len = 0;
+    for (uint i = 0; i < xfer.size; i++)
+        xfer.buf[i] = i;
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_BETWEEN_FRAMES, 1000), 1000);
+    us = spi_timed_write(&xfer);
+    CHECK(us >= 10 * 9 && us <= 10 * 9 + 2);
+    CHECK_EQ(spi_written_len, 10);
+    CHECK_EQ(spi_written[9], 9);
+
+    // The timer period is limited, a frame and the delay have to fit
+    struct {
+        uint8_t port;
+        uint32_t delay;
+    } TU_ATTR_PACKED delay = { .port = 0, .delay = (65535 - 1000 + 1) * 8 };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_DELAY_BETWEEN_FRAMES, &delay, sizeof(delay)), DLN2_RES_INVALID_VALUE);
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_BETWEEN_FRAMES, (65535 - 1000) * 8), (65535 - 1000) * 8);
+    // A longer frame doesn't fit anymore
+    uint8_t bpw[2] = { 0, 16 };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_FRAME_SIZE, bpw, sizeof(bpw)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_INVALID_VALUE);
+    bpw[1] = 8;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_FRAME_SIZE, bpw, sizeof(bpw)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_BETWEEN_FRAMES, 0), 0);
+    CHECK_EQ(spi_timed_write(&xfer), 1);
+
+    // Reset by the Linux driver probe
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_AFTER_SS, 4000), 4000);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_GET_SS_COUNT, &port, 1), DLN2_RES_SUCCESS);
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_GET_DELAY_AFTER_SS, &port, 1, &rsp));
+    CHECK_EQ(rsp.data[0], 0);
+
+    spi_teardown();
+}
+
+static uint spi_free_dma_timers(void)
+{
+    int claimed[NUM_DMA_TIMERS];
+    uint count = 0;
+    int timer;
+
+    while ((timer = dma_claim_unused_timer(false)) >= 0)
+        claimed[count++] = timer;
+    for (uint i = 0; i < count; i++)
+        dma_timer_unclaim(claimed[i]);
+    return count;
+}
+
+// Disabling in the middle of a write stream closes it and gives back the pacing timer
+static void test_disable(void)
+{
+    struct spi_stream stream = { .port = 0, .size = 100 };
+    struct {
+        uint8_t port;
+        uint8_t buf[4];
+    } TU_ATTR_PACKED data = { .port = 0 };
+    uint8_t disable[2] = { 0, 0 };
+    uint free = spi_free_dma_timers();
+    uint8_t port = 0;
+    struct test_rsp rsp;
+
+    spi_setup();
+    CHECK_EQ(spi_set_delay(DLN2_SPI_SET_DELAY_BETWEEN_FRAMES, 1000), 1000);
+    CHECK_EQ(spi_free_dma_timers(), free - 1);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_WRITE, &stream, sizeof(stream)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_DATA, &data, sizeof(data)), DLN2_RES_SUCCESS);
+    CHECK(!gpio_get_out_level(SPI_CSN_PIN));
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_DISABLE, disable, sizeof(disable)), DLN2_RES_SUCCESS);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+    CHECK_EQ(spi_free_dma_timers(), free);
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_ENABLE, &port, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_DATA, &data, sizeof(data)), DLN2_RES_INVALID_MODE);
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_GET_DELAY_BETWEEN_FRAMES, &port, 1, &rsp));
+    CHECK_EQ(rsp.data[0] | rsp.data[1] << 8, 0);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    spi_teardown();
+}
+
+// 12-bit frames are little endian 16-bit words in the buffers
+static void test_frame_size(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 4, .buf = { 0xbc, 0x0a, 0x23, 0xf1 } };
+    uint8_t bpw[2] = { 0, 3 };
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_FRAME_SIZE, bpw, sizeof(bpw)), DLN2_RES_SPI_INVALID_FRAME_SIZE);
+    bpw[1] = 17;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_FRAME_SIZE, bpw, sizeof(bpw)), DLN2_RES_SPI_INVALID_FRAME_SIZE);
+    bpw[1] = 12;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_FRAME_SIZE, bpw, sizeof(bpw)), DLN2_RES_SUCCESS);
+    CHECK_EQ(mock_spi_data_bits(0), 12);
+
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + 4);
+    CHECK_EQ(rsp.data[2] | rsp.data[3] << 8, 0x543);
+    CHECK_EQ(rsp.data[4] | rsp.data[5] << 8, 0xedc);
+    // The unused bits aren't sent
+    CHECK_EQ(spi_written_len, 4);
+    CHECK_EQ(spi_written[1], 0x0a);
+    CHECK_EQ(spi_written[3], 0x01);
+
+    xfer.size = 3;
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_INVALID_BUFFER_SIZE);
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ, &xfer, 4, &rsp), DLN2_RES_INVALID_BUFFER_SIZE);
+    xfer.size = 6;
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ, &xfer, 4, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.data[2] | rsp.data[3] << 8, 0xfff);
+    CHECK_EQ(spi_written_len, 4 + 6);
+
+    // Unaligned stream data
+    struct spi_stream stream = { .port = 0, .size = 4 };
+    struct {
+        uint8_t port;
+        uint8_t buf[4];
+    } TU_ATTR_PACKED data = { .port = 0, .buf = { 0x34, 0x12, 0x78, 0x56 } };
+    spi_written_len = 0;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_WRITE, &stream, sizeof(stream)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_DATA, &data, 1 + 3), DLN2_RES_INVALID_BUFFER_SIZE);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_STREAM_DATA, &data, sizeof(data)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_written_len, 4);
+    CHECK_EQ(spi_written[0], 0x34);
+    CHECK_EQ(spi_written[1], 0x02);
+    CHECK_EQ(spi_written[3], 0x06);
+
+    bpw[1] = 8;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_FRAME_SIZE, bpw, sizeof(bpw)), DLN2_RES_SUCCESS);
+    spi_teardown();
+}
+
+static void test_bad_size(void)
+{
+    struct spi_xfer xfer = { .port = 0, .size = 4 };
+    struct test_rsp rsp;
+
+    spi_setup();
+
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ_WRITE, &xfer, 4 + 3, &rsp), DLN2_RES_INVALID_BUFFER_SIZE);
+    xfer.size = 257;
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ, &xfer, 4, &rsp), DLN2_RES_BAD_PARAMETER);
+    xfer.port = 2;
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ, &xfer, 4, &rsp), DLN2_RES_INVALID_PORT_NUMBER);
+    CHECK_EQ(spi_written_len, 0);
+
+    spi_teardown();
+}
+
+static uint pio_device_bits;
+static uint pio_device_count;
+
+// Pin level device on the PIO engine port, sampled on the rising SCK edge. MISO is the inverse
+// of MOSI, and when the host releases IO0 a counter is put on IO0-3 instead.
+static void pio_device(uint gpio, bool value)
+{
+    if (gpio != PIO_SCK_PIN || !value || gpio_get_out_level(SPI_CSN_PIN))
+        return;
+
+    if (!gpio_get_dir(PIO_IO0_PIN)) {
+        for (uint i = 0; i < 4; i++)
+            mock_gpio_set_input(PIO_IO0_PIN + i, (pio_device_count >> i) & 1);
+        pio_device_count++;
+        return;
+    }
+
+    bool bit = gpio_get_out_level(PIO_IO0_PIN);
+    mock_gpio_set_input(PIO_IO0_PIN + 1, !bit);
+    if (pio_device_bits++ % 8 == 0 && spi_written_len < sizeof(spi_written))
+        spi_written[spi_written_len++] = 0;
+    spi_written[spi_written_len - 1] = (spi_written[spi_written_len - 1] << 1) | bit;
+}
+
+static void pio_setup(uint8_t flags)
+{
+    struct spi_engine engine = { 0, DLN2_SPI_ENGINE_PIO, flags, PIO_SCK_PIN, PIO_IO0_PIN, PIO_IO0_PIN + 1 };
+    uint8_t port = 0;
+    uint8_t cs[2] = { 0, 0x01 };
+
+    mock_gpio_set_output_hook(pio_device);
+    spi_written_len = 0;
+    pio_device_bits = 0;
+    pio_device_count = 0;
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_ENABLE, &port, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SS_MULTI_ENABLE, cs, sizeof(cs)), DLN2_RES_SUCCESS);
+    CHECK_EQ(mock_gpio_function(PIO_SCK_PIN), GPIO_FUNC_PIO1);
+    CHECK_EQ(mock_gpio_function(PICO_DEFAULT_SPI_SCK_PIN), GPIO_FUNC_NULL);
+}
+
+static void test_pio_engine(void)
+{
+    struct spi_engine engine = { 0, DLN2_SPI_ENGINE_PIO, DLN2_SPI_PIO_QUAD, PIO_SCK_PIN, PIO_IO0_PIN, 7 };
+    struct spi_xfer xfer = { .port = 0, .size = 3, .buf = { 0x9f, 0x5a, 0x01 } };
+    struct spi_list list = {
+        .port = 0,
+        .count = 3,
+        .segs = {
+            { .flags = DLN2_SPI_SEGMENT_TX, .len = 1 },
+            { .flags = DLN2_SPI_SEGMENT_TX, .len = 3 },
+            { .flags = DLN2_SPI_SEGMENT_RX | DLN2_SPI_SEGMENT_QUAD, .len = 3 },
+        },
+        .tx = { 0x6b, 0x00, 0x10, 0x00 },
+    };
+    uint8_t bpw[2] = { 0, 12 };
+    uint8_t port = 0;
+    struct test_rsp rsp;
+
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_GET_SS_COUNT, &port, 1), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_INVALID_PIN_NUMBER);
+    engine.miso = PIO_SCK_PIN;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_INVALID_PIN_NUMBER);
+    engine.flags |= DLN2_SPI_PIO_3WIRE;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_BAD_PARAMETER);
+    engine.engine = 2;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_BAD_PARAMETER);
+    // The controller has fixed pin functions
+    engine = (struct spi_engine){ 0, DLN2_SPI_ENGINE_HW, 0, PICO_DEFAULT_SPI_TX_PIN, PICO_DEFAULT_SPI_SCK_PIN,
+                                  PICO_DEFAULT_SPI_RX_PIN };
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_INVALID_PIN_NUMBER);
+    engine.flags = DLN2_SPI_PIO_LSB_FIRST;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_BAD_PARAMETER);
+
+    pio_setup(DLN2_SPI_PIO_QUAD);
+    CHECK_EQ(spi_cmd(DLN2_SPI_GET_ENGINE, &port, 1, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 5);
+    CHECK_EQ(rsp.data[0], DLN2_SPI_ENGINE_PIO);
+    CHECK_EQ(rsp.data[1], DLN2_SPI_PIO_QUAD);
+    CHECK_EQ(rsp.data[2], PIO_SCK_PIN);
+    CHECK_EQ(rsp.data[4], PIO_IO0_PIN + 1);
+    CHECK_EQ(mock_gpio_function(PIO_IO0_PIN + 3), GPIO_FUNC_PIO1);
+    // IO2 and IO3 are WP# and HOLD# on a flash chip
+    CHECK(gpio_get_out_level(PIO_IO0_PIN + 2));
+    CHECK(gpio_get_out_level(PIO_IO0_PIN + 3));
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_INVALID_MODE);
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_FRAME_SIZE, bpw, sizeof(bpw)), DLN2_RES_SPI_INVALID_FRAME_SIZE);
+
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + 3);
+    CHECK_EQ(spi_written_len, 3);
+    for (uint i = 0; i < xfer.size; i++) {
+        CHECK_EQ(spi_written[i], xfer.buf[i]);
+        CHECK_EQ(rsp.data[2 + i], (uint8_t)~xfer.buf[i]);
+    }
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    // Quad output read: the command on IO0, the data on all four
+    spi_written_len = 0;
+    pio_device_bits = 0;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 2 + 3);
+    CHECK_EQ(rsp.data[2], 0x01);
+    CHECK_EQ(rsp.data[3], 0x23);
+    CHECK_EQ(rsp.data[4], 0x45);
+    CHECK_EQ(spi_written_len, 4);
+    CHECK_EQ(spi_written[0], 0x6b);
+    CHECK_EQ(spi_written[2], 0x10);
+    CHECK(gpio_get_dir(PIO_IO0_PIN));
+    list.segs[2].flags |= DLN2_SPI_SEGMENT_TX;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_BAD_PARAMETER);
+    spi_teardown();
+    CHECK_EQ(mock_gpio_function(PIO_SCK_PIN), GPIO_FUNC_NULL);
+
+    // 3-wire is half duplex on the MOSI pin
+    pio_setup(DLN2_SPI_PIO_LSB_FIRST | DLN2_SPI_PIO_3WIRE);
+    CHECK_EQ(mock_gpio_function(PIO_IO0_PIN + 1), GPIO_FUNC_NULL);
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_INVALID_MODE);
+    list.segs[2].flags = DLN2_SPI_SEGMENT_RX | DLN2_SPI_SEGMENT_QUAD;
+    CHECK_EQ(spi_list_cmd(&list, sizeof(list), &rsp), DLN2_RES_INVALID_MODE);
+    CHECK_EQ(spi_cmd(DLN2_SPI_WRITE, &xfer, 4 + xfer.size, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(spi_written_len, 3);
+    CHECK_EQ(spi_written[0], 0xf9);
+    CHECK_EQ(spi_written[2], 0x80);
+    // The device drives 0, 1, 0, 1... on IO0 which comes in LSB first
+    xfer.size = 1;
+    CHECK_EQ(spi_cmd(DLN2_SPI_READ, &xfer, 4, &rsp), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.data[2], 0xaa);
+    spi_teardown();
+
+    // The flash commands go out MSB first
+    pio_setup(DLN2_SPI_PIO_LSB_FIRST);
+    CHECK_EQ(spi_cmd(DLN2_SPI_FLASH_READ_ID, &port, 1, &rsp), DLN2_RES_BAD_PARAMETER);
+    spi_teardown();
+
+    engine.flags = 0;
+    engine.sck = PICO_DEFAULT_SPI_SCK_PIN;
+    engine.mosi = PICO_DEFAULT_SPI_TX_PIN;
+    CHECK_EQ(spi_port_cmd(DLN2_SPI_SET_ENGINE, &engine, sizeof(engine)), DLN2_RES_SUCCESS);
+}
+
+#define FLASH_SIZE  0x40000
+
+// SPI NOR with 3-byte addresses, the operations are started on the last address byte and it's busy
+// for a few status reads after an erase or program
+static struct {
+    uint8_t mem[FLASH_SIZE];
+    uint8_t op;
+    uint32_t addr;
+    uint pos;
+    bool wel;
+    uint busy;
+    uint busy_polls;
+    uint ops[256];
+} flash;
+
+static void flash_cs(uint gpio, bool value)
+{
+    if (gpio == SPI_CSN_PIN && value)
+        flash.pos = 0;
+}
+
+static void flash_device(uint index, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    for (size_t i = 0; i < len; i++, flash.pos++) {
+        uint8_t out = 0xff;
+
+        if (flash.pos == 0) {
+            flash.op = tx[i];
+            flash.ops[flash.op]++;
+            if (flash.op == 0x06)
+                flash.wel = true;
+        } else if (flash.op == 0x9f) {
+            const uint8_t id[] = { 0xef, 0x40, 0x18 };
+            out = id[(flash.pos - 1) % 3];
+        } else if (flash.op == 0x05) {
+            out = (flash.wel << 1) | !!flash.busy;
+            if (flash.busy)
+                flash.busy--;
+        } else if (flash.pos < 4) {
+            flash.addr = ((flash.addr << 8) | tx[i]) & 0xffffff;
+            if (flash.pos == 3 && flash.op != 0x03) {
+                CHECK(flash.wel && !flash.busy);
+                uint32_t size = flash.op == 0x20 ? 0x1000 : flash.op == 0xd8 ? 0x10000 : 0;
+                uint32_t start = flash.addr & ~(size - 1) & (FLASH_SIZE - 1);
+                if (size)
+                    memset(&flash.mem[start], 0xff, size);
+                flash.wel = false;
+                flash.busy = flash.busy_polls;
+            }
+        } else if (flash.op == 0x03) {
+            out = flash.mem[(flash.addr + flash.pos - 4) % FLASH_SIZE];
+        } else if (flash.op == 0x02) {
+            uint32_t addr = (flash.addr & ~0xff) | ((flash.addr + flash.pos - 4) & 0xff);
+            flash.mem[addr % FLASH_SIZE] &= tx[i];
+        }
+        rx[i] = out;
+    }
+}
+
+// Flash commands are answered when the operations are done, reads come as stream events first
+static uint16_t spi_flash_cmd(uint16_t id, const void *data, size_t len, struct test_rsp *rsp, uint8_t *read)
+{
+    uint8_t buf[DLN2_BUF_SIZE];
+    uint32_t offset = 0;
+
+    len = test_build_msg(buf, DLN2_HANDLE_SPI, id, 9, data, len);
+    CHECK(mock_usb_send(buf, len));
+
+    for (uint polls = 0; polls < 1000; polls++) {
+        if (!test_recv(rsp))
+            continue;
+
+        struct dln2_header *hdr = &rsp->hdr.hdr;
+        if (hdr->handle == DLN2_HANDLE_SPI) {
+            CHECK_EQ(hdr->echo, 9);
+            return rsp->hdr.result;
+        }
+
+        struct spi_stream_event *ev = (struct spi_stream_event *)((uint8_t *)&rsp->hdr + sizeof(*hdr));
+        CHECK_EQ(hdr->id, DLN2_SPI_STREAM_READ_EV);
+        CHECK_EQ(ev->offset, offset);
+        memcpy(read + offset, ev->buf, ev->size);
+        offset += ev->size;
+    }
+
+    CHECK(false);
+    return DLN2_RES_FAIL;
+}
+
+static void test_flash(void)
+{
+    struct spi_flash_range range = { .port = 0, .addr = 0xf000, .size = 0x12000 };
+    struct spi_flash_page page = { .port = 0, .addr = 0x10000 };
+    static uint8_t read[600];
+    uint8_t buf[DLN2_BUF_SIZE];
+    struct test_rsp rsp;
+    uint32_t val;
+
+    spi_setup();
+    mock_spi_set_device(flash_device);
+    mock_gpio_set_output_hook(flash_cs);
+    memset(&flash, 0, sizeof(flash));
+    flash.busy_polls = 2;
+
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_READ_ID, &range, 1, &rsp, NULL), DLN2_RES_SUCCESS);
+    CHECK_EQ(rsp.len, 3);
+    CHECK_EQ(rsp.data[0], 0xef);
+    CHECK_EQ(rsp.data[2], 0x18);
+
+    // A sector up to the block, the block and a sector after it
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_ERASE, &range, sizeof(range), &rsp, NULL), DLN2_RES_SUCCESS);
+    CHECK_EQ(flash.ops[0x20], 2);
+    CHECK_EQ(flash.ops[0xd8], 1);
+    CHECK_EQ(flash.ops[0x06], 3);
+    CHECK_EQ(flash.ops[0x05], 3 * (2 + 1));
+    CHECK_EQ(flash.mem[0xefff], 0);
+    CHECK_EQ(flash.mem[0xf000], 0xff);
+    CHECK_EQ(flash.mem[0x20fff], 0xff);
+    CHECK_EQ(flash.mem[0x21000], 0);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    // The pages are queued without waiting for the responses
+    for (uint i = 0; i < 256; i++)
+        page.buf[i] = i;
+    for (uint i = 0; i < 2; i++) {
+        size_t len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_FLASH_PROGRAM, 20 + i, &page, sizeof(page));
+        CHECK(mock_usb_send(buf, len));
+        page.addr += 256;
+    }
+    for (uint i = 0, polls = 0; i < 2 && polls < 100; polls++) {
+        if (!test_recv(&rsp))
+            continue;
+        CHECK_EQ(rsp.hdr.hdr.echo, 20 + i);
+        CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+        i++;
+    }
+    CHECK_EQ(flash.ops[0x02], 2);
+    CHECK_EQ(flash.mem[0x10000 + 255], 255);
+    CHECK_EQ(flash.mem[0x10000 + 256 + 1], 1);
+
+    range = (struct spi_flash_range){ .port = 0, .addr = 0x10000, .size = sizeof(read) };
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_READ, &range, sizeof(range), &rsp, read), DLN2_RES_SUCCESS);
+    memcpy(&val, rsp.data, sizeof(val));
+    CHECK_EQ(val, sizeof(read));
+    CHECK_EQ(memcmp(read, &flash.mem[0x10000], sizeof(read)), 0);
+    CHECK_EQ(flash.ops[0x03], 1);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    page.addr = 0x20000;
+    memcpy(page.buf, "123456789", 9);
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_PROGRAM, &page, 5 + 9, &rsp, NULL), DLN2_RES_SUCCESS);
+    range = (struct spi_flash_range){ .port = 0, .addr = 0x20000, .size = 9 };
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_CRC32, &range, sizeof(range), &rsp, NULL), DLN2_RES_SUCCESS);
+    memcpy(&val, rsp.data, sizeof(val));
+    CHECK_EQ(val, 0xcbf43926);
+    range.size = 600;
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_CRC32, &range, sizeof(range), &rsp, NULL), DLN2_RES_SUCCESS);
+    CHECK_EQ(flash.ops[0x03], 1 + 1 + 3);
+
+    page.addr = 0x200f0;
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_PROGRAM, &page, 5 + 17, &rsp, NULL), DLN2_RES_BAD_PARAMETER);
+    range = (struct spi_flash_range){ .port = 0, .addr = 0x1000, .size = 0x800 };
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_ERASE, &range, sizeof(range), &rsp, NULL), DLN2_RES_BAD_PARAMETER);
+    range.addr = 0xfff000;
+    range.size = 0x2000;
+    CHECK_EQ(spi_flash_cmd(DLN2_SPI_FLASH_ERASE, &range, sizeof(range), &rsp, NULL), DLN2_RES_BAD_PARAMETER);
+    CHECK_EQ(flash.ops[0x06], 3 + 3);
+
+    // A flash that stays busy
+    flash.busy_polls = ~0u;
+    range = (struct spi_flash_range){ .port = 0, .addr = 0, .size = 0x1000 };
+    size_t len = test_build_msg(buf, DLN2_HANDLE_SPI, DLN2_SPI_FLASH_ERASE, 30, &range, sizeof(range));
+    CHECK(mock_usb_send(buf, len));
+    for (uint i = 0; i < 10; i++)
+        CHECK(!test_recv(&rsp));
+    mock_time_advance_us(10 * 1000 * 1000 + 1);
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.echo, 30);
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_FAIL);
+    CHECK(gpio_get_out_level(SPI_CSN_PIN));
+
+    spi_teardown();
+}
+
+int main(void)
+{
+    RUN_TEST(test_read_write);
+    RUN_TEST(test_read);
+    RUN_TEST(test_write_leave_ss_low);
+    RUN_TEST(test_async);
+    RUN_TEST(test_reset);
+    RUN_TEST(test_in_coalesce_zlp);
+    RUN_TEST(test_stream_read);
+    RUN_TEST(test_stream_write);
+    RUN_TEST(test_ss_pins);
+    RUN_TEST(test_port1);
+    RUN_TEST(test_transfer_list);
+    RUN_TEST(test_delays);
+    RUN_TEST(test_disable);
+    RUN_TEST(test_frame_size);
+    RUN_TEST(test_bad_size);
+    RUN_TEST(test_pio_engine);
+    RUN_TEST(test_flash);
+
+    return test_result();
+}
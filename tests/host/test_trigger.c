@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: CC0-1.0
+/*
+ * Written in 2026 for the host build of the DLN2 core.
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright and related and
+ * neighboring rights to this software to the public domain worldwide. This software is
+ * distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <string.h>
+#include "test.h"
+
+#define DLN2_GPIO_CMD(cmd)       DLN2_CMD(cmd, DLN2_MODULE_GPIO)
+
+#define DLN2_GPIO_PIN_ENABLE            DLN2_GPIO_CMD(0x10)
+#define DLN2_GPIO_PIN_DISABLE           DLN2_GPIO_CMD(0x11)
+#define DLN2_GPIO_PIN_SET_EVENT_CFG     DLN2_GPIO_CMD(0x1E)
+#define DLN2_GPIO_PIN_SET_TRIGGER       DLN2_GPIO_CMD(0x89)
+#define DLN2_GPIO_TRIGGER_EV            DLN2_GPIO_CMD(0x8A)
+
+#define DLN2_GPIO_EVENT_CHANGE          1
+
+#define DLN2_SPI_ENABLE                 DLN2_CMD(0x11, DLN2_MODULE_SPI)
+#define DLN2_SPI_DISABLE                DLN2_CMD(0x12, DLN2_MODULE_SPI)
+#define DLN2_SPI_READ_WRITE             DLN2_CMD(0x1A, DLN2_MODULE_SPI)
+#define DLN2_SPI_READ                   DLN2_CMD(0x1B, DLN2_MODULE_SPI)
+
+#define DLN2_I2C_ENABLE                 DLN2_CMD(0x01, DLN2_MODULE_I2C)
+#define DLN2_I2C_DISABLE                DLN2_CMD(0x02, DLN2_MODULE_I2C)
+#define DLN2_I2C_READ                   DLN2_CMD(0x07, DLN2_MODULE_I2C)
+#define DLN2_I2C_TRANSFER               DLN2_CMD(0x80, DLN2_MODULE_I2C)
+
+#define DRDY_PIN        10
+#define SENSOR_ADDR     0x48
+
+struct event_cfg {
+    uint16_t pin;
+    uint8_t type;
+    uint16_t period;
+} TU_ATTR_PACKED;
+
+struct set_trigger {
+    uint16_t pin;
+    uint8_t msg[DLN2_BUF_SIZE];
+} TU_ATTR_PACKED;
+
+struct trigger_event {
+    uint16_t pin;
+    uint8_t value;
+    uint16_t missed;
+    uint64_t timestamp;
+    uint16_t result;
+    uint8_t data[256];
+} TU_ATTR_PACKED;
+
+#define TRIGGER_EVENT_HDR_SIZE  15
+
+static int i2c_reads;
+
+// MISO is the inverse of MOSI
+static void spi_device(uint index, const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        rx[i] = ~tx[i];
+}
+
+// Counts up from 0x10 on every byte read
+static int i2c_device(uint8_t addr, bool read, uint8_t *buf, size_t len, bool nostop)
+{
+    if (addr != SENSOR_ADDR)
+        return PICO_ERROR_GENERIC;
+
+    for (size_t i = 0; read && i < len; i++)
+        buf[i] = 0x10 + i2c_reads++;
+
+    return len;
+}
+
+static uint16_t set_trigger(uint16_t pin, uint16_t handle, uint16_t id, uint16_t echo, const void *data, size_t len)
+{
+    struct set_trigger cmd = { .pin = pin };
+    struct test_rsp rsp;
+
+    size_t msg_len = handle != DLN2_HANDLE_UNUSED ? test_build_msg(cmd.msg, handle, id, echo, data, len) : 0;
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_SET_TRIGGER, &cmd, sizeof(cmd.pin) + msg_len, &rsp));
+    return rsp.hdr.result;
+}
+
+// The request is queued on one pass of the main loop and handled on the next
+static bool trigger_recv_event(struct trigger_event *ev, uint16_t *echo, size_t *len)
+{
+    struct test_rsp rsp;
+
+    test_tasks();
+    if (!test_recv(&rsp))
+        return false;
+
+    struct dln2_header *hdr = &rsp.hdr.hdr;
+    CHECK_EQ(hdr->handle, DLN2_HANDLE_EVENT);
+    CHECK_EQ(hdr->id, DLN2_GPIO_TRIGGER_EV);
+    memset(ev, 0, sizeof(*ev));
+    memcpy(ev, (uint8_t *)&rsp.hdr + sizeof(*hdr), hdr->size - sizeof(*hdr));
+    *echo = hdr->echo;
+    *len = hdr->size - sizeof(*hdr) - TRIGGER_EVENT_HDR_SIZE;
+    return true;
+}
+
+static void gpio_setup(void)
+{
+    struct event_cfg cfg = { .pin = DRDY_PIN, .type = DLN2_GPIO_EVENT_CHANGE };
+    uint16_t pin = DRDY_PIN;
+    struct test_rsp rsp;
+
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_ENABLE, &pin, sizeof(pin), &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_SET_EVENT_CFG, &cfg, sizeof(cfg), &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+}
+
+// Events are turned off first like the Linux driver does
+static void gpio_teardown(void)
+{
+    struct event_cfg cfg = { .pin = DRDY_PIN };
+    uint16_t pin = DRDY_PIN;
+    struct test_rsp rsp;
+
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_SET_EVENT_CFG, &cfg, sizeof(cfg), &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_DISABLE, &pin, sizeof(pin), &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    mock_gpio_set_input(DRDY_PIN, 0);
+}
+
+static void test_set_errors(void)
+{
+    uint8_t port = 0;
+
+    // Pin not enabled
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_UNUSED, 0, 0, NULL, 0), DLN2_RES_INVALID_PIN_NUMBER);
+
+    gpio_setup();
+
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_DISABLE, 0, &port, 1), DLN2_RES_INVALID_HANDLE);
+
+    struct set_trigger cmd = { .pin = DRDY_PIN };
+    struct test_rsp rsp;
+    size_t len = test_build_msg(cmd.msg, DLN2_HANDLE_SPI, DLN2_SPI_READ_WRITE, 0, &port, 1);
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_SET_TRIGGER, &cmd, sizeof(cmd.pin) + len - 1, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_INVALID_COMMAND_SIZE);
+    CHECK(test_cmd(DLN2_HANDLE_GPIO, DLN2_GPIO_PIN_SET_TRIGGER, &cmd, 1, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_INVALID_COMMAND_SIZE);
+
+    // Removing a trigger that isn't there is fine
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_UNUSED, 0, 0, NULL, 0), DLN2_RES_SUCCESS);
+
+    // Only data transfers and the response has to fit in the event
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_SPI, DLN2_SPI_ENABLE, 0, &port, 1), DLN2_RES_COMMAND_NOT_SUPPORTED);
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_I2C, DLN2_I2C_ENABLE, 0, &port, 1), DLN2_RES_COMMAND_NOT_SUPPORTED);
+    static uint8_t xfer[4 + 251];
+    put_unaligned_le16(251, xfer + 1);
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_SPI, DLN2_SPI_READ_WRITE, 0, xfer, sizeof(xfer)),
+             DLN2_RES_INVALID_BUFFER_SIZE);
+    put_unaligned_le16(249, xfer + 1);
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_SPI, DLN2_SPI_READ, 0, xfer, 4), DLN2_RES_INVALID_BUFFER_SIZE);
+    const struct {
+        uint8_t port;
+        uint8_t count;
+        uint8_t addr;
+        uint8_t flags;
+        uint16_t len;
+    } TU_ATTR_PACKED i2c_read = { 0, 1, SENSOR_ADDR, 1, 249 };
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_I2C, DLN2_I2C_TRANSFER, 0, &i2c_read, sizeof(i2c_read)),
+             DLN2_RES_INVALID_BUFFER_SIZE);
+    put_unaligned_le16(248, xfer + 1);
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_SPI, DLN2_SPI_READ, 0, xfer, 4), DLN2_RES_SUCCESS);
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_UNUSED, 0, 0, NULL, 0), DLN2_RES_SUCCESS);
+
+    gpio_teardown();
+}
+
+static void test_spi(void)
+{
+    struct {
+        uint8_t port;
+        uint16_t size;
+        uint8_t attr;
+        uint8_t buf[3];
+    } TU_ATTR_PACKED xfer = { .size = 3, .buf = { 0x01, 0x02, 0x03 } };
+    struct trigger_event ev;
+    uint8_t port = 0;
+    struct test_rsp rsp;
+    uint16_t echo;
+    size_t len;
+
+    mock_spi_set_device(spi_device);
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_ENABLE, &port, 1, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    gpio_setup();
+
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_SPI, DLN2_SPI_READ_WRITE, 77, &xfer, sizeof(xfer)), DLN2_RES_SUCCESS);
+
+    uint64_t start = time_us_64();
+    mock_time_advance_us(100);
+    mock_gpio_set_input(DRDY_PIN, 1);
+    mock_time_advance_us(50);
+
+    // The response takes the place of the GPIO event
+    CHECK(trigger_recv_event(&ev, &echo, &len));
+    CHECK_EQ(echo, 77);
+    CHECK_EQ(ev.pin, DRDY_PIN);
+    CHECK_EQ(ev.value, 1);
+    CHECK_EQ(ev.missed, 0);
+    CHECK_EQ(ev.timestamp - start, 100);
+    CHECK_EQ(ev.result, DLN2_RES_SUCCESS);
+    CHECK_EQ(len, 2 + 3);
+    CHECK_EQ(ev.data[0] | ev.data[1] << 8, 3);
+    CHECK_EQ(ev.data[2], 0xfe);
+    CHECK_EQ(ev.data[3], 0xfd);
+    CHECK_EQ(ev.data[4], 0xfc);
+    CHECK(!test_recv(&rsp));
+
+    // Edges that come while the transfer is queued are counted
+    mock_gpio_set_input(DRDY_PIN, 0);
+    mock_gpio_set_input(DRDY_PIN, 1);
+    mock_gpio_set_input(DRDY_PIN, 0);
+    CHECK(trigger_recv_event(&ev, &echo, &len));
+    CHECK_EQ(ev.value, 0);
+    CHECK_EQ(ev.missed, 2);
+    CHECK(!test_recv(&rsp));
+
+    mock_gpio_set_input(DRDY_PIN, 1);
+    CHECK(trigger_recv_event(&ev, &echo, &len));
+    CHECK_EQ(ev.missed, 0);
+
+    // Errors are passed on
+    uint8_t disable[2] = { 0, 0 };
+    CHECK(test_cmd(DLN2_HANDLE_SPI, DLN2_SPI_DISABLE, disable, sizeof(disable), &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    mock_gpio_set_input(DRDY_PIN, 0);
+    CHECK(trigger_recv_event(&ev, &echo, &len));
+    CHECK_EQ(echo, 77);
+    CHECK(ev.result != DLN2_RES_SUCCESS);
+    CHECK_EQ(len, 0);
+
+    // Disabling the pin removes the trigger
+    gpio_teardown();
+    gpio_setup();
+    mock_gpio_set_input(DRDY_PIN, 1);
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.id, DLN2_GPIO_CMD(0x0F));
+
+    gpio_teardown();
+}
+
+static void test_i2c(void)
+{
+    struct {
+        uint8_t port;
+        uint8_t addr;
+        uint8_t mem_addr_len;
+        uint32_t mem_addr;
+        uint16_t buf_len;
+    } TU_ATTR_PACKED msg = { .addr = SENSOR_ADDR, .buf_len = 2 };
+    struct trigger_event ev;
+    uint8_t port = 0;
+    struct test_rsp rsp;
+    uint16_t echo;
+    size_t len;
+
+    mock_i2c_set_device(i2c_device);
+    i2c_reads = 0;
+    CHECK(test_cmd(DLN2_HANDLE_I2C, DLN2_I2C_ENABLE, &port, 1, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    gpio_setup();
+
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_I2C, DLN2_I2C_READ, 5, &msg, sizeof(msg)), DLN2_RES_SUCCESS);
+
+    for (uint i = 0; i < 2; i++) {
+        mock_gpio_set_input(DRDY_PIN, !i);
+        CHECK(trigger_recv_event(&ev, &echo, &len));
+        CHECK_EQ(echo, 5);
+        CHECK_EQ(ev.value, !i);
+        CHECK_EQ(ev.result, DLN2_RES_SUCCESS);
+        CHECK_EQ(len, 2 + 2);
+        CHECK_EQ(ev.data[0] | ev.data[1] << 8, 2);
+        CHECK_EQ(ev.data[2], 0x10 + 2 * i);
+        CHECK_EQ(ev.data[3], 0x11 + 2 * i);
+    }
+
+    // Removed, the plain GPIO event is back
+    CHECK_EQ(set_trigger(DRDY_PIN, DLN2_HANDLE_UNUSED, 0, 0, NULL, 0), DLN2_RES_SUCCESS);
+    mock_gpio_set_input(DRDY_PIN, 1);
+    CHECK(test_recv(&rsp));
+    CHECK_EQ(rsp.hdr.hdr.id, DLN2_GPIO_CMD(0x0F));
+
+    CHECK(test_cmd(DLN2_HANDLE_I2C, DLN2_I2C_DISABLE, &port, 1, &rsp));
+    CHECK_EQ(rsp.hdr.result, DLN2_RES_SUCCESS);
+    gpio_teardown();
+}
+
+int main(void)
+{
+    RUN_TEST(test_set_errors);
+    RUN_TEST(test_spi);
+    RUN_TEST(test_i2c);
+
+    return test_result();
+}